@@ -0,0 +1,449 @@
+/******************************************************************************
+  File: aot.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+//! \file aot.c
+//!
+//! chip8-aot: recompiles a CHIP-8 ROM ahead of time into a C file.
+//!
+//! Usage: chip8-aot ROM OUTPUT
+//!
+//! Code is recovered by following every statically known path from the entry
+//! point: fallthrough, both outcomes of each skip, jump and call targets and
+//! the return address of each call. The code is then split into basic blocks,
+//! each becoming one C function, and a dispatcher keyed by pc ties them
+//! together. Indirect control flow (00EE) simply goes back through the
+//! dispatcher, which hands any address it has no block for to the interpreter.
+//!
+//! FX0A, FX33 and FX55 are always interpreted. The latter two are the only
+//! opcodes that write memory, so the dispatcher can tell when they overwrite a
+//! recompiled block and retire that block for good.
+//!
+//! The generated file implements aot.h. See aotmain.c.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcode.h"
+#include "system.h"
+
+//! CHIP-8 addressable memory
+#define MEMORY_SIZE 4096
+
+//! \brief Statically recovered control flow. Unexported.
+struct analysis {
+        unsigned char reachable[MEMORY_SIZE]; //!< Instruction addresses found to be reachable
+        unsigned char leader[MEMORY_SIZE]; //!< Addresses that begin a basic block
+};
+
+//! \brief Reads the instruction at an address
+//! \param[in] memory CHIP-8 memory to be read
+//! \param[in] address Address of the instruction; must be below MEMORY_SIZE - 1
+//! \return The two-byte instruction
+static unsigned short Instruction(const unsigned char *memory, unsigned int address) {
+        return memory[address] << 8 | memory[address + 1];
+}
+
+//! \brief Whether an opcode is recompiled, as opposed to interpreted
+//! \param[in] name Opcode name as returned by OpcodeName(), or NULL
+//! \return non-zero if the opcode is recompiled, otherwise 0
+static int IsRecompiled(const char *name) {
+        if (name == NULL) {
+                return 0;
+        }
+
+        return strcmp(name, "FX0A") != 0 && strcmp(name, "FX33") != 0 && strcmp(name, "FX55") != 0;
+}
+
+//! \brief Whether an opcode always ends a basic block
+//! \param[in] name Opcode name as returned by OpcodeName()
+//! \return non-zero if the opcode changes flow control, otherwise 0
+static int IsTerminator(const char *name) {
+        static const char *const terminators[] = {
+                "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "9XY0", "EX9E", "EXA1",
+        };
+
+        for (int i = 0; i < sizeof(terminators) / sizeof(terminators[0]); i++) {
+                if (strcmp(name, terminators[i]) == 0) {
+                        return !0;
+                }
+        }
+
+        return 0;
+}
+
+//! \brief Gets the statically known addresses executed after an instruction
+//!
+//! A jump to address zero is treated as no jump, just like the interpreter.
+//! Skips have two successors. FX0A has just the one: it has already moved past
+//! itself, so the frontend only has to end the wait once a key is pressed.
+//!
+//! \param[in] memory CHIP-8 memory to be read
+//! \param[in] address Address of the instruction
+//! \param[out] next Successor addresses
+//! \return The number of successors written to next
+static int Successors(const unsigned char *memory, unsigned int address, unsigned int next[2]) {
+        unsigned short instruction = Instruction(memory, address);
+        const char *name = OpcodeName(instruction);
+        unsigned int nnn = instruction & 0x0FFF;
+
+        if (name == NULL || strcmp(name, "00EE") == 0) {
+                return 0;
+        }
+
+        if (strcmp(name, "1NNN") == 0) {
+                next[0] = nnn ? nnn : address + 2;
+                return 1;
+        }
+
+        if (strcmp(name, "2NNN") == 0) {
+                next[0] = nnn ? nnn : address + 2;
+                next[1] = address + 2; // Where 00EE returns to.
+                return 2;
+        }
+
+        if (IsTerminator(name)) { // One of the skips, by now.
+                next[0] = address + 2;
+                next[1] = address + 4;
+                return 2;
+        }
+
+        next[0] = address + 2;
+        return 1;
+}
+
+//! \brief Finds all statically reachable code and its basic block leaders
+//! \param[in] memory CHIP-8 memory to be read
+//! \param[in] entry Address execution starts at
+//! \param[out] a Analysis results
+static void Analyze(const unsigned char *memory, unsigned int entry, struct analysis *a) {
+        static unsigned int worklist[MEMORY_SIZE * 2];
+        unsigned int pending = 0;
+
+        memset(a, 0, sizeof(struct analysis));
+        a->leader[entry] = 1;
+        worklist[pending++] = entry;
+
+        while (pending > 0) {
+                unsigned int address = worklist[--pending];
+                if (address + 1 >= MEMORY_SIZE || a->reachable[address]) {
+                        continue;
+                }
+                a->reachable[address] = 1;
+
+                unsigned int next[2];
+                int count = Successors(memory, address, next);
+
+                // Interpreted instructions are never part of a block, so
+                // whatever follows them starts a new one too.
+                const char *name = OpcodeName(Instruction(memory, address));
+                int ends = (count > 0) && (IsTerminator(name) || !IsRecompiled(name));
+
+                for (int i = 0; i < count; i++) {
+                        if (next[i] >= MEMORY_SIZE) {
+                                continue;
+                        }
+                        if (ends) {
+                                a->leader[next[i]] = 1;
+                        }
+                        worklist[pending++] = next[i];
+                }
+        }
+}
+
+//! \brief Counts the instructions in the basic block starting at an address
+//! \param[in] memory CHIP-8 memory to be read
+//! \param[in] a Analysis results
+//! \param[in] start Leader address of the block
+//! \return The number of instructions in the block; 0 if there is no block
+static unsigned int BlockLength(const unsigned char *memory, const struct analysis *a, unsigned int start) {
+        unsigned int length = 0;
+
+        for (unsigned int address = start; address + 1 < MEMORY_SIZE; address += 2) {
+                if (address != start && a->leader[address]) {
+                        break;
+                }
+
+                const char *name = OpcodeName(Instruction(memory, address));
+                if (!IsRecompiled(name)) {
+                        break;
+                }
+
+                length++;
+                if (IsTerminator(name)) {
+                        break;
+                }
+        }
+
+        return length;
+}
+
+//! \brief Writes the C statements for a single recompiled instruction
+//!
+//! Statements must match the opcode functions in opcode.c exactly. Only
+//! terminators set the pc; otherwise the block does so once at its end.
+//!
+//! \param[in,out] out File to write to
+//! \param[in] address Address of the instruction
+//! \param[in] instruction The instruction
+static void EmitInstruction(FILE *out, unsigned int address, unsigned short instruction) {
+        const char *name = OpcodeName(instruction);
+        unsigned int nnn = instruction & 0x0FFF;
+        unsigned int nn = instruction & 0x00FF;
+        unsigned int n = instruction & 0x000F;
+        unsigned int x = (instruction >> 8) & 0x000F;
+        unsigned int y = (instruction >> 4) & 0x000F;
+        unsigned int target = nnn ? nnn : address + 2;
+
+        fprintf(out, "        // 0x%04X: %04X (%s)\n", address, instruction, name);
+
+#define EMIT(...) fprintf(out, __VA_ARGS__)
+#define IS(opcode) (strcmp(name, opcode) == 0)
+#define EMIT_SKIP_IF(condition, ...) \
+        EMIT("        s->pc = (" condition ") ? 0x%04X : 0x%04X;\n", __VA_ARGS__, address + 4, address + 2)
+
+        if (IS("0NNN")) {
+                // Not implemented by the interpreter either.
+        } else if (IS("00E0")) {
+                EMIT("        SystemClearScreen(s);\n");
+        } else if (IS("00EE")) {
+                EMIT("        SystemStackPop(s);\n        s->pc += 2;\n");
+        } else if (IS("1NNN")) {
+                EMIT("        s->pc = 0x%04X;\n", target);
+        } else if (IS("2NNN")) {
+                EMIT("        s->pc = 0x%04X;\n        SystemStackPush(s);\n        s->pc = 0x%04X;\n", address, target);
+        } else if (IS("3XNN")) {
+                EMIT_SKIP_IF("s->v[%u] == %u", x, nn);
+        } else if (IS("4XNN")) {
+                EMIT_SKIP_IF("s->v[%u] != %u", x, nn);
+        } else if (IS("5XY0")) {
+                EMIT_SKIP_IF("s->v[%u] == s->v[%u]", x, y);
+        } else if (IS("6XNN")) {
+                EMIT("        s->v[%u] = %u;\n", x, nn);
+        } else if (IS("7XNN")) {
+                EMIT("        s->v[%u] += %u;\n", x, nn);
+        } else if (IS("8XY0")) {
+                EMIT("        s->v[%u] = s->v[%u];\n", x, y);
+        } else if (IS("8XY1")) {
+                EMIT("        s->v[%u] |= s->v[%u];\n", x, y);
+        } else if (IS("8XY2")) {
+                EMIT("        s->v[%u] &= s->v[%u];\n", x, y);
+        } else if (IS("8XY3")) {
+                EMIT("        s->v[%u] ^= s->v[%u];\n", x, y);
+        } else if (IS("8XY4")) {
+                EMIT("        val = s->v[%u] + s->v[%u];\n", x, y);
+                EMIT("        s->v[%u] = (unsigned char)val;\n", x);
+                EMIT("        if ((int)(s->v[%u]) != val) s->v[15] = 1;\n", x);
+        } else if (IS("8XY5") || IS("8XY7")) {
+                EMIT("        val = s->v[%u] - s->v[%u];\n", IS("8XY5") ? x : y, IS("8XY5") ? y : x);
+                EMIT("        s->v[%u] = (unsigned char)val;\n", x);
+                EMIT("        s->v[15] = 1;\n");
+                EMIT("        if ((int)(s->v[%u]) != val) s->v[15] = 0;\n", x);
+        } else if (IS("8XY6")) {
+                EMIT("        s->v[15] = s->v[%u] | 0x01;\n        s->v[%u] = (s->v[%u] >> 1);\n", x, x, x);
+        } else if (IS("8XYE")) {
+                EMIT("        s->v[15] = s->v[%u] | 0x80;\n        s->v[%u] = (s->v[%u] << 1);\n", x, x, x);
+        } else if (IS("9XY0")) {
+                EMIT_SKIP_IF("s->v[%u] != s->v[%u]", x, y);
+        } else if (IS("ANNN")) {
+                EMIT("        s->i = %u;\n", nnn);
+        } else if (IS("BNNN")) {
+                EMIT("        s->i = (s->v[0] + %u);\n", nnn);
+        } else if (IS("CXNN")) {
+                EMIT("        s->v[%u] = %u & SystemRandom(s);\n", x, nn);
+        } else if (IS("DXYN")) {
+                EMIT("        SystemDrawSprite(s, s->v[%u], s->v[%u], %u);\n", x, y, n);
+        } else if (IS("EX9E")) {
+                EMIT_SKIP_IF("SystemKeyIsPressed(s, s->v[%u])", x);
+        } else if (IS("EXA1")) {
+                EMIT_SKIP_IF("!SystemKeyIsPressed(s, s->v[%u])", x);
+        } else if (IS("FX07")) {
+                EMIT("        s->v[%u] = SystemDelayTimer(s);\n", x);
+        } else if (IS("FX15")) {
+                EMIT("        SystemSetTimers(s, s->v[%u], -1);\n", x);
+        } else if (IS("FX18")) {
+                EMIT("        SystemSetTimers(s, -1, s->v[%u]);\n        SystemSoundSetTrigger(s, 1);\n", x);
+        } else if (IS("FX1E")) {
+                EMIT("        s->i += s->v[%u];\n", x);
+        } else if (IS("FX29")) {
+                EMIT("        s->i = SystemFontSprite(s, s->v[%u]);\n", x);
+        } else if (IS("FX65")) {
+                EMIT("        for (int i = 0; i <= %u; i++) s->v[i] = s->memory[s->i + i];\n", x);
+        } else {
+                fprintf(stderr, "chip8-aot: Opcode %s can't be recompiled\n", name);
+                exit(1);
+        }
+
+#undef EMIT_SKIP_IF
+#undef IS
+#undef EMIT
+}
+
+//! The runtime half of every generated file
+static const char *const RUNTIME =
+        "\n"
+        "//! \\brief Retires every block overlapping a range of written memory\n"
+        "static void Stored(unsigned int address, unsigned int length) {\n"
+        "        for (unsigned int i = 0; i < BLOCK_COUNT; i++) {\n"
+        "                if (address < BLOCKS[i].end && address + length > BLOCKS[i].start) {\n"
+        "                        retired[i] = 1;\n"
+        "                }\n"
+        "        }\n"
+        "}\n"
+        "\n"
+        "// Described in aot.h\n"
+        "unsigned int AotRun(struct opcode *c, struct system *s, unsigned int count) {\n"
+        "        unsigned int executed = 0;\n"
+        "\n"
+        "        while (executed < count) {\n"
+        "                if (Dispatch(s, count - executed, &executed)) {\n"
+        "                        continue;\n"
+        "                }\n"
+        "\n"
+        "                // No usable block here; interpret a single instruction.\n"
+        "                unsigned int i = s->i;\n"
+        "                unsigned int instruction = (s->pc + 1 < 4096) ? (s->memory[s->pc] << 8 | s->memory[s->pc + 1]) : 0;\n"
+        "                if (OpcodeRun(c, s, 1) == 0) {\n"
+        "                        break; // Unknown instruction.\n"
+        "                }\n"
+        "                executed++;\n"
+        "\n"
+        "                switch (instruction & 0xF0FF) {\n"
+        "                        case 0xF00A: return executed;\n"
+        "                        case 0xF033: Stored(i, 3); break;\n"
+        "                        case 0xF055: Stored(i, ((instruction >> 8) & 0xF) + 1); break;\n"
+        "                }\n"
+        "        }\n"
+        "\n"
+        "        return executed;\n"
+        "}\n";
+
+//! \brief Writes the complete C file for a ROM
+//! \param[in,out] out File to write to
+//! \param[in] path Path of the ROM, for reference
+//! \param[in] rom ROM file contents
+//! \param[in] size Size of the ROM in bytes
+//! \param[in] memory CHIP-8 memory with the ROM loaded
+//! \param[in] a Analysis results
+//! \return The number of blocks written
+static unsigned int Emit(FILE *out, const char *path, const unsigned char *rom, unsigned int size, const unsigned char *memory, const struct analysis *a) {
+        fprintf(out, "// Generated by chip8-aot from %s. Do not edit.\n", path);
+        fprintf(out, "#include <stdlib.h>\n\n#include \"aot.h\"\n#include \"opcode.h\"\n#include \"system.h\"\n\n");
+
+        fprintf(out, "const unsigned int AOT_ROM_SIZE = %u;\n\nconst unsigned char AOT_ROM[] = {", size);
+        for (unsigned int i = 0; i < size; i++) {
+                fprintf(out, "%s0x%02X,", (i % 12 == 0) ? "\n        " : " ", rom[i]);
+        }
+        fprintf(out, "\n};\n");
+
+        unsigned int count = 0;
+        for (unsigned int start = 0; start < MEMORY_SIZE; start++) {
+                unsigned int length = a->leader[start] ? BlockLength(memory, a, start) : 0;
+                if (length == 0) {
+                        continue;
+                }
+
+                fprintf(out, "\nstatic void Block%04X(struct system *s) {\n", start);
+                for (unsigned int i = 0, address = start; i < length; i++, address += 2) {
+                        if ((Instruction(memory, address) & 0xF00F) == 0x8004 || (Instruction(memory, address) & 0xF00D) == 0x8005) {
+                                fprintf(out, "        int val; // Used by 8XY4, 8XY5 and 8XY7\n\n");
+                                break;
+                        }
+                }
+
+                unsigned int address = start;
+                const char *name = NULL;
+                for (unsigned int i = 0; i < length; i++, address += 2) {
+                        unsigned short instruction = Instruction(memory, address);
+                        name = OpcodeName(instruction);
+                        EmitInstruction(out, address, instruction);
+                }
+                if (!IsTerminator(name)) {
+                        fprintf(out, "        s->pc = 0x%04X;\n", address);
+                }
+                fprintf(out, "}\n");
+
+                count++;
+        }
+
+        fprintf(out, "\n#define BLOCK_COUNT %u\n\n", count);
+        fprintf(out, "//! Memory spanned by each block, in order\n");
+        fprintf(out, "static const struct { unsigned short start, end; } BLOCKS[BLOCK_COUNT + 1] = {\n");
+        for (unsigned int start = 0; start < MEMORY_SIZE; start++) {
+                unsigned int length = a->leader[start] ? BlockLength(memory, a, start) : 0;
+                if (length > 0) {
+                        fprintf(out, "        { 0x%04X, 0x%04X },\n", start, start + length * 2);
+                }
+        }
+        fprintf(out, "        { 0, 0 }\n};\n\n");
+        fprintf(out, "//! Blocks whose code has been overwritten since recompiling\n");
+        fprintf(out, "static unsigned char retired[BLOCK_COUNT + 1];\n\n");
+
+        fprintf(out, "//! \\brief Runs the block at pc, if there is one and it fits within remaining\n");
+        fprintf(out, "static int Dispatch(struct system *s, unsigned int remaining, unsigned int *executed) {\n");
+        fprintf(out, "        switch (s->pc) {\n");
+        unsigned int index = 0;
+        for (unsigned int start = 0; start < MEMORY_SIZE; start++) {
+                unsigned int length = a->leader[start] ? BlockLength(memory, a, start) : 0;
+                if (length == 0) {
+                        continue;
+                }
+
+                fprintf(out, "                case 0x%04X:\n", start);
+                fprintf(out, "                        if (retired[%u] || remaining < %u) return 0;\n", index, length);
+                fprintf(out, "                        Block%04X(s);\n", start);
+                fprintf(out, "                        *executed += %u;\n", length);
+                fprintf(out, "                        return !0;\n");
+                index++;
+        }
+        fprintf(out, "        }\n\n        return 0;\n}\n");
+
+        fputs(RUNTIME, out);
+
+        return count;
+}
+
+int main(int argc, char **argv) {
+        if (argc != 3) {
+                printf("chip8-aot ROM OUTPUT\n");
+                return 1;
+        }
+
+        FILE *f = fopen(argv[1], "r");
+        if (f == NULL) {
+                perror("Couldn't open file");
+                return 1;
+        }
+
+        unsigned char *rom = (unsigned char *)malloc(MEMORY_SIZE);
+        unsigned int size = fread(rom, 1, MEMORY_SIZE, f);
+        fclose(f);
+
+        struct system *system = SystemInit(0);
+        if (size == 0 || !SystemLoadProgram(system, rom, size)) {
+                fprintf(stderr, "chip8-aot: Couldn't load program from %s\n", argv[1]);
+                return 1;
+        }
+
+        static struct analysis a;
+        Analyze(system->memory, system->pc, &a);
+
+        FILE *out = fopen(argv[2], "w");
+        if (out == NULL) {
+                perror("Couldn't open output file");
+                return 1;
+        }
+
+        unsigned int blocks = Emit(out, argv[1], rom, size, system->memory, &a);
+        fclose(out);
+
+        printf("%s: %u blocks written to %s\n", argv[1], blocks, argv[2]);
+
+        SystemDeinit(system);
+        free(rom);
+
+        return 0;
+}
@@ -0,0 +1,45 @@
+/******************************************************************************
+  File: aot.h
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+//! \file aot.h
+//!
+//! Interface to a ROM recompiled ahead of time by chip8-aot.
+//!
+//! chip8-aot reads a ROM, recovers as much of its code as static analysis can
+//! find and writes it out as a C file: one function per basic block plus a
+//! dispatcher keyed by pc. That file implements this interface and is compiled
+//! together with aotmain.c, opcode.c and system.c into a dedicated binary.
+//!
+//! Anything the dispatcher has no block for (indirect targets nobody saw,
+//! code that has since been overwritten, FX0A, FX33 and FX55) is executed by
+//! the interpreter via OpcodeRun().
+#ifndef AOT_VERSION
+//! include guard
+#define AOT_VERSION "0.1.0"
+
+struct opcode;
+struct system;
+
+//! The ROM that was recompiled, to be loaded with SystemLoadProgram()
+extern const unsigned char AOT_ROM[];
+
+//! Size of AOT_ROM in bytes
+extern const unsigned int AOT_ROM_SIZE;
+
+//! \brief Executes up to count instructions of the recompiled ROM
+//!
+//! Behaves exactly like OpcodeRun(), which it uses for anything that wasn't
+//! recompiled.
+//!
+//! \param[in,out] opcode Opcode state used to interpret instructions
+//! \param[in,out] system CHIP-8 system state to be read and updated
+//! \param[in] count Maximum number of instructions to execute
+//! \return The number of instructions executed
+unsigned int
+AotRun(struct opcode *opcode, struct system *system, unsigned int count);
+
+#endif // AOT_VERSION
@@ -0,0 +1,154 @@
+/******************************************************************************
+  File: aotcheck.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+//! \file aotcheck.c
+//!
+//! Checks a ROM recompiled by chip8-aot against the interpreter.
+//!
+//! Usage: ROM-check [-n INSTRUCTIONS]
+//!
+//! Runs the recompiled ROM and OpcodeRun() side by side on two systems, in
+//! batches of varying size, and compares registers, I, pc, the stack, memory
+//! and the framebuffer after every batch. Both see the same keys and the same
+//! random numbers, and their timers don't run. Exits non-zero at the first
+//! difference.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+#include "opcode.h"
+#include "system.h"
+
+#define MEMORY_SIZE 4096 //!< Size of the CHIP-8's addressable memory
+#define GRAPHICS_MEM_SIZE 64*32 //!< Size of the framebuffer
+
+//! \brief Creates a system running AOT_ROM that behaves the same every time
+//! \return The initialized system object
+static struct system *CheckSystem() {
+        struct system *system = SystemInit(0);
+        if (NULL == system) {
+                return NULL;
+        }
+
+        SystemLoadProgram(system, (unsigned char *)AOT_ROM, AOT_ROM_SIZE);
+        SystemRandomSeed(system, 1);
+        SystemVirtualTimeSet(system, 500); // Timers only tick in SystemRunCycles(), which we don't use.
+
+        return system;
+}
+
+//! \brief Reports the first difference between the two systems
+//! \param[in] want system run by the interpreter
+//! \param[in] got system run by the recompiled ROM
+//! \return 1 if they differ, otherwise 0
+static int Compare(struct system *want, struct system *got) {
+        for (int i = 0; i < sizeof(want->v); i++) {
+                if (want->v[i] != got->v[i]) {
+                        printf("V%X: got 0x%02X, want 0x%02X\n", i, got->v[i], want->v[i]);
+                        return 1;
+                }
+        }
+        if (want->i != got->i) {
+                printf("I: got 0x%03X, want 0x%03X\n", got->i, want->i);
+                return 1;
+        }
+        if (want->pc != got->pc) {
+                printf("pc: got 0x%03X, want 0x%03X\n", got->pc, want->pc);
+                return 1;
+        }
+        if (want->sp != got->sp || memcmp(want->stack, got->stack, sizeof(want->stack)) != 0) {
+                printf("stack differs\n");
+                return 1;
+        }
+        if (memcmp(want->memory, got->memory, MEMORY_SIZE) != 0) {
+                printf("memory differs\n");
+                return 1;
+        }
+        if (memcmp(want->gfx, got->gfx, GRAPHICS_MEM_SIZE) != 0) {
+                printf("framebuffer differs\n");
+                return 1;
+        }
+
+        return 0;
+}
+
+int main(int argc, char **argv) {
+        unsigned long instructions = 1000000;
+
+        if (argc == 3 && strcmp(argv[1], "-n") == 0) {
+                instructions = strtoul(argv[2], NULL, 10);
+        } else if (argc != 1) {
+                printf("%s [-n INSTRUCTIONS]\n", argv[0]);
+                return 1;
+        }
+
+        struct system *want = CheckSystem();
+        struct system *got = CheckSystem();
+        struct opcode *wantOpcode = OpcodeInit();
+        struct opcode *gotOpcode = OpcodeInit();
+        if (NULL == want || NULL == got || NULL == wantOpcode || NULL == gotOpcode) {
+                fprintf(stderr, "Couldn't initialize\n");
+                return 1;
+        }
+
+        // Odd batch sizes end batches in the middle of recompiled blocks.
+        unsigned int sizes[] = { 1, 7, 64, 1000 };
+        unsigned long executed = 0;
+        int differ = 0;
+
+        for (unsigned long batch = 0; executed < instructions; batch++) {
+                unsigned long remaining = instructions - executed;
+                unsigned int size = sizes[batch % (sizeof(sizes) / sizeof(sizes[0]))];
+                if (remaining < size) {
+                        size = remaining;
+                }
+
+                // Hold a different key every so often.
+                unsigned int key = (batch / 16) % 16;
+                for (int k = 0; k < 16; k++) {
+                        SystemKeySetPressed(want, k, k == key);
+                        SystemKeySetPressed(got, k, k == key);
+                }
+
+                unsigned int pc = want->pc;
+                unsigned int wantCount = OpcodeRun(wantOpcode, want, size);
+                unsigned int gotCount = AotRun(gotOpcode, got, size);
+                if (wantCount != gotCount) {
+                        printf("ran %u instructions, want %u\n", gotCount, wantCount);
+                        differ = 1;
+                } else {
+                        differ = Compare(want, got);
+                }
+                if (differ) {
+                        printf("after %lu instructions, in a batch of %u from 0x%03X\n", executed, size, pc);
+                        break;
+                }
+                executed += wantCount;
+
+                if (SystemWFKWaiting(want)) {
+                        // FX0A has already moved pc on; just end the wait.
+                        SystemWFKOccurred(want, key);
+                        SystemWFKStop(want);
+                        SystemWFKOccurred(got, key);
+                        SystemWFKStop(got);
+                } else if (wantCount == 0) {
+                        break; // Unknown instruction.
+                }
+        }
+
+        if (!differ) {
+                printf("%lu instructions match\n", executed);
+        }
+
+        OpcodeDeinit(gotOpcode);
+        OpcodeDeinit(wantOpcode);
+        SystemDeinit(got);
+        SystemDeinit(want);
+
+        return differ;
+}
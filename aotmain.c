@@ -0,0 +1,69 @@
+/******************************************************************************
+  File: aotmain.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+//! \file aotmain.c
+//!
+//! Entrypoint for a ROM recompiled by chip8-aot.
+//!
+//! Usage: ROM [-n INSTRUCTIONS]
+//!
+//! Runs the recompiled ROM with no pacing, no graphics and no sound, then
+//! reports how many instructions were executed and how quickly. Whenever the
+//! ROM waits for a keypress, key 0 is pressed immediately.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aot.h"
+#include "opcode.h"
+#include "system.h"
+
+int main(int argc, char **argv) {
+        unsigned long instructions = 20000000;
+
+        if (argc == 3 && strcmp(argv[1], "-n") == 0) {
+                instructions = strtoul(argv[2], NULL, 10);
+        } else if (argc != 1) {
+                printf("%s [-n INSTRUCTIONS]\n", argv[0]);
+                return 1;
+        }
+
+        struct system *system = SystemInit(0);
+        struct opcode *opcode = OpcodeInit();
+        SystemLoadProgram(system, (unsigned char *)AOT_ROM, AOT_ROM_SIZE);
+        OpcodeSetEngine(opcode, OPCODE_ENGINE_THREADED);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        unsigned long executed = 0;
+        while (executed < instructions) {
+                unsigned long remaining = instructions - executed;
+                unsigned int count = AotRun(opcode, system, remaining < 10000 ? remaining : 10000);
+                executed += count;
+
+                if (SystemWFKWaiting(system)) {
+                        // FX0A has already moved pc on; just end the wait.
+                        SystemWFKOccurred(system, 0);
+                        SystemWFKStop(system);
+                } else if (count == 0) {
+                        break; // Unknown instruction.
+                }
+        }
+
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        printf("%lu instructions in %.3fs (%.0f/s)\n", executed, seconds, executed / seconds);
+
+        OpcodeDeinit(opcode);
+        SystemDeinit(system);
+
+        return 0;
+}
@@ -0,0 +1,516 @@
+/******************************************************************************
+  File: batch.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+//! \file batch.c
+//!
+//! Runs many ROMs headless, in parallel, from one process.
+//!
+//! Usage: chip8-batch [-j THREADS] [-e ENGINE] [-q QUIRKS] [-c CYCLES]
+//!                    [-f FRAMES] [-r SEED] [-s SCENARIOS] [ROM...]
+//!
+//! Each ROM argument is run once within the -c and -f budgets, seeded with
+//! -r. Each line of a SCENARIOS file ("-" for stdin) is a job of its own:
+//!
+//!     # ROM [cycles=N] [frames=N] [seed=N] [keys=FRAME:KEY+,FRAME:KEY-,...]
+//!     games/PONG frames=600 seed=7
+//!     games/BRIX frames=1200 keys=10:4+,40:4-,50:6+
+//!
+//! where `10:4+` presses key 4 at the start of frame 10 and `40:4-` releases
+//! it. Jobs run as in `chip8 --headless`; see HeadlessExecute(). Each job has
+//! its own system and random number generator, so its result doesn't depend
+//! on which worker ran it or what ran alongside.
+//!
+//! Jobs are shared out between THREADS workers (default: one per CPU), each
+//! with its own deque. A worker takes jobs from the back of its own deque, and
+//! once that's empty steals from the front of the others', so a few slow ROMs
+//! don't leave the other workers idle.
+//!
+//! A line per job is printed in the order given, with the final framebuffer
+//! hash, instructions executed, frames run and wall time.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h> // sysconf
+
+#include "opcode.h"
+#include "system.h"
+
+//! Instructions run per second, as in main.c
+#define CYCLES_HZ 500
+
+#include "headless.c"
+
+//! One ROM and scenario to run, and what running it did
+struct batch_job {
+        char *rom; //!< Path to the program ROM
+        char *scenario; //!< Scenario line it came from, or NULL for a ROM argument
+        struct headless_job run; //!< Budget and input script
+        struct headless_result result; //!< Filled in by the worker that ran it
+        unsigned long long hash; //!< Final framebuffer, see HeadlessFrameHash()
+        const char *error; //!< Why it couldn't run, or NULL
+};
+
+//! A worker's jobs; the owner works from the back and thieves from the front
+struct batch_deque {
+        pthread_mutex_t lock;
+        unsigned int front; //!< First job index not yet taken
+        unsigned int back; //!< One past the last job index not yet taken
+        unsigned long steals; //!< Jobs this worker stole from others
+};
+
+//! Everything the workers share
+struct batch {
+        struct batch_job *jobs;
+        unsigned int jobCount;
+        struct batch_deque *deques; //!< One per worker
+        unsigned int workers;
+        enum opcode_engine engine;
+        enum opcode_profile profile;
+};
+
+//! What a worker thread is given
+struct batch_worker {
+        struct batch *batch;
+        unsigned int index; //!< Which of batch->deques it owns
+        pthread_t thread;
+};
+
+//! \brief Takes the last job from a worker's own deque
+//! \param[in,out] deque Deque to take from
+//! \return Job index, or -1 if it's empty
+static long DequePopBack(struct batch_deque *deque) {
+        long job = -1;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->front < deque->back) {
+                job = --deque->back;
+        }
+        pthread_mutex_unlock(&deque->lock);
+        return job;
+}
+
+//! \brief Takes the first job from another worker's deque
+//! \param[in,out] deque Deque to take from
+//! \return Job index, or -1 if it's empty
+static long DequeStealFront(struct batch_deque *deque) {
+        long job = -1;
+        pthread_mutex_lock(&deque->lock);
+        if (deque->front < deque->back) {
+                job = deque->front++;
+        }
+        pthread_mutex_unlock(&deque->lock);
+        return job;
+}
+
+//! \brief Reads a whole file
+//! \param[in] path File to read
+//! \param[out] size Bytes read
+//! \return malloc'd contents, or NULL on failure
+static unsigned char *ReadFile(const char *path, size_t *size) {
+        FILE *f = fopen(path, "rb");
+        if (f == NULL) {
+                return NULL;
+        }
+
+        size_t capacity = 4096;
+        unsigned char *data = malloc(capacity);
+        *size = 0;
+        size_t got;
+        while (data != NULL && (got = fread(&data[*size], 1, capacity - *size, f)) > 0) {
+                *size += got;
+                if (*size == capacity) {
+                        capacity *= 2;
+                        unsigned char *grown = realloc(data, capacity);
+                        if (grown == NULL) {
+                                free(data);
+                        }
+                        data = grown;
+                }
+        }
+
+        fclose(f);
+        return data;
+}
+
+//! \brief Runs a job on a fresh system and opcode instance
+//! \param[in] batch Engine and profile to use
+//! \param[in,out] job Job to run; its result is filled in
+static void BatchRunJob(struct batch *batch, struct batch_job *job) {
+        size_t size;
+        unsigned char *program = ReadFile(job->rom, &size);
+        if (program == NULL) {
+                job->error = "couldn't read ROM";
+                return;
+        }
+
+        struct system *sys = SystemInit(0);
+        struct opcode *opcode = OpcodeInit();
+        if (sys == NULL || opcode == NULL) {
+                job->error = "couldn't initialize";
+        } else if (!SystemLoadProgram(sys, program, size)) {
+                job->error = "ROM too large";
+        } else {
+                OpcodeSetEngine(opcode, batch->engine);
+                OpcodeSetProfile(opcode, batch->profile);
+                job->result = HeadlessExecute(sys, opcode, &job->run);
+                job->hash = HeadlessFrameHash(sys);
+        }
+
+        if (opcode != NULL)
+                OpcodeDeinit(opcode);
+        if (sys != NULL)
+                SystemDeinit(sys);
+        free(program);
+}
+
+//! \brief Runs jobs until there are none left to run or steal
+//! \param[in,out] arg struct batch_worker
+//! \return NULL
+static void *BatchWorker(void *arg) {
+        struct batch_worker *worker = (struct batch_worker *)arg;
+        struct batch *batch = worker->batch;
+        struct batch_deque *own = &batch->deques[worker->index];
+
+        while (1) {
+                long job = DequePopBack(own);
+                for (unsigned int i = 1; job < 0 && i < batch->workers; i++) {
+                        job = DequeStealFront(&batch->deques[(worker->index + i) % batch->workers]);
+                        if (job >= 0) {
+                                own->steals++;
+                        }
+                }
+
+                // Jobs are only ever taken, so once every deque is empty the batch is done.
+                if (job < 0) {
+                        return NULL;
+                }
+
+                BatchRunJob(batch, &batch->jobs[job]);
+        }
+}
+
+//! \brief Parses a whole string as a number
+//! \param[in] text String to parse
+//! \param[in] base Base as for strtoull(), 0 to accept a 0x prefix
+//! \param[out] value Parsed number
+//! \return 1 on success, otherwise 0
+static int ParseNumber(const char *text, int base, unsigned long long *value) {
+        char *end;
+        *value = strtoull(text, &end, base);
+        return end != text && *end == '\0';
+}
+
+//! \brief Parses a key script such as `10:4+,40:4-`
+//! \param[in] text Script to parse
+//! \param[out] job Job to store the script in
+//! \return 1 on success, otherwise 0
+static int ParseKeys(const char *text, struct headless_job *job) {
+        unsigned int capacity = 1;
+        for (const char *c = text; *c; c++) {
+                capacity += (*c == ',');
+        }
+
+        struct headless_key *keys = calloc(capacity, sizeof(struct headless_key));
+        unsigned int count = 0;
+        while (keys != NULL && *text) {
+                char *end;
+                unsigned long long frame = strtoull(text, &end, 10);
+                if (end == text || *end != ':' || count == capacity) {
+                        break;
+                }
+                text = end + 1;
+
+                unsigned long key = strtoul(text, &end, 16);
+                if (end != text + 1 || key > 0xF || (*end != '+' && *end != '-')) {
+                        break;
+                }
+                if (count > 0 && frame < keys[count - 1].frame) {
+                        break; // Out of order
+                }
+
+                keys[count++] = (struct headless_key){ frame, key, *end == '+' };
+                text = end + 1;
+                if (*text == ',') {
+                        text++;
+                } else if (*text != '\0') {
+                        break;
+                }
+        }
+
+        if (keys == NULL || *text) {
+                free(keys);
+                return 0;
+        }
+
+        job->keys = keys;
+        job->keyCount = count;
+        return 1;
+}
+
+//! \brief Parses a scenario line into a job
+//! \param[in] line Line without its newline
+//! \param[in] defaults Budget and seed for options the line leaves out
+//! \param[out] job Job to fill in
+//! \return 1 on success, otherwise 0
+static int ParseScenario(const char *line, const struct headless_job *defaults, struct batch_job *job) {
+        memset(job, 0, sizeof(struct batch_job));
+        job->run = *defaults;
+        job->scenario = strdup(line);
+
+        char *copy = strdup(line);
+        char *save;
+        char *token = strtok_r(copy, " \t", &save);
+        job->rom = strdup(token);
+
+        int ok = 1;
+        while (ok && (token = strtok_r(NULL, " \t", &save)) != NULL) {
+                if (strncmp(token, "cycles=", 7) == 0) {
+                        ok = ParseNumber(&token[7], 10, &job->run.cycles);
+                } else if (strncmp(token, "frames=", 7) == 0) {
+                        ok = ParseNumber(&token[7], 10, &job->run.frames);
+                } else if (strncmp(token, "seed=", 5) == 0) {
+                        ok = ParseNumber(&token[5], 0, &job->run.seed);
+                } else if (strncmp(token, "keys=", 5) == 0) {
+                        ok = ParseKeys(&token[5], &job->run);
+                } else {
+                        ok = 0;
+                }
+        }
+
+        free(copy);
+        return ok;
+}
+
+//! \brief Adds the jobs in a scenario file
+//! \param[in] path File to read, or "-" for stdin
+//! \param[in] defaults Budget and seed for options a line leaves out
+//! \param[in,out] jobs Growing array of jobs
+//! \param[in,out] count Number of entries in jobs
+//! \return 1 on success, otherwise 0
+static int ReadScenarios(const char *path, const struct headless_job *defaults, struct batch_job **jobs, unsigned int *count) {
+        FILE *f = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+        if (f == NULL) {
+                perror(path);
+                return 0;
+        }
+
+        char *line = NULL;
+        size_t lineSize = 0;
+        unsigned int lineNumber = 0;
+        int ok = 1;
+        while (ok && getline(&line, &lineSize, f) != -1) {
+                lineNumber++;
+                line[strcspn(line, "\r\n")] = '\0';
+
+                char *start = line + strspn(line, " \t");
+                if (*start == '\0' || *start == '#') {
+                        continue;
+                }
+
+                struct batch_job *grown = realloc(*jobs, (*count + 1) * sizeof(struct batch_job));
+                if (grown == NULL) {
+                        fprintf(stderr, "%s:%u: out of memory\n", path, lineNumber);
+                        ok = 0;
+                        break;
+                }
+                *jobs = grown;
+
+                if (!ParseScenario(start, defaults, &(*jobs)[*count])) {
+                        fprintf(stderr, "%s:%u: couldn't parse scenario\n", path, lineNumber);
+                        ok = 0;
+                }
+                (*count)++;
+        }
+
+        free(line);
+        if (f != stdin) {
+                fclose(f);
+        }
+
+        return ok;
+}
+
+//! \brief Displays proper program invocation on the CLI
+static void Usage() {
+        printf("chip8-batch [-j THREADS] [-e ENGINE] [-q QUIRKS] [-c CYCLES] [-f FRAMES] [-r SEED] [-s SCENARIOS] [ROM...]\n");
+        printf("\t-j THREADS: workers to run jobs on, default one per CPU\n");
+        printf("\t-e ENGINE: interpreter engine, one of: reference, threaded (default), jit\n");
+        printf("\t-q QUIRKS: variant to emulate, one of: default, vip, schip, xochip\n");
+        printf("\t-c CYCLES: default instruction budget per job\n");
+        printf("\t-f FRAMES: default budget per job in 60Hz frames\n");
+        printf("\t-r SEED: default seed for the random numbers CXNN draws, default 0\n");
+        printf("\t-s SCENARIOS: file of jobs, one per line, or - for stdin\n");
+}
+
+int main(int argc, char **argv) {
+        struct batch batch = {
+                .jobs = NULL,
+                .jobCount = 0,
+                .workers = sysconf(_SC_NPROCESSORS_ONLN),
+                .engine = OPCODE_ENGINE_THREADED,
+                .profile = OPCODE_PROFILE_DEFAULT
+        };
+        struct headless_job defaults = { 0, 0, NULL, 0, 0 };
+        const char *scenarios[argc];
+        int scenarioCount = 0;
+
+        int opt;
+        while ((opt = getopt(argc, argv, "c:e:f:j:q:r:s:")) != -1) {
+                switch (opt) {
+                        case 'c':
+                                if (!ParseNumber(optarg, 10, &defaults.cycles)) {
+                                        Usage();
+                                        return 1;
+                                }
+                                break;
+
+                        case 'e':
+                                if (strcmp(optarg, "reference") == 0) {
+                                        batch.engine = OPCODE_ENGINE_REFERENCE;
+                                } else if (strcmp(optarg, "threaded") == 0) {
+                                        batch.engine = OPCODE_ENGINE_THREADED;
+                                } else if (strcmp(optarg, "jit") == 0) {
+                                        batch.engine = OPCODE_ENGINE_JIT;
+                                } else {
+                                        Usage();
+                                        return 1;
+                                }
+                                break;
+
+                        case 'f':
+                                if (!ParseNumber(optarg, 10, &defaults.frames)) {
+                                        Usage();
+                                        return 1;
+                                }
+                                break;
+
+                        case 'j':
+                                batch.workers = strtoul(optarg, NULL, 10);
+                                break;
+
+                        case 'q':
+                                if (strcmp(optarg, "default") == 0) {
+                                        batch.profile = OPCODE_PROFILE_DEFAULT;
+                                } else if (strcmp(optarg, "vip") == 0) {
+                                        batch.profile = OPCODE_PROFILE_COSMAC_VIP;
+                                } else if (strcmp(optarg, "schip") == 0) {
+                                        batch.profile = OPCODE_PROFILE_SCHIP;
+                                } else if (strcmp(optarg, "xochip") == 0) {
+                                        batch.profile = OPCODE_PROFILE_XO_CHIP;
+                                } else {
+                                        Usage();
+                                        return 1;
+                                }
+                                break;
+
+                        case 'r':
+                                if (!ParseNumber(optarg, 0, &defaults.seed)) {
+                                        Usage();
+                                        return 1;
+                                }
+                                break;
+
+                        case 's':
+                                scenarios[scenarioCount++] = optarg;
+                                break;
+
+                        default:
+                                Usage();
+                                return 1;
+                }
+        }
+
+        if (batch.workers == 0) {
+                batch.workers = 1;
+        }
+
+        for (int i = 0; i < scenarioCount; i++) {
+                if (!ReadScenarios(scenarios[i], &defaults, &batch.jobs, &batch.jobCount)) {
+                        return 1;
+                }
+        }
+
+        for (int i = optind; i < argc; i++) {
+                struct batch_job *grown = realloc(batch.jobs, (batch.jobCount + 1) * sizeof(struct batch_job));
+                if (grown == NULL) {
+                        fprintf(stderr, "Out of memory\n");
+                        return 1;
+                }
+                batch.jobs = grown;
+                batch.jobs[batch.jobCount++] = (struct batch_job){ .rom = strdup(argv[i]), .scenario = NULL, .run = defaults };
+        }
+
+        if (batch.jobCount == 0) {
+                Usage();
+                return 1;
+        }
+
+        if (batch.workers > batch.jobCount) {
+                batch.workers = batch.jobCount;
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        // Deal out contiguous runs of jobs; stealing evens out the rest.
+        batch.deques = calloc(batch.workers, sizeof(struct batch_deque));
+        struct batch_worker *workers = calloc(batch.workers, sizeof(struct batch_worker));
+        for (unsigned int w = 0; w < batch.workers; w++) {
+                pthread_mutex_init(&batch.deques[w].lock, NULL);
+                batch.deques[w].front = (unsigned long long)batch.jobCount * w / batch.workers;
+                batch.deques[w].back = (unsigned long long)batch.jobCount * (w + 1) / batch.workers;
+                workers[w] = (struct batch_worker){ .batch = &batch, .index = w };
+        }
+
+        for (unsigned int w = 1; w < batch.workers; w++) {
+                if (0 != pthread_create(&workers[w].thread, NULL, BatchWorker, &workers[w])) {
+                        fprintf(stderr, "Couldn't create worker %u\n", w);
+                        return 1;
+                }
+        }
+        BatchWorker(&workers[0]);
+
+        unsigned long steals = 0;
+        for (unsigned int w = 0; w < batch.workers; w++) {
+                if (w > 0) {
+                        pthread_join(workers[w].thread, NULL);
+                }
+                steals += batch.deques[w].steals;
+                pthread_mutex_destroy(&batch.deques[w].lock);
+        }
+
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        int failed = 0;
+        unsigned long long instructions = 0;
+        printf("# rom\tgfx\tinstructions\tframes\twall_ms\tstatus\tscenario\n");
+        for (unsigned int j = 0; j < batch.jobCount; j++) {
+                struct batch_job *job = &batch.jobs[j];
+                const char *status = job->error ? job->error : job->result.unknownInstruction ? "unknown instruction" : "ok";
+                printf("%s\t0x%016llX\t%llu\t%llu\t%.3f\t%s\t%s\n", job->rom, job->hash, job->result.instructions,
+                       job->result.frames, job->result.seconds * 1000, status, job->scenario ? job->scenario : "");
+
+                failed |= (job->error != NULL);
+                instructions += job->result.instructions;
+
+                free(job->rom);
+                free(job->scenario);
+                free((void *)job->run.keys);
+        }
+
+        fprintf(stderr, "%u jobs on %u workers in %.3fs, %lu stolen, %.0f instructions/s\n",
+                batch.jobCount, batch.workers, seconds, steals, instructions / seconds);
+
+        free(workers);
+        free(batch.deques);
+        free(batch.jobs);
+
+        return failed;
+}
@@ -0,0 +1,146 @@
+/******************************************************************************
+  File: cycles_bench.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+//! \file cycles_bench.c
+//!
+//! Measures emulated instructions per second through SystemRunCycles() with
+//! the threaded engine, for several batch sizes.
+//!
+//! Usage: cycles_bench [-n INSTRUCTIONS] ROM...
+//!
+//! ROMs run in virtual time, with no pacing, no graphics and no sound; see
+//! engine_bench.c. Whenever a ROM waits for a keypress, key 0 is pressed
+//! immediately.
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../opcode.h"
+#include "../system.h"
+
+//! Batch sizes handed to SystemRunCycles()
+static const unsigned int BATCHES[] = { 1, 8, 1000 };
+
+//! Number of entries in BATCHES
+#define BATCH_COUNT (sizeof(BATCHES) / sizeof(BATCHES[0]))
+
+//! Emulated instructions per second, as in main.c
+#define BENCH_CYCLES_HZ 500
+
+//! \brief Reads an entire ROM file into memory
+//! \param[in] path ROM file to read
+//! \param[out] size Size of the ROM in bytes
+//! \return The ROM, to be freed by the caller, or NULL on error
+static unsigned char *ReadRom(const char *path, unsigned int *size) {
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+                perror("Couldn't open file");
+                return NULL;
+        }
+
+        unsigned char *rom = (unsigned char *)malloc(4096);
+        *size = fread(rom, 1, 4096, f);
+        fclose(f);
+
+        return rom;
+}
+
+//! \brief Runs a ROM in batches for the given number of instructions
+//! \param[in] rom ROM to be loaded
+//! \param[in] size Size of the ROM in bytes
+//! \param[in] batch Instructions per call to SystemRunCycles()
+//! \param[in] instructions How many instructions to execute
+//! \return Instructions executed per second
+static double Run(unsigned char *rom, unsigned int size, unsigned int batch, unsigned long instructions) {
+        struct system *system = SystemInit(0);
+        struct opcode *opcode = OpcodeInit();
+        SystemLoadProgram(system, rom, size);
+        OpcodeSetEngine(opcode, OPCODE_ENGINE_THREADED);
+        SystemVirtualTimeSet(system, BENCH_CYCLES_HZ);
+        SystemRandomSeed(system, 1);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        unsigned long executed = 0;
+        while (executed < instructions) {
+                unsigned long remaining = instructions - executed;
+                unsigned int count = SystemRunCycles(system, opcode, remaining < batch ? remaining : batch);
+                executed += count;
+
+                if (SystemWFKWaiting(system)) {
+                        // FX0A has already moved pc on; just end the wait.
+                        SystemWFKOccurred(system, 0);
+                        SystemWFKStop(system);
+                } else if (count == 0) {
+                        break; // Unknown instruction.
+                }
+        }
+
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        OpcodeDeinit(opcode);
+        SystemDeinit(system);
+
+        return executed / seconds;
+}
+
+int main(int argc, char **argv) {
+        unsigned long instructions = 20000000;
+        int first = 1;
+
+        if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+                instructions = strtoul(argv[2], NULL, 10);
+                first = 3;
+        }
+
+        if (first >= argc) {
+                printf("cycles_bench [-n INSTRUCTIONS] ROM...\n");
+                return 1;
+        }
+
+        printf("struct system: %zu bytes; pc at offset %zu, stack at %zu, memory at %zu, gfx at %zu\n",
+               sizeof(struct system), offsetof(struct system, pc), offsetof(struct system, stack),
+               offsetof(struct system, memory), offsetof(struct system, gfx));
+
+        printf("%-24s", "rom");
+        for (int b = 0; b < BATCH_COUNT; b++) {
+                printf(" %10s%-4u", "batch ", BATCHES[b]);
+        }
+        printf("\n");
+
+        double totals[BATCH_COUNT] = { 0 };
+        for (int i = first; i < argc; i++) {
+                unsigned int size;
+                unsigned char *rom = ReadRom(argv[i], &size);
+                if (rom == NULL) {
+                        continue;
+                }
+
+                printf("%-24s", argv[i]);
+                for (int b = 0; b < BATCH_COUNT; b++) {
+                        double rate = Run(rom, size, BATCHES[b], instructions);
+                        totals[b] += rate;
+                        printf(" %14.0f", rate);
+                }
+                printf("\n");
+
+                free(rom);
+        }
+
+        printf("%-24s", "mean");
+        for (int b = 0; b < BATCH_COUNT; b++) {
+                printf(" %14.0f", totals[b] / (argc - first));
+        }
+        printf("\n");
+
+        return 0;
+}
@@ -0,0 +1,144 @@
+/******************************************************************************
+  File: engine_bench.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+//! \file engine_bench.c
+//!
+//! Measures emulated instructions per second for each OpcodeRun() engine.
+//!
+//! Usage: engine_bench [-n INSTRUCTIONS] ROM...
+//!
+//! ROMs run through SystemRunCycles() in virtual time, as headless runs do,
+//! with no pacing, no graphics and no sound. Timers tick every
+//! BENCH_CYCLES_HZ / 60 instructions, so the instruction stream doesn't depend
+//! on how fast the engine is and FX07 never reads the clock. Whenever a ROM
+//! waits for a keypress, key 0 is pressed immediately.
+//!
+//! Engines take turns, BENCH_REPEATS times over, and each one's fastest run is
+//! reported, so a burst of load elsewhere doesn't skew one engine's number.
+//!
+//! Also reports how often the threaded engine ran each fused sequence.
+#include <math.h> // fmax
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../opcode.h"
+#include "../system.h"
+
+//! Instructions handed to SystemRunCycles() per call
+#define BATCH_SIZE 10000
+
+//! Emulated instructions per second, as in main.c
+#define BENCH_CYCLES_HZ 500
+
+//! Times each engine runs each ROM; the fastest run is reported
+#define BENCH_REPEATS 3
+
+//! \brief Reads an entire ROM file into memory
+//! \param[in] path ROM file to read
+//! \param[out] size Size of the ROM in bytes
+//! \return The ROM, to be freed by the caller, or NULL on error
+static unsigned char *ReadRom(const char *path, unsigned int *size) {
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+                perror("Couldn't open file");
+                return NULL;
+        }
+
+        unsigned char *rom = (unsigned char *)malloc(4096);
+        *size = fread(rom, 1, 4096, f);
+        fclose(f);
+
+        return rom;
+}
+
+//! \brief Runs a ROM on the given engine for the given number of instructions
+//! \param[in] rom ROM to be loaded
+//! \param[in] size Size of the ROM in bytes
+//! \param[in] engine Engine to run the ROM on
+//! \param[in] instructions How many instructions to execute
+//! \param[out] fusions Times each fused sequence ran, or NULL
+//! \return Instructions executed per second
+static double Run(unsigned char *rom, unsigned int size, enum opcode_engine engine, unsigned long instructions, unsigned long *fusions) {
+        struct system *system = SystemInit(0);
+        struct opcode *opcode = OpcodeInit();
+        SystemLoadProgram(system, rom, size);
+        OpcodeSetEngine(opcode, engine);
+        SystemVirtualTimeSet(system, BENCH_CYCLES_HZ);
+        SystemRandomSeed(system, 1);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        unsigned long executed = 0;
+        while (executed < instructions) {
+                unsigned long remaining = instructions - executed;
+                unsigned int count = SystemRunCycles(system, opcode, remaining < BATCH_SIZE ? remaining : BATCH_SIZE);
+                executed += count;
+
+                if (SystemWFKWaiting(system)) {
+                        // FX0A has already moved pc on; just end the wait.
+                        SystemWFKOccurred(system, 0);
+                        SystemWFKStop(system);
+                } else if (count == 0) {
+                        break; // Unknown instruction.
+                }
+        }
+
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        for (int i = 0; fusions != NULL && i < OPCODE_FUSION_COUNT; i++) {
+                fusions[i] = OpcodeFusionCount(opcode, i);
+        }
+
+        OpcodeDeinit(opcode);
+        SystemDeinit(system);
+
+        return executed / seconds;
+}
+
+int main(int argc, char **argv) {
+        unsigned long instructions = 20000000;
+        int first = 1;
+
+        if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+                instructions = strtoul(argv[2], NULL, 10);
+                first = 3;
+        }
+
+        if (first >= argc) {
+                printf("engine_bench [-n INSTRUCTIONS] ROM...\n");
+                return 1;
+        }
+
+        printf("%-24s %14s %14s %8s %14s %8s %10s %10s %10s\n", "rom", "reference/s", "threaded/s", "speedup", "jit/s", "speedup", "sprite", "delaywait", "countloop");
+
+        for (int i = first; i < argc; i++) {
+                unsigned int size;
+                unsigned char *rom = ReadRom(argv[i], &size);
+                if (rom == NULL) {
+                        continue;
+                }
+
+                unsigned long fusions[OPCODE_FUSION_COUNT];
+                double reference = 0, threaded = 0, jit = 0;
+                for (int r = 0; r < BENCH_REPEATS; r++) {
+                        reference = fmax(reference, Run(rom, size, OPCODE_ENGINE_REFERENCE, instructions, NULL));
+                        threaded = fmax(threaded, Run(rom, size, OPCODE_ENGINE_THREADED, instructions, fusions));
+                        jit = fmax(jit, Run(rom, size, OPCODE_ENGINE_JIT, instructions, NULL));
+                }
+                printf("%-24s %14.0f %14.0f %7.2fx %14.0f %7.2fx %10lu %10lu %10lu\n", argv[i], reference, threaded, threaded / reference, jit, jit / reference,
+                       fusions[OPCODE_FUSION_SPRITE], fusions[OPCODE_FUSION_DELAY_WAIT], fusions[OPCODE_FUSION_COUNTED_LOOP]);
+
+                free(rom);
+        }
+
+        return 0;
+}
@@ -0,0 +1,325 @@
+/******************************************************************************
+  File: lock_bench.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+//! \file lock_bench.c
+//!
+//! Measures how fast the emulation thread can use shared system state while
+//! the UI, timer and sound threads use it too.
+//!
+//! Usage: lock_bench [-t SECONDS] [ROM...]
+//!
+//! Two implementations are compared: the lock-free accessors in system.c and a
+//! copy of the pthread rwlock accessors they replaced. The emulation thread
+//! repeatedly does what an instruction does: checks for quit, debug and
+//! wait-for-key, reads a key and the delay timer, and every eighth time draws a
+//! sprite. Each implementation runs alone, then with three threads hammering
+//! the same state: one pressing keys, one decrementing timers and one copying
+//! the framebuffer.
+//!
+//! ROM arguments are ignored, so `make runbench` can pass games/*.
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../system.h"
+
+#define GFX_SIZE (64 * 32) //!< Size of the CHIP-8 framebuffer
+
+//! \brief Shared state guarded like system.c used to guard it. Unexported.
+struct locked {
+        struct system *s; //!< Provides memory, registers and the framebuffer
+        int shouldQuit;
+        int debugEnabled;
+        int wfkWaiting;
+        unsigned char key[16];
+        unsigned char delayTimer;
+        unsigned char soundTimer;
+        pthread_rwlock_t shouldQuitLock;
+        pthread_rwlock_t debugLock;
+        pthread_rwlock_t wfkLock;
+        pthread_rwlock_t keyLock;
+        pthread_rwlock_t timerRwLock;
+        pthread_rwlock_t gfxRwLock;
+};
+
+//! \brief Operations the emulation and contending threads perform
+struct backend {
+        const char *name; //!< Name to report
+        int (*shouldQuit)(void *state);
+        int (*debugIsEnabled)(void *state);
+        int (*wfkWaiting)(void *state);
+        int (*keyIsPressed)(void *state, int key);
+        int (*delayTimer)(void *state);
+        void (*drawSprite)(void *state);
+        void (*keySetPressed)(void *state, int key, int pressed);
+        void (*decrementTimers)(void *state);
+        void (*gfxCopy)(void *state, unsigned char *gfx);
+};
+
+// The rwlock accessors as system.c had them, sprite drawing included.
+
+static int LockedRead(pthread_rwlock_t *lock, int *value) {
+        pthread_rwlock_rdlock(lock);
+        int result = *value;
+        pthread_rwlock_unlock(lock);
+        return result;
+}
+
+static int LockedShouldQuit(void *state) {
+        struct locked *l = (struct locked *)state;
+        return LockedRead(&l->shouldQuitLock, &l->shouldQuit);
+}
+
+static int LockedDebugIsEnabled(void *state) {
+        struct locked *l = (struct locked *)state;
+        return LockedRead(&l->debugLock, &l->debugEnabled);
+}
+
+static int LockedWFKWaiting(void *state) {
+        struct locked *l = (struct locked *)state;
+        return LockedRead(&l->wfkLock, &l->wfkWaiting);
+}
+
+static int LockedKeyIsPressed(void *state, int key) {
+        struct locked *l = (struct locked *)state;
+        pthread_rwlock_rdlock(&l->keyLock);
+        int result = l->key[key];
+        pthread_rwlock_unlock(&l->keyLock);
+        return result;
+}
+
+static int LockedDelayTimer(void *state) {
+        struct locked *l = (struct locked *)state;
+        pthread_rwlock_rdlock(&l->timerRwLock);
+        int result = l->delayTimer;
+        pthread_rwlock_unlock(&l->timerRwLock);
+        return result;
+}
+
+static void LockedDrawSprite(void *state) {
+        struct locked *l = (struct locked *)state;
+        struct system *s = l->s;
+
+        pthread_rwlock_rdlock(&l->gfxRwLock);
+        s->v[15] = 0;
+        for (int y = 0; y < 5; y++) {
+                unsigned char pixel = s->memory[s->i + y];
+                for (int x = 0; x < 8; x++) {
+                        if ((pixel & (0x80 >> x)) == 0) {
+                                continue;
+                        }
+
+                        int pos = y * 64 + x;
+                        if (s->gfx[pos] == 0xFF) {
+                                s->v[15] = 1;
+                        }
+                        s->gfx[pos] ^= 0xFF;
+                }
+        }
+        pthread_rwlock_unlock(&l->gfxRwLock);
+}
+
+static void LockedKeySetPressed(void *state, int key, int pressed) {
+        struct locked *l = (struct locked *)state;
+        pthread_rwlock_wrlock(&l->keyLock);
+        l->key[key] = pressed ? 0xFF : 0;
+        pthread_rwlock_unlock(&l->keyLock);
+}
+
+static void LockedDecrementTimers(void *state) {
+        struct locked *l = (struct locked *)state;
+        pthread_rwlock_wrlock(&l->timerRwLock);
+        if (l->delayTimer > 0) {
+                l->delayTimer--;
+        }
+        if (l->soundTimer > 0) {
+                l->soundTimer--;
+        }
+        pthread_rwlock_unlock(&l->timerRwLock);
+}
+
+static void LockedGfxCopy(void *state, unsigned char *gfx) {
+        struct locked *l = (struct locked *)state;
+        pthread_rwlock_rdlock(&l->gfxRwLock);
+        memcpy(gfx, l->s->gfx, GFX_SIZE);
+        pthread_rwlock_unlock(&l->gfxRwLock);
+}
+
+// The lock-free accessors system.c has now.
+
+static int FreeShouldQuit(void *state) {
+        return SystemShouldQuit(((struct locked *)state)->s);
+}
+
+static int FreeDebugIsEnabled(void *state) {
+        return SystemDebugIsEnabled(((struct locked *)state)->s);
+}
+
+static int FreeWFKWaiting(void *state) {
+        return SystemWFKWaiting(((struct locked *)state)->s);
+}
+
+static int FreeKeyIsPressed(void *state, int key) {
+        return SystemKeyIsPressed(((struct locked *)state)->s, key);
+}
+
+static int FreeDelayTimer(void *state) {
+        return SystemDelayTimer(((struct locked *)state)->s);
+}
+
+static void FreeDrawSprite(void *state) {
+        SystemDrawSprite(((struct locked *)state)->s, 0, 0, 5);
+}
+
+static void FreeKeySetPressed(void *state, int key, int pressed) {
+        SystemKeySetPressed(((struct locked *)state)->s, key, pressed);
+}
+
+static void FreeDecrementTimers(void *state) {
+        SystemDecrementTimers(((struct locked *)state)->s);
+}
+
+static void FreeGfxCopy(void *state, unsigned char *gfx) {
+        memcpy(gfx, SystemGfxFrame(((struct locked *)state)->s), GFX_SIZE);
+}
+
+//! Implementations to compare
+static const struct backend BACKENDS[] = {
+        {
+                "rwlock", LockedShouldQuit, LockedDebugIsEnabled, LockedWFKWaiting,
+                LockedKeyIsPressed, LockedDelayTimer, LockedDrawSprite,
+                LockedKeySetPressed, LockedDecrementTimers, LockedGfxCopy
+        },
+        {
+                "lock-free", FreeShouldQuit, FreeDebugIsEnabled, FreeWFKWaiting,
+                FreeKeyIsPressed, FreeDelayTimer, FreeDrawSprite,
+                FreeKeySetPressed, FreeDecrementTimers, FreeGfxCopy
+        },
+};
+
+//! Number of entries in BACKENDS
+#define BACKEND_COUNT (sizeof(BACKENDS) / sizeof(BACKENDS[0]))
+
+//! \brief What a contending thread should do. Unexported.
+struct contender {
+        const struct backend *b; //!< Implementation to use
+        struct locked *state; //!< State to use it on
+        int role; //!< 0 presses keys, 1 decrements timers, 2 copies the framebuffer
+        atomic_int *stop; //!< Set once measuring is done
+        unsigned long operations; //!< How many operations the thread managed
+};
+
+//! \brief Hammers shared state until told to stop
+//! \param[in,out] arg struct contender describing the thread
+//! \return NULL
+static void *Contend(void *arg) {
+        struct contender *c = (struct contender *)arg;
+        unsigned char gfx[GFX_SIZE];
+
+        while (!atomic_load_explicit(c->stop, memory_order_relaxed)) {
+                switch (c->role) {
+                        case 0:
+                                c->b->keySetPressed(c->state, c->operations & 0xF, c->operations & 0x10);
+                                break;
+                        case 1:
+                                c->b->decrementTimers(c->state);
+                                break;
+                        default:
+                                c->b->gfxCopy(c->state, gfx);
+                                break;
+                }
+                c->operations++;
+        }
+
+        return NULL;
+}
+
+//! \brief Runs the emulation thread's access pattern for a while
+//! \param[in] b Implementation to use
+//! \param[in] contenders Number of contending threads, 0 to 3
+//! \param[in] seconds How long to measure
+//! \param[out] contended Operations per second achieved by contending threads
+//! \return Emulated instructions per second
+static double Run(const struct backend *b, int contenders, double seconds, double *contended) {
+        struct locked state;
+        memset(&state, 0, sizeof(state));
+        state.s = SystemInit(0);
+        state.s->i = 0; // Font sprite for 0
+        pthread_rwlock_init(&state.shouldQuitLock, NULL);
+        pthread_rwlock_init(&state.debugLock, NULL);
+        pthread_rwlock_init(&state.wfkLock, NULL);
+        pthread_rwlock_init(&state.keyLock, NULL);
+        pthread_rwlock_init(&state.timerRwLock, NULL);
+        pthread_rwlock_init(&state.gfxRwLock, NULL);
+
+        atomic_int stop = 0;
+        struct contender c[3];
+        pthread_t threads[3];
+        for (int t = 0; t < contenders; t++) {
+                c[t] = (struct contender){ b, &state, t, &stop, 0 };
+                pthread_create(&threads[t], NULL, Contend, &c[t]);
+        }
+
+        struct timespec start, now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        unsigned long instructions = 0;
+        double elapsed = 0;
+        int sink = 0;
+        do {
+                for (int n = 0; n < 4096; n++, instructions++) {
+                        sink += b->shouldQuit(&state) + b->debugIsEnabled(&state) + b->wfkWaiting(&state);
+                        sink += b->keyIsPressed(&state, instructions & 0xF) + b->delayTimer(&state);
+                        if ((instructions & 7) == 0) {
+                                b->drawSprite(&state);
+                        }
+                }
+
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+        } while (elapsed < seconds);
+
+        atomic_store(&stop, 1);
+        unsigned long operations = 0;
+        for (int t = 0; t < contenders; t++) {
+                pthread_join(threads[t], NULL);
+                operations += c[t].operations;
+        }
+        *contended = operations / elapsed;
+
+        pthread_rwlock_destroy(&state.shouldQuitLock);
+        pthread_rwlock_destroy(&state.debugLock);
+        pthread_rwlock_destroy(&state.wfkLock);
+        pthread_rwlock_destroy(&state.keyLock);
+        pthread_rwlock_destroy(&state.timerRwLock);
+        pthread_rwlock_destroy(&state.gfxRwLock);
+        SystemDeinit(state.s);
+
+        return (sink == -1) ? 0 : instructions / elapsed;
+}
+
+int main(int argc, char **argv) {
+        double seconds = 1.0;
+
+        if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+                seconds = strtod(argv[2], NULL);
+        }
+
+        printf("%-12s %12s %16s %16s\n", "backend", "contenders", "emulation/s", "contenders/s");
+        for (int b = 0; b < BACKEND_COUNT; b++) {
+                for (int contenders = 0; contenders <= 3; contenders += 3) {
+                        double contended;
+                        double rate = Run(&BACKENDS[b], contenders, seconds, &contended);
+                        printf("%-12s %12d %16.0f %16.0f\n", BACKENDS[b].name, contenders, rate, contended);
+                }
+        }
+
+        return 0;
+}
@@ -0,0 +1,202 @@
+/******************************************************************************
+  File: eventloop.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+
+//! \file eventloop.c
+
+#include <errno.h> // EINTR
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h> // read, close
+
+//! \brief Starts a timerfd firing at the given rate, or stops it
+//! \param[in] fd timerfd to update
+//! \param[in] hz Expirations per second, or 0 to stop
+void EventLoopTimerSetHz(int fd, double hz) {
+        struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+        if (hz > 0) {
+                long ns = 1000000000.0 / hz;
+                spec.it_interval = (struct timespec){ ns / 1000000000, ns % 1000000000 };
+                spec.it_value = spec.it_interval;
+        }
+        timerfd_settime(fd, 0, &spec, NULL);
+}
+
+//! \brief Starts a timerfd firing once, after the given time
+//! \param[in] fd timerfd to update
+//! \param[in] ms Milliseconds until it fires
+void EventLoopTimerOnce(int fd, unsigned int ms) {
+        struct itimerspec spec = { { 0, 0 }, { ms / 1000, (ms % 1000) * 1000000L } };
+        timerfd_settime(fd, 0, &spec, NULL);
+}
+
+//! \brief Runs every subsystem from one thread
+//!
+//! An alternative to the emulation loop in main() plus GFXInputThread() and
+//! SoundThread(), for hosting many instances densely. Everything is driven by
+//! timerfds multiplexed with epoll, so the thread only wakes when there's
+//! something to do and never contends with itself for shared state:
+//! - emulation: runs a batch of instructions, or a debugger command, every
+//!   CYCLES_PER_BATCH instruction periods. Late batches are caught up like the
+//!   threaded loop does, up to CYCLES_MAX_CATCH_UP. Stopped while waiting for a
+//!   key, unless time is virtual, or paused in the debugger.
+//! - frame: polls input and presents at GFX_INPUT_HZ. Runs debugger commands
+//!   posted while paused, and restarts emulation once a key ends a wait or the
+//!   debugger resumes.
+//! - sound: stops the tone SOUND_MS after it was started.
+//!
+//! While fast-forwarding, the loop polls instead of sleeping and runs
+//! TurboRun() between events.
+//!
+//! Timers need no event; system.c derives them from the clock, or ticks them
+//! in SystemRunCycles() with `--virtual-time`.
+//!
+//! Stops at an instruction it can't decode; see StoppedAtUnknown().
+//!
+//! \param[in] ctx struct thread_args for the system and opcode
+//! \return 0 on a normal quit, otherwise 1
+int EventLoop(struct thread_args *ctx) {
+        struct system *sys = ctx->sys;
+        int status = 1;
+
+        struct gfx_input gfxInput;
+        if (!GFXInputInit(&gfxInput, ctx->isDebugEnabled)) {
+                return 1;
+        }
+
+        struct sound *sound = SoundInit();
+        if (NULL == sound) {
+                fprintf(stderr, "Couldn't initialize sound");
+                GFXInputDeinit(&gfxInput);
+                return 1;
+        }
+
+        int epoll = epoll_create1(EPOLL_CLOEXEC);
+        int emulationFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        int frameFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        int soundFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+        int fds[] = { emulationFd, frameFd, soundFd };
+        for (int i = 0; i < 3; i++) {
+                struct epoll_event event = { .events = EPOLLIN, .data.fd = fds[i] };
+                if (fds[i] < 0 || epoll < 0 || 0 != epoll_ctl(epoll, EPOLL_CTL_ADD, fds[i], &event)) {
+                        perror("Couldn't set up event loop");
+                        goto done;
+                }
+        }
+
+        const double batchHz = (double)CYCLES_HZ / CYCLES_PER_BATCH;
+        int emulating = 1;
+        long runTo = -1; // See DebugCommand()
+        int fast = 0;
+        unsigned int turboBeeps = 0;
+        struct speed_meter meter;
+        SpeedMeterInit(&meter);
+        EventLoopTimerSetHz(emulationFd, batchHz);
+        EventLoopTimerSetHz(frameFd, GFX_INPUT_HZ);
+
+        while (!SystemShouldQuit(sys)) {
+                TurboUpdate(ctx, &fast);
+
+                struct epoll_event events[3];
+                int count = epoll_wait(epoll, events, 3, (fast && emulating) ? 0 : -1);
+                if (count < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        perror("Event loop failed");
+                        goto done;
+                }
+
+                for (int i = 0; i < count; i++) {
+                        int fd = events[i].data.fd;
+                        unsigned long long expirations;
+                        if (sizeof(expirations) != read(fd, &expirations, sizeof(expirations))) {
+                                continue;
+                        }
+
+                        if (fd == emulationFd) {
+                                if (SystemDebugIsEnabled(sys)) {
+                                        unsigned int argument;
+                                        enum system_debug_command command = SystemDebugTake(sys, &argument);
+                                        DebugCommand(sys, ctx->opcode, &runTo, command, argument);
+                                        if (runTo < 0 && SystemDebugIsEnabled(sys)) {
+                                                // Paused: the frame timer picks up the next command.
+                                                EventLoopTimerSetHz(emulationFd, 0);
+                                                emulating = 0;
+                                        }
+                                } else if (SystemWFKWaiting(sys) && !ctx->isVirtualTime) {
+                                        // FX0A: nothing to do until the frame timer sees a key.
+                                        // In virtual time the wait runs idle batches instead.
+                                        EventLoopTimerSetHz(emulationFd, 0);
+                                        emulating = 0;
+                                } else if (!fast) {
+                                        unsigned int due = expirations;
+                                        if (due > 1 + CYCLES_MAX_CATCH_UP)
+                                                due = 1 + CYCLES_MAX_CATCH_UP;
+                                        unsigned int ran = SystemRunCycles(sys, ctx->opcode, CYCLES_PER_BATCH * due);
+                                        SpeedMeterAdd(&meter, ran, 0);
+                                        if (StoppedAtUnknown(sys, ctx->opcode, ran))
+                                                goto done;
+                                }
+
+                                if (SystemSoundTriggered(sys)) {
+                                        SystemSoundSetTrigger(sys, 0);
+                                        if (!TurboSkip(ctx, &turboBeeps)) {
+                                                SoundPlay(sound);
+                                                EventLoopTimerOnce(soundFd, SOUND_MS);
+                                        }
+                                }
+                        } else if (fd == frameFd) {
+                                GFXInputFrame(&gfxInput, ctx);
+
+                                int resume = 0;
+                                if (!emulating && SystemDebugIsEnabled(sys)) {
+                                        // The UI posts commands from this thread, so there's no need to wait for one.
+                                        unsigned int argument;
+                                        enum system_debug_command command = SystemDebugTake(sys, &argument);
+                                        if (command != SYSTEM_DEBUG_NONE) {
+                                                DebugCommand(sys, ctx->opcode, &runTo, command, argument);
+                                        }
+                                        resume = runTo >= 0 || !SystemDebugIsEnabled(sys);
+                                } else if (!emulating) {
+                                        resume = !SystemWFKWaiting(sys) || SystemWFKPoll(sys);
+                                }
+
+                                if (resume) {
+                                        EventLoopTimerSetHz(emulationFd, batchHz);
+                                        emulating = 1;
+                                }
+                        } else if (fd == soundFd) {
+                                SoundStop(sound);
+                        }
+                }
+
+                if (fast && emulating) {
+                        unsigned int ran = TurboRun(sys, ctx->opcode);
+                        SpeedMeterAdd(&meter, ran, 1);
+                        if (StoppedAtUnknown(sys, ctx->opcode, ran))
+                                goto done;
+                }
+        }
+
+        if (ctx->isPacingReported)
+                SpeedMeterReport(&meter);
+        status = 0;
+
+done:
+        for (int i = 0; i < 3; i++) {
+                if (fds[i] >= 0)
+                        close(fds[i]);
+        }
+        if (epoll >= 0)
+                close(epoll);
+
+        SoundDeinit(sound);
+        GFXInputDeinit(&gfxInput);
+
+        return status;
+}
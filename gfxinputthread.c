@@ -1,7 +1,7 @@
 /******************************************************************************
   File: gfxinputthread.c
   Created: 2019-07-25
-  Updated: 2019-07-31
+  Updated: 2026-10-17
   Author: Aaron Oman
   Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
  ******************************************************************************/
@@ -20,11 +20,80 @@ void UIRenderFn() {
         UIRender(ui);
 }
 
+//! Graphics, input and UI state shared by GFXInputThread() and EventLoop()
+struct gfx_input {
+        struct graphics *graphics;
+        struct input *input;
+        unsigned int turboFrames; //!< For TurboSkip()
+};
+
+//! \brief Initializes graphics, input and the ui
+//! \param[out] gfxInput State to initialize
+//! \param[in] isDebugEnabled Whether the visual debugger is enabled
+//! \return 1 on success, otherwise 0
+int GFXInputInit(struct gfx_input *gfxInput, int isDebugEnabled) {
+        gfxInput->turboFrames = 0;
+        gfxInput->graphics = GraphicsInit(isDebugEnabled);
+        if (gfxInput->graphics == NULL) {
+                fprintf(stderr, "Couldn't initialize graphics\n");
+                return 0;
+        }
+
+        gfxInput->input = InputInit();
+        if (NULL == gfxInput->input) {
+                fprintf(stderr, "Couldn't initialize input");
+                GraphicsDeinit(gfxInput->graphics);
+                return 0;
+        }
+
+        ui = UIInit(isDebugEnabled, 240, 240, GraphicsSDLWindow(gfxInput->graphics));
+        if (NULL == ui) {
+                fprintf(stderr, "Couldn't initialize ui\n");
+                InputDeinit(gfxInput->input);
+                GraphicsDeinit(gfxInput->graphics);
+                return 0;
+        }
+
+        return 1;
+}
+
+//! \brief De-initializes everything GFXInputInit() initialized
+//! \param[in,out] gfxInput State to clean up
+void GFXInputDeinit(struct gfx_input *gfxInput) {
+        UIDeinit(ui);
+        InputDeinit(gfxInput->input);
+        GraphicsDeinit(gfxInput->graphics);
+}
+
+//! \brief Handles pending input, then draws a frame
+//!
+//! Input is always handled, but frames are skipped while fast-forwarding.
+//!
+//! \param[in,out] gfxInput Graphics and input state
+//! \param[in] ctx struct thread_args for the system and opcode
+void GFXInputFrame(struct gfx_input *gfxInput, struct thread_args *ctx) {
+        SDL_Event event;
+
+        UIInputBegin(ui);
+        while (SDL_PollEvent(&event)) {
+                InputCheck(gfxInput->input, ctx->sys, &event);
+                UIHandleEvent(ui, &event);
+        }
+        UIInputEnd(ui);
+
+        if (TurboSkip(ctx, &gfxInput->turboFrames)) {
+                return;
+        }
+
+        UIWidgets(ui, ctx->sys, ctx->opcode);
+        GraphicsPresent(gfxInput->graphics, ctx->sys, UIRenderFn);
+}
+
 //! \brief Thread for graphics and input updates
 //!
 //! Graphics and input are coupled together on the same thread because I
 //! figure both deal with human perception, so their frequency can be similar.
-//! Right now this thread is configured to run at 30hz.
+//! Right now this thread is configured to run at GFX_INPUT_HZ.
 //!
 //! Decoupling graphics and input allows the emulation engine to run at a
 //! much higher frequency and not be limited by drawing routines.
@@ -39,57 +108,29 @@ void *GFXInputThread(void *context) {
         struct thread_args *ctx = (struct thread_args *)context;
         #pragma GCC diagnostic pop
 
-        static const double msPerFrame = HZ_TO_MS(30);
-
-        struct graphics *graphics = GraphicsInit(ctx->isDebugEnabled);
-        if (graphics == NULL) {
-                fprintf(stderr, "Couldn't initialize graphics\n");
-                return NULL;
-        }
-
-        struct input *input = InputInit();
-        if (NULL == input) {
-                fprintf(stderr, "Couldn't initialize input");
-                GraphicsDeinit(graphics);
+        struct gfx_input gfxInput;
+        if (!GFXInputInit(&gfxInput, ctx->isDebugEnabled)) {
                 return NULL;
         }
 
-        ui = UIInit(ctx->isDebugEnabled, 240, 240, GraphicsSDLWindow(graphics));
-        if (NULL == ui) {
-                fprintf(stderr, "Couldn't initialize ui\n");
-                InputDeinit(input);
-                GraphicsDeinit(graphics);
+        // Frames that are late are dropped rather than drawn back to back.
+        struct pacer *pacer = PacerInit(GFX_INPUT_HZ, 0);
+        if (NULL == pacer) {
+                fprintf(stderr, "Couldn't initialize pacer\n");
+                GFXInputDeinit(&gfxInput);
                 return NULL;
         }
 
-        SDL_Event event;
         while (!ThreadSyncShouldShutdown(ctx->threadSync)) {
-                struct timespec start;
-                clock_gettime(CLOCK_REALTIME, &start);
-
-                UIInputBegin(ui);
-                while (SDL_PollEvent(&event)) {
-                        InputCheck(input, ctx->sys, &event);
-                        UIHandleEvent(ui, &event);
-                }
-                UIInputEnd(ui);
-
-                UIWidgets(ui, ctx->sys, ctx->opcode);
-                GraphicsPresent(graphics, ctx->sys, UIRenderFn);
-
-                struct timespec end;
-                clock_gettime(CLOCK_REALTIME, &end);
-
-                double elapsedTime = S_TO_MS(end.tv_sec - start.tv_sec);
-                elapsedTime += NS_TO_MS(end.tv_nsec - start.tv_nsec);
-
-                struct timespec sleep = { .tv_sec = 0, .tv_nsec = MS_TO_NS(msPerFrame - elapsedTime) };
-                nanosleep(&sleep, NULL);
+                GFXInputFrame(&gfxInput, ctx);
+                PacerWait(pacer);
         }
 
-        UIDeinit(ui);
-        InputDeinit(input);
-        GraphicsDeinit(graphics);
+        if (ctx->isPacingReported)
+                PacingReport("graphics", pacer);
+        PacerDeinit(pacer);
+
+        GFXInputDeinit(&gfxInput);
 
         return NULL;
 }
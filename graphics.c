@@ -107,10 +107,7 @@ void GraphicsDeinit(struct graphics *g) {
 //! \param[in,out] graphics Graphics state to be updated
 //! \param[in] system CHIP-8 system state to be read
 void Raster(struct graphics *graphics, struct system *system) {
-        if (0 != SystemGfxLock(system)) {
-                fprintf(stderr, "Failed to lock system gfx rwlock");
-                return;
-        }
+        const unsigned char *gfx = SystemGfxFrame(system);
 
         memset(graphics->textureData, 0xFF, CHIP8_DISPLAY_WIDTH * CHIP8_DISPLAY_HEIGHT * 3);
 
@@ -118,7 +115,7 @@ void Raster(struct graphics *graphics, struct system *system) {
                 for (int x = 0, cx = 0; cx < CHIP8_DISPLAY_WIDTH; cx++, x+=3) {
                         unsigned int pos = cy * (CHIP8_DISPLAY_WIDTH * 3) + x;
 
-                        if (system->gfx[y * CHIP8_DISPLAY_WIDTH + cx]) {
+                        if (gfx[y * CHIP8_DISPLAY_WIDTH + cx]) {
                                 // Black (Foreground)
                                 graphics->textureData[pos + 0] = 0;
                                 graphics->textureData[pos + 1] = 0;
@@ -126,7 +123,6 @@ void Raster(struct graphics *graphics, struct system *system) {
                         }
                 }
         }
-        SystemGfxUnlock(system);
 }
 
 void GraphicsPresent(struct graphics *g, struct system *s, void (*ui_render_fn)()) {
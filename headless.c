@@ -0,0 +1,180 @@
+/******************************************************************************
+  File: headless.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+//! \file headless.c
+//!
+//! Runs a program with no graphics, input or sound, for CI and batch jobs.
+//!
+//! Nothing here touches SDL, GL or soundio, so main.c built with
+//! `-DCHIP8_HEADLESS` links without them; see `make chip8-headless`.
+
+//! Timer ticks per second. A headless frame is one tick.
+#define HEADLESS_FRAME_HZ 60
+
+//! Frames run when neither budget is given: ten seconds of emulated time
+#define HEADLESS_DEFAULT_FRAMES (10 * HEADLESS_FRAME_HZ)
+
+//! \brief FNV-1a hash of the framebuffer
+//!
+//! Identifies the final screen without printing it, eg. to compare runs.
+//! Covers everything drawn, even if the run ended partway through a frame.
+//!
+//! \param[in] sys System to hash the framebuffer of
+//! \return 64-bit hash
+unsigned long long HeadlessFrameHash(struct system *sys) {
+        const unsigned char *gfx = sys->gfx;
+        unsigned long long hash = 0xcbf29ce484222325ull;
+        for (int i = 0; i < 64 * 32; i++) {
+                hash = (hash ^ gfx[i]) * 0x100000001b3ull;
+        }
+        return hash;
+}
+
+//! \brief Prints registers, timers and the screen
+//! \param[in] out Stream to print to
+//! \param[in] sys System to print
+void HeadlessPrintState(FILE *out, struct system *sys) {
+        fprintf(out, "pc 0x%03X i 0x%03X sp %u dt %d st %d\n", sys->pc, sys->i, sys->sp, SystemDelayTimer(sys), SystemSoundTimer(sys));
+        fprintf(out, "v ");
+        for (int r = 0; r < 16; r++) {
+                fprintf(out, "%02X%s", sys->v[r], r < 15 ? " " : "\n");
+        }
+        fprintf(out, "gfx 0x%016llX\n", HeadlessFrameHash(sys));
+
+        const unsigned char *gfx = sys->gfx;
+        for (int y = 0; y < 32; y++) {
+                char row[64 + 2];
+                for (int x = 0; x < 64; x++) {
+                        row[x] = gfx[y * 64 + x] ? '#' : '.';
+                }
+                row[64] = '\n';
+                row[65] = '\0';
+                fputs(row, out);
+        }
+}
+
+//! A key pressed or released at the start of a frame of a headless run
+struct headless_key {
+        unsigned long long frame; //!< Frame the change happens at, counting from 0
+        unsigned char key; //!< Key 0x0-0xF
+        unsigned char pressed; //!< 1 for a press, 0 for a release
+};
+
+//! What a headless run should do
+struct headless_job {
+        unsigned long long cycles; //!< Most instructions to run, or 0 for no limit
+        unsigned long long frames; //!< Most frames to run, or 0 for no limit
+        const struct headless_key *keys; //!< Input script in frame order, or NULL
+        unsigned int keyCount; //!< Number of entries in keys
+        unsigned long long seed; //!< Seed for CXNN, see SystemRandomSeed()
+};
+
+//! What a headless run did
+struct headless_result {
+        unsigned long long instructions; //!< Instructions executed
+        unsigned long long frames; //!< Whole frames run
+        int unknownInstruction; //!< Whether it stopped at an instruction it couldn't decode
+        double seconds; //!< Wall time taken
+};
+
+//! \brief Runs a program as fast as possible within a budget
+//!
+//! Runs in virtual time at CYCLES_HZ, so a frame is a tick of
+//! CYCLES_HZ / HEADLESS_FRAME_HZ instructions and a run behaves the same
+//! however fast the host is; see SystemVirtualTimeSet().
+//!
+//! Scripted key changes are made at the start of their frame. A key wait
+//! ends with the next scripted press; until then the rest of each frame is
+//! spent waiting. Once the script is used up, or without one, key 0 is
+//! pressed straight away, as there's nobody to press one.
+//!
+//! \param[in,out] sys System with a program loaded
+//! \param[in,out] opcode Opcode state for sys
+//! \param[in] job Budget and input. If neither budget is set, runs
+//!            HEADLESS_DEFAULT_FRAMES.
+//! \return What the run did
+struct headless_result HeadlessExecute(struct system *sys, struct opcode *opcode, const struct headless_job *job) {
+        struct headless_result result = { 0, 0, 0, 0 };
+        unsigned long long cycles = job->cycles;
+        unsigned long long frames = job->frames;
+        if (cycles == 0 && frames == 0) {
+                frames = HEADLESS_DEFAULT_FRAMES;
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        SystemRandomSeed(sys, job->seed);
+        SystemVirtualTimeSet(sys, CYCLES_HZ);
+
+        unsigned long long frame0 = SystemVirtualTicks(sys);
+        unsigned int nextKey = 0;
+        for (;;) {
+                unsigned long long frame = SystemVirtualTicks(sys) - frame0;
+                if (frames != 0 && frame >= frames) {
+                        break;
+                }
+
+                for (; nextKey < job->keyCount && job->keys[nextKey].frame <= frame; nextKey++) {
+                        SystemKeySetPressed(sys, job->keys[nextKey].key, job->keys[nextKey].pressed);
+                }
+
+                // Unless the script has a press to come, end a key wait now.
+                // FX0A has already moved pc on, so the next instruction runs.
+                if (SystemWFKWaiting(sys) && (SystemWFKPoll(sys) || nextKey >= job->keyCount)) {
+                        if (SystemWFKWaiting(sys)) {
+                                SystemWFKOccurred(sys, 0);
+                        }
+                        SystemWFKStop(sys);
+                }
+
+                // Run to the end of the frame, or spend it waiting.
+                unsigned int slice = SystemVirtualTickRemaining(sys);
+                if (cycles != 0 && !SystemWFKWaiting(sys) && slice > cycles - result.instructions) {
+                        slice = cycles - result.instructions;
+                }
+
+                unsigned int ran = SystemRunCycles(sys, opcode, slice);
+                if (ran == 0 && !SystemWFKWaiting(sys)) {
+                        result.unknownInstruction = 1;
+                        break;
+                }
+
+                result.instructions += ran;
+                if (cycles != 0 && result.instructions == cycles) {
+                        break; // The instruction budget is spent.
+                }
+        }
+        result.frames = SystemVirtualTicks(sys) - frame0;
+
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        result.seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        return result;
+}
+
+//! \brief Runs a program as fast as possible within a budget, then prints its final state
+//!
+//! \param[in,out] sys System with a program loaded
+//! \param[in,out] opcode Opcode state for sys
+//! \param[in] cycles Most instructions to run, or 0 for no limit
+//! \param[in] frames Most frames to run, or 0 for no limit
+//! \param[in] seed Seed for CXNN
+//! \return 0, or 1 if it stopped at an instruction it couldn't decode
+//!
+//! \see HeadlessExecute()
+int HeadlessRun(struct system *sys, struct opcode *opcode, unsigned long long cycles, unsigned long long frames, unsigned long long seed) {
+        struct headless_job job = { .cycles = cycles, .frames = frames, .keys = NULL, .keyCount = 0, .seed = seed };
+        struct headless_result result = HeadlessExecute(sys, opcode, &job);
+
+        printf("%llu instructions, %llu frames in %.6fs%s\n", result.instructions, result.frames, result.seconds,
+               result.unknownInstruction ? ", stopped at an unknown instruction" : "");
+        HeadlessPrintState(stdout, sys);
+
+        return result.unknownInstruction;
+}
@@ -59,10 +59,9 @@ void HandleKeyDown(struct input *input, struct system *system, SDL_Keycode keyco
 
         for (int i = 0; i < NUM_KEYS; i++) {
                 if (keycode == input->keycodeIndices[i]) {
+                        // The emulation thread notices the press if it's
+                        // waiting for one; see SystemWFKPoll().
                         SystemKeySetPressed(system, i, 1);
-                        if (SystemWFKWaiting(system)) {
-                                SystemWFKOccurred(system, i);
-                        }
                         break;
                 }
         }
@@ -94,6 +93,10 @@ void InputCheck(struct input *i, struct system *s, SDL_Event *event) {
                         break;
 
                 case SDL_KEYUP:
+                        if (event->key.keysym.sym == SDLK_TAB) {
+                                SystemFastForwardSet(s, 0);
+                                break;
+                        }
                         HandleKeyUp(i, s, event->key.keysym.sym);
                         break;
 
@@ -102,6 +105,10 @@ void InputCheck(struct input *i, struct system *s, SDL_Event *event) {
                                 SystemSignalQuit(s);
                                 break;
                         }
+                        if (event->key.keysym.sym == SDLK_TAB) {
+                                SystemFastForwardSet(s, 1); // For as long as it's held
+                                break;
+                        }
                         HandleKeyDown(i, s, event->key.keysym.sym);
                         break;
         }
@@ -12,60 +12,305 @@
 #include <string.h>
 #include <signal.h>
 #include <pthread.h>
+#include <getopt.h>
 
+#ifndef CHIP8_HEADLESS
 #include "GL/glew.h"
 #include "SDL2/SDL.h"
 #include "SDL2/SDL_opengl.h"
+#endif
 
 //! \file main.c
 //!
 //! This file is the main entrypoint for the CHIP-8 emulator.
-//! The program runs on four threads:
+//! The program runs on three threads:
 //! - graphics + input
 //! - sound
-//! - timers
 //! - system emulation
 //!
+//! The delay and sound timers don't need a thread: system.c works out their
+//! values from the clock whenever they're read. With `--virtual-time` they
+//! tick every CYCLES_HZ / 60 instructions instead; see SystemVirtualTimeSet().
+//!
 //! The system emulation (re: "main") thread provides routines for other threads
 //! to call into, and these routines internally use POSIX threads
 //! synchronization primitives to sync data.
 //!
+//! With `--single-thread`, EventLoop() runs emulation, graphics, input and
+//! sound on the main thread instead.
+//!
+//! `--affinity` and `--sched` pin threads to CPUs and request a real-time
+//! policy for them; see threadsched.c.
+//!
+//! With `--headless`, HeadlessRun() runs the program on the main thread with
+//! no graphics, input or sound. Built with `-DCHIP8_HEADLESS` that's the only
+//! mode, and nothing here needs SDL, GL or soundio.
+//!
 //! Besides creating the threads, this file is responsible for parsing CLI args,
 //! loading CHIP-8 ROM data and otherwise just being a main entrypoint.
 
-#include "input.h"
-#include "graphics.h"
 #include "opcode.h"
-#include "sound.h"
+#include "pacer.h"
 #include "system.h"
 #include "timer.c"
+#ifndef CHIP8_HEADLESS
+#include "input.h"
+#include "graphics.h"
+#include "sound.h"
 #include "ui.h"
+#endif
 
 #include "threadsync.c"
+#include "threadsched.c"
 
 struct thread_args {
         struct system *sys;
         struct opcode *opcode;
         int isDebugEnabled;
+        int isPacingReported; //!< Print pacing statistics on exit
+        int isTurbo; //!< Never pace emulation, as if fast-forward were always held
+        int isVirtualTime; //!< Run timers off instructions executed, not the clock
         struct thread_sync *threadSync;
 };
 
-#define S_TO_MS(x) (x) * 1000.0 //!< Convert seconds to milliseconds
-#define NS_TO_MS(x) (x) / 1000000.0 //!< Convert nanoseconds to milliseconds
-#define MS_TO_NS(x) (x) * 1000000.0 //!< Convert milliseconds to nanoseconds
-#define HZ_TO_MS(x) (1.0 / (x)) * 1000.0 //!< Convert hertz to milliseconds per frame
+//! Instructions run per second
+#define CYCLES_HZ 500
+
+//! Instructions run per pass of the main loop when not debugging
+#define CYCLES_PER_BATCH 8
+
+//! Passes of the main loop a late batch may catch up on
+#define CYCLES_MAX_CATCH_UP 4
+
+//! Frames drawn and input polls per second
+#define GFX_INPUT_HZ 30
+
+//! How long the tone plays once sound is triggered, in milliseconds
+#define SOUND_MS 200
+
+//! Emulated frames run per pass of the main loop while fast-forwarding
+#define TURBO_FRAMES_PER_PASS 64
+
+//! While fast-forwarding, only every Nth frame is drawn and every Nth beep played
+#define TURBO_DECIMATE 4
+
+//! \brief Prints a loop's pacing statistics
+//! \param[in] name Loop to report on
+//! \param[in] pacer Pacer running the loop
+void PacingReport(const char *name, struct pacer *pacer) {
+        struct pacer_stats stats = PacerStats(pacer);
+        fprintf(stderr, "%s: %lu periods, jitter %.3fms mean %.3fms max, %lu overruns, %lu skipped\n",
+                name, stats.waits, stats.jitterMeanMs, stats.jitterMaxMs, stats.overruns, stats.skipped);
+}
+
+//! \brief Carries out a command posted by the debugger UI
+//!
+//! A step runs all of its instructions at once. Running to an address goes
+//! one batch per call, at normal speed, until pc reaches it or another command
+//! arrives. Each executed instruction ticks the timers once, since their clock
+//! is stopped while debugging. Afterwards the instruction at pc is fetched and
+//! decoded so the UI can show it.
+//!
+//! \param[in,out] sys System being debugged
+//! \param[in,out] opcode Opcode state for sys
+//! \param[in,out] runTo Address being run to, or -1 if paused; kept between calls
+//! \param[in] command Command taken from SystemDebugTake() or SystemDebugWait()
+//! \param[in] argument Argument posted with command
+void DebugCommand(struct system *sys, struct opcode *opcode, long *runTo, enum system_debug_command command, unsigned int argument) {
+        // A key press finishes FX0A, which has already moved pc on; as in
+        // SystemRunCycles(), the next instruction runs from there.
+        SystemWFKPoll(sys);
+        if (SystemWFKChanged(sys)) {
+                SystemWFKStop(sys);
+        }
+
+        unsigned int steps = 0;
+        switch (command) {
+                case SYSTEM_DEBUG_NONE:
+                        steps = (*runTo >= 0) ? CYCLES_PER_BATCH : 0;
+                        break;
+
+                case SYSTEM_DEBUG_STEP:
+                        *runTo = -1;
+                        steps = argument;
+                        break;
+
+                case SYSTEM_DEBUG_RUN_TO:
+                        *runTo = argument;
+                        steps = CYCLES_PER_BATCH;
+                        break;
+
+                case SYSTEM_DEBUG_BREAK:
+                        *runTo = -1;
+                        break;
+
+                case SYSTEM_DEBUG_CONTINUE:
+                        *runTo = -1;
+                        SystemDebugSetEnabled(sys, 0);
+                        return;
+        }
+
+        for (; steps > 0 && !SystemWFKWaiting(sys); steps--) {
+                OpcodeFetch(opcode, sys);
+                OpcodeDecode(opcode);
+                OpcodeExecute(opcode, sys);
+                SystemDecrementTimers(sys);
+
+                if (sys->pc == *runTo) {
+                        *runTo = -1;
+                        break;
+                }
+        }
+
+        OpcodeFetch(opcode, sys);
+        OpcodeDecode(opcode);
+}
+
+#include "headless.c"
+
+//! Instructions executed, for reporting speed. Owned by the emulation thread.
+struct speed_meter {
+        unsigned long long instructions; //!< Since the meter started
+        unsigned long long start; //!< When the meter started, CLOCK_MONOTONIC ns
+        unsigned long long reported; //!< instructions at the last report
+        unsigned long long reportedAt; //!< When the last report was, CLOCK_MONOTONIC ns
+};
+
+//! \brief Reads CLOCK_MONOTONIC
+//! \return nanoseconds
+unsigned long long SpeedMeterNow() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+//! \brief Starts counting from now
+//! \param[out] meter Meter to start
+void SpeedMeterInit(struct speed_meter *meter) {
+        meter->instructions = meter->reported = 0;
+        meter->start = meter->reportedAt = SpeedMeterNow();
+}
+
+//! \brief Counts executed instructions, printing the rate once a second while live
+//!
+//! The speed multiple compares against CYCLES_HZ, the normal rate.
+//!
+//! \param[in,out] meter Meter to update
+//! \param[in] executed Instructions just executed
+//! \param[in] live Whether to print the rate; eg. while fast-forwarding
+void SpeedMeterAdd(struct speed_meter *meter, unsigned int executed, int live) {
+        meter->instructions += executed;
+        if (!live) {
+                return;
+        }
+
+        unsigned long long now = SpeedMeterNow();
+        if (now - meter->reportedAt < 1000000000ull) {
+                return;
+        }
+
+        double ips = (meter->instructions - meter->reported) * 1e9 / (now - meter->reportedAt);
+        fprintf(stderr, "%.0f instructions/s, %.1fx speed\n", ips, ips / CYCLES_HZ);
+        meter->reported = meter->instructions;
+        meter->reportedAt = now;
+}
+
+//! \brief Prints the average rate since the meter started
+//! \param[in] meter Meter to report on
+void SpeedMeterReport(struct speed_meter *meter) {
+        double seconds = (SpeedMeterNow() - meter->start) / 1e9;
+        double ips = meter->instructions / seconds;
+        fprintf(stderr, "emulation: %llu instructions in %.3fs, %.0f instructions/s, %.2fx speed\n",
+                meter->instructions, seconds, ips, ips / CYCLES_HZ);
+}
+
+//! \brief Whether the user wants the emulator running flat out
+//! \param[in] ctx struct thread_args for the system and options
+//! \return 1 in turbo mode or while fast-forward is held, otherwise 0
+int TurboWanted(struct thread_args *ctx) {
+        return ctx->isTurbo || SystemFastForward(ctx->sys);
+}
+
+//! \brief Whether to skip a frame or beep to keep up with fast-forwarding
+//!
+//! Only every TURBO_DECIMATE-th is kept. Nothing is skipped while debugging.
+//!
+//! \param[in] ctx struct thread_args for the system and options
+//! \param[in,out] count Frames or beeps so far, kept between calls
+//! \return 1 to skip this one, otherwise 0
+int TurboSkip(struct thread_args *ctx, unsigned int *count) {
+        if (!TurboWanted(ctx) || SystemDebugIsEnabled(ctx->sys)) {
+                return 0;
+        }
 
+        return (++*count % TURBO_DECIMATE) != 0;
+}
+
+//! \brief Decides whether emulation should run unpaced now
+//!
+//! Fast-forwarding stops while debugging or waiting for a key. Time is virtual
+//! while it lasts, so timers speed up along with everything else. Afterwards
+//! it goes back to the clock, unless `--virtual-time` was given.
+//!
+//! \param[in] ctx struct thread_args for the system and options
+//! \param[in,out] fast Whether emulation was running unpaced; updated
+//! \return 1 if that changed, otherwise 0
+int TurboUpdate(struct thread_args *ctx, int *fast) {
+        int wanted = TurboWanted(ctx) && !SystemDebugIsEnabled(ctx->sys) && !SystemWFKWaiting(ctx->sys);
+        if (wanted == *fast) {
+                return 0;
+        }
+
+        *fast = wanted;
+        SystemVirtualTimeSet(ctx->sys, (wanted || ctx->isVirtualTime) ? CYCLES_HZ : 0);
+        return 1;
+}
+
+//! \brief Runs TURBO_FRAMES_PER_PASS emulated frames without pacing
+//!
+//! Time is virtual, so SystemRunCycles() ticks the timers as the frames go by.
+//! Stops early at a key wait.
+//!
+//! \param[in,out] sys System to run
+//! \param[in,out] opcode Opcode state for sys
+//! \return Instructions executed
+unsigned int TurboRun(struct system *sys, struct opcode *opcode) {
+        return SystemRunCycles(sys, opcode, TURBO_FRAMES_PER_PASS * CYCLES_HZ / HEADLESS_FRAME_HZ);
+}
+
+//! \brief Checks whether a batch stopped at an instruction it couldn't decode
+//!
+//! An unknown instruction doesn't move pc on, so every later batch would stop
+//! at it too. Like HeadlessExecute(), takes a batch that ran nothing without a
+//! key wait, a quit or the debugger to explain it as one, and reports it once.
+//!
+//! \param[in] sys System that ran the batch
+//! \param[in] opcode Opcode state for sys, holding the instruction it stopped at
+//! \param[in] ran Instructions SystemRunCycles() executed
+//! \return 1 if the program can't go on, otherwise 0
+int StoppedAtUnknown(struct system *sys, struct opcode *opcode, unsigned int ran) {
+        if (ran != 0 || SystemWFKWaiting(sys) || SystemShouldQuit(sys) || SystemDebugIsEnabled(sys)) {
+                return 0;
+        }
+
+        fprintf(stderr, "Stopped at unknown instruction 0x%04X at 0x%03X\n", OpcodeInstruction(opcode), sys->pc);
+        return 1;
+}
+
+#ifndef CHIP8_HEADLESS
 #include "gfxinputthread.c"
 #include "soundthread.c"
-#include "timerthread.c"
+#include "eventloop.c"
+#endif
 
 static struct system *sys;
 static struct opcode *opcode;
 static struct thread_sync *threadSync;
 
-static pthread_t timerThread;
 static pthread_t soundThread;
 static pthread_t gfxInputThread;
+static int soundThreadStarted = 0;
+static int gfxInputThreadStarted = 0;
 
 //! \brief Gracefully handle shutting down the program
 //!
@@ -74,10 +319,13 @@ static pthread_t gfxInputThread;
 //! \param[in] status Status code to terminate program with. 0 on succes.
 void Shutdown(int status) {
         void *threadStatus;
+        if (NULL != sys)
+                SystemSignalQuit(sys); // Wakes threads sleeping in system.c
         ThreadSyncSignalShutdown(threadSync);
-        pthread_join(timerThread, &threadStatus);
-        pthread_join(soundThread, &threadStatus);
-        pthread_join(gfxInputThread, &threadStatus);
+        if (soundThreadStarted)
+                pthread_join(soundThread, &threadStatus);
+        if (gfxInputThreadStarted)
+                pthread_join(gfxInputThread, &threadStatus);
 
         if (NULL != opcode)
                 OpcodeDeinit(opcode);
@@ -93,43 +341,191 @@ void Shutdown(int status) {
 
 //! \brief Displays proper program invocation on the CLI
 void Usage() {
-        printf("chip-8 [-d] PROGRAM\n");
-        printf("\t-d: interactive debug mode\n");
+        printf("chip-8 [-1] [-a CPUS] [-c CYCLES] [-d] [-e ENGINE] [-f FRAMES] [-H] [-p] [-q QUIRKS] [-r SEED] [-s POLICY] [-t] [-v] PROGRAM\n");
+        printf("\t-1, --single-thread: run everything on one thread\n");
+        printf("\t-a, --affinity=CPUS: pin emulation,graphics,sound threads, eg. 2,3,3\n");
+        printf("\t-c, --cycles=CYCLES: with --headless, stop after this many instructions\n");
+        printf("\t-d, --debug: interactive debug mode\n");
+        printf("\t-e, --engine=ENGINE: interpreter engine, one of: reference (default), threaded, jit\n");
+        printf("\t-f, --frames=FRAMES: with --headless, stop after this many 60Hz frames\n");
+        printf("\t-H, --headless: run without graphics, input or sound as fast as possible, then print the final state\n");
+        printf("\t-p, --pacing: print timing jitter, overruns and instructions per second on exit\n");
+        printf("\t-q, --quirks=QUIRKS: variant to emulate, one of: default, vip, schip, xochip\n");
+        printf("\t-r, --seed=SEED: seed for the random numbers CXNN draws, default 0\n");
+        printf("\t-s, --sched=POLICY[:PRIORITY]: scheduling policy for all threads, one of: other, fifo, rr\n");
+        printf("\t-t, --turbo: run as fast as possible, as if Tab (fast-forward) were held, reporting the speed\n");
+        printf("\t-v, --virtual-time: time timers, sound and frames by instructions executed, not the clock, for reproducible runs\n");
 }
 
+//! Options parsed from the command line
+struct args {
+        int debugEnabled; //!< Whether the visual debugger is enabled
+        enum opcode_engine engine; //!< Engine used to run the program
+        enum opcode_profile profile; //!< Variant whose quirks are emulated
+        int pacingReported; //!< Print pacing statistics on exit
+        int singleThread; //!< Run EventLoop() instead of several threads
+        int scheduled; //!< Whether --affinity or --sched was given
+        int headless; //!< Run HeadlessRun() instead of the interactive emulator
+        int turbo; //!< Run emulation unpaced
+        int virtualTime; //!< Run timers off instructions executed
+        unsigned long long cycles; //!< Instruction budget for HeadlessRun(), 0 for none
+        unsigned long long frames; //!< Frame budget for HeadlessRun(), 0 for none
+        unsigned long long seed; //!< Seed for SystemRandomSeed()
+        struct thread_sched sched[THREAD_SCHED_COUNT]; //!< CPU and policy per thread
+        char *program; //!< Path to the program ROM
+};
+
 //! \brief Parses command line arguments
 //! \param[in] argc Number of CLI arguments
 //! \param[in] argv CLI arguments as array of strings
-//! \return 0 if visual debugger is disabled, otherwise 1
-int ArgParse(int argc, char **argv) {
-        int debugEnabled = 0;
+//! \return The parsed options
+struct args ArgParse(int argc, char **argv) {
+        struct args args = {
+                .debugEnabled = 0,
+                .engine = OPCODE_ENGINE_REFERENCE,
+                .profile = OPCODE_PROFILE_DEFAULT,
+                .pacingReported = 0,
+                .singleThread = 0,
+                .scheduled = 0,
+#ifdef CHIP8_HEADLESS
+                .headless = 1,
+#else
+                .headless = 0,
+#endif
+                .turbo = 0,
+                .virtualTime = 0,
+                .cycles = 0,
+                .frames = 0,
+                .seed = 0,
+                .program = NULL
+        };
+        ThreadSchedDefaults(args.sched);
+
+        static struct option longOptions[] = {
+                { "affinity", required_argument, NULL, 'a' },
+                { "cycles", required_argument, NULL, 'c' },
+                { "debug", no_argument, NULL, 'd' },
+                { "engine", required_argument, NULL, 'e' },
+                { "frames", required_argument, NULL, 'f' },
+                { "headless", no_argument, NULL, 'H' },
+                { "pacing", no_argument, NULL, 'p' },
+                { "quirks", required_argument, NULL, 'q' },
+                { "seed", required_argument, NULL, 'r' },
+                { "sched", required_argument, NULL, 's' },
+                { "turbo", no_argument, NULL, 't' },
+                { "virtual-time", no_argument, NULL, 'v' },
+                { "single-thread", no_argument, NULL, '1' },
+                { NULL, 0, NULL, 0 }
+        };
 
-        if (argc < 2 || argc > 3) {
-                Usage();
-                exit(1);
+        int opt;
+        while ((opt = getopt_long(argc, argv, "1a:c:de:f:Hpq:r:s:tv", longOptions, NULL)) != -1) {
+                switch (opt) {
+                        case '1':
+                                args.singleThread = 1;
+                                break;
+
+                        case 'a':
+                                if (!ThreadSchedParseAffinity(args.sched, optarg)) {
+                                        Usage();
+                                        exit(1);
+                                }
+                                args.scheduled = 1;
+                                break;
+
+                        case 'c':
+                                args.cycles = strtoull(optarg, NULL, 10);
+                                break;
+
+                        case 'd':
+                                args.debugEnabled = 1;
+                                break;
+
+                        case 'e':
+                                if (strcmp(optarg, "reference") == 0) {
+                                        args.engine = OPCODE_ENGINE_REFERENCE;
+                                } else if (strcmp(optarg, "threaded") == 0) {
+                                        args.engine = OPCODE_ENGINE_THREADED;
+                                } else if (strcmp(optarg, "jit") == 0) {
+                                        args.engine = OPCODE_ENGINE_JIT;
+                                } else {
+                                        Usage();
+                                        exit(1);
+                                }
+                                break;
+
+                        case 'f':
+                                args.frames = strtoull(optarg, NULL, 10);
+                                break;
+
+                        case 'H':
+                                args.headless = 1;
+                                break;
+
+                        case 'p':
+                                args.pacingReported = 1;
+                                break;
+
+                        case 'q':
+                                if (strcmp(optarg, "default") == 0) {
+                                        args.profile = OPCODE_PROFILE_DEFAULT;
+                                } else if (strcmp(optarg, "vip") == 0) {
+                                        args.profile = OPCODE_PROFILE_COSMAC_VIP;
+                                } else if (strcmp(optarg, "schip") == 0) {
+                                        args.profile = OPCODE_PROFILE_SCHIP;
+                                } else if (strcmp(optarg, "xochip") == 0) {
+                                        args.profile = OPCODE_PROFILE_XO_CHIP;
+                                } else {
+                                        Usage();
+                                        exit(1);
+                                }
+                                break;
+
+                        case 'r':
+                                args.seed = strtoull(optarg, NULL, 0);
+                                break;
+
+                        case 's':
+                                if (!ThreadSchedParsePolicy(args.sched, optarg)) {
+                                        Usage();
+                                        exit(1);
+                                }
+                                args.scheduled = 1;
+                                break;
+
+                        case 't':
+                                args.turbo = 1;
+                                break;
+
+                        case 'v':
+                                args.virtualTime = 1;
+                                break;
+
+                        default:
+                                Usage();
+                                exit(1);
+                }
         }
 
-        if (argc == 3 && strcmp(argv[1], "-d") == 0) {
-                argv[1] = argv[2];
-                debugEnabled = 1;
-        } else if (argc == 3 && strcmp(argv[2], "-d") == 0) {
-                debugEnabled = 1;
-        } else if (argc == 3) {
+        if (optind != argc - 1 || (args.headless && args.debugEnabled)) {
                 Usage();
                 exit(1);
         }
 
-        return debugEnabled;
+        args.program = argv[optind];
+
+        return args;
 }
 
 //! \brief CHIP-8 emulator main entrypoint
 int main(int argc, char **argv) {
-        int debugEnabled = ArgParse(argc, argv);
+        struct args args = ArgParse(argc, argv);
+        int debugEnabled = args.debugEnabled;
 
         size_t fsize = 0;
         unsigned char *mem;
         {
-                FILE *f = fopen(argv[1], "r");
+                FILE *f = fopen(args.program, "r");
                 if (f == NULL) {
                         perror("Couldn't open file");
                         exit(1);
@@ -174,76 +570,128 @@ int main(int argc, char **argv) {
                 fprintf(stderr, "Couldn't initialize opcode");
                 Shutdown(1);
         }
+        OpcodeSetEngine(opcode, args.engine);
+        OpcodeSetProfile(opcode, args.profile);
 
+        if (args.scheduled) {
+                // The main thread runs emulation, or everything with --single-thread.
+                const char *name = args.singleThread ? "event loop" : THREAD_SCHED_NAMES[THREAD_SCHED_EMULATION];
+                ThreadSchedApply(args.headless ? "headless" : name, pthread_self(), &args.sched[THREAD_SCHED_EMULATION]);
+        }
+
+        if (args.headless) {
+                Shutdown(HeadlessRun(sys, opcode, args.cycles, args.frames, args.seed));
+        }
+
+        int status = 0; // Non-zero once the program stops at an unknown instruction
+#ifndef CHIP8_HEADLESS
         int err;
         struct thread_args threadArgs = (struct thread_args){
                 .sys = sys,
                 .opcode = opcode,
                 .isDebugEnabled = debugEnabled,
+                .isPacingReported = args.pacingReported,
+                .isTurbo = args.turbo,
+                .isVirtualTime = args.virtualTime,
                 .threadSync = threadSync
         };
 
-        if (0 != (err = pthread_create(&timerThread, NULL, TimerThread, &threadArgs))) {
-                fprintf(stderr, "Couldn't create timerThread: errno(%d)\n", err);
+        SystemRandomSeed(sys, args.seed);
+        if (args.virtualTime) {
+                SystemVirtualTimeSet(sys, CYCLES_HZ);
+        }
+
+        long runTo = -1; // See DebugCommand()
+        if (debugEnabled) {
+                // Show the first instruction.
+                DebugCommand(sys, opcode, &runTo, SYSTEM_DEBUG_BREAK, 0);
+        }
+
+        if (args.singleThread) {
+                Shutdown(EventLoop(&threadArgs));
         }
 
         if (0 != (err = pthread_create(&soundThread, NULL, SoundThread, &threadArgs))) {
                 fprintf(stderr, "Couldn't create soundThread: errno(%d)\n", err);
+        } else {
+                soundThreadStarted = 1;
+                if (args.scheduled)
+                        ThreadSchedApply(THREAD_SCHED_NAMES[THREAD_SCHED_SOUND], soundThread, &args.sched[THREAD_SCHED_SOUND]);
         }
 
         if (0 != (err = pthread_create(&gfxInputThread, NULL, GFXInputThread, &threadArgs))) {
                 fprintf(stderr, "Couldn't create gfxInputThread: errno(%d)\n", err);
+        } else {
+                gfxInputThreadStarted = 1;
+                if (args.scheduled)
+                        ThreadSchedApply(THREAD_SCHED_NAMES[THREAD_SCHED_GRAPHICS], gfxInputThread, &args.sched[THREAD_SCHED_GRAPHICS]);
+        }
+
+        struct pacer *pacer = PacerInit((double)CYCLES_HZ / CYCLES_PER_BATCH, CYCLES_MAX_CATCH_UP);
+        if (NULL == pacer) {
+                fprintf(stderr, "Couldn't initialize pacer");
+                Shutdown(1);
         }
 
-        const double msPerFrame = HZ_TO_MS(500);
+        struct speed_meter meter;
+        SpeedMeterInit(&meter);
+        int fast = 0;
 
+        unsigned int due = 1;
         while (!SystemShouldQuit(sys)) {
-                struct timespec start;
-                clock_gettime(CLOCK_REALTIME, &start);
+                if (TurboUpdate(&threadArgs, &fast)) {
+                        PacerReset(pacer);
+                }
 
                 if (SystemDebugIsEnabled(sys)) {
                         // debug ui
-                        if (SystemDebugShouldFetchAndDecode(sys) && !SystemWFKWaiting(sys)) {
-                                OpcodeFetch(opcode, sys);
-                                OpcodeDecode(opcode);
-                                SystemDecrementTimers(sys);
-                                // Configure debug settings so UI input is required to proceed.
-                                SystemDebugSetExecute(sys, 0);
-                                SystemDebugSetFetchAndDecode(sys, 0);
+                        // Paused, sleep until the UI posts a command. Running
+                        // to an address, check for one between batches.
+                        unsigned int argument;
+                        enum system_debug_command command = (runTo < 0) ? SystemDebugWait(sys, &argument) : SystemDebugTake(sys, &argument);
+                        DebugCommand(sys, opcode, &runTo, command, argument);
+                        if (runTo < 0) {
+                                PacerReset(pacer);
+                                continue;
                         }
-                        else if (SystemWFKChanged(sys)) {
-                                SystemIncrementPC(sys);
-                                SystemWFKStop(sys);
-                        }
-                        else if (SystemDebugShouldExecute(sys)) {
-                                OpcodeExecute(opcode, sys);
-                                // Configure debug settings so we fetch the next instruction automatically.
-                                SystemDebugSetExecute(sys, 0);
-                                SystemDebugSetFetchAndDecode(sys, 1);
+                } else if (SystemWFKWaiting(sys) && !args.virtualTime) {
+                        // FX0A: sleep until a key is pressed, the debugger breaks
+                        // in or we quit. In virtual time the wait runs idle
+                        // batches instead.
+                        SystemWFKBlock(sys);
+                        PacerReset(pacer);
+                        continue;
+                } else if (fast) {
+                        // Turbo or fast-forward: as many frames as the host can run.
+                        unsigned int ran = TurboRun(sys, opcode);
+                        SpeedMeterAdd(&meter, ran, 1);
+                        if (StoppedAtUnknown(sys, opcode, ran)) {
+                                status = 1;
+                                break;
                         }
+                        continue;
                 } else {
                         // no debug ui
-                        if (!SystemWFKWaiting(sys)) {
-                                OpcodeFetch(opcode, sys);
-                                OpcodeDecode(opcode);
-                                SystemDecrementTimers(sys);
-                                OpcodeExecute(opcode, sys);
-                        }
-                        else if (SystemWFKChanged(sys)) {
-                                SystemIncrementPC(sys);
-                                SystemWFKStop(sys);
+                        // Timers count down by themselves. SystemRunCycles()
+                        // checks for quitting, the debugger and key waits.
+                        // A late pass also runs the batches it missed.
+                        unsigned int ran = SystemRunCycles(sys, opcode, CYCLES_PER_BATCH * due);
+                        SpeedMeterAdd(&meter, ran, 0);
+                        if (StoppedAtUnknown(sys, opcode, ran)) {
+                                status = 1;
+                                break;
                         }
                 }
 
-                struct timespec end;
-                clock_gettime(CLOCK_REALTIME, &end);
-
-                double elapsed_time = S_TO_MS(end.tv_sec - start.tv_sec);
-                elapsed_time += NS_TO_MS(end.tv_nsec - start.tv_nsec);
-
-                struct timespec sleep = { .tv_sec = 0, .tv_nsec = MS_TO_NS(msPerFrame - elapsed_time) };
-                nanosleep(&sleep, NULL);
+                due = PacerWait(pacer);
         } // while (!SystemShouldQuit(sys))
 
-        Shutdown(0);
+        if (args.pacingReported) {
+                PacingReport("emulation", pacer);
+                SpeedMeterReport(&meter);
+        }
+        PacerDeinit(pacer);
+#endif // CHIP8_HEADLESS
+
+        Shutdown(status);
 }
@@ -6,40 +6,141 @@
   Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
  ******************************************************************************/
 //! \file opcode.c
-#include <limits.h> // UINT_MAX
-#include <stdlib.h> // rand, malloc, free
+#include <limits.h> // UINT_MAX, USHRT_MAX
+#include <stdlib.h> // aligned_alloc, free
 #include <string.h> // memset
 #include <stdio.h>
+#include <pthread.h> // pthread_once
 
+#include "opcode.h"
 #include "system.h"
 
+#define MEMORY_SIZE 4096 //!< Size of the CHIP-8's addressable memory
+
 struct opcode;
+struct opcode_decoded;
 
 //! Function pointer to the implementation of a given opcode
-typedef void (*opcode_fn)(struct opcode *c, struct system *);
+typedef void (*opcode_fn)(struct opcode *c, struct system *, const struct opcode_decoded *d);
+
+//! \brief Opcode function ids. Unexported.
+//!
+//! Each decode table entry carries one, so engines can switch on it or index
+//! tables with it.
+enum opcode_fn_id {
+        OPCODE_FN_0NNN,
+        OPCODE_FN_00E0,
+        OPCODE_FN_00EE,
+        OPCODE_FN_1NNN,
+        OPCODE_FN_2NNN,
+        OPCODE_FN_3XNN,
+        OPCODE_FN_4XNN,
+        OPCODE_FN_5XY0,
+        OPCODE_FN_6XNN,
+        OPCODE_FN_7XNN,
+        OPCODE_FN_8XY0,
+        OPCODE_FN_8XY1,
+        OPCODE_FN_8XY2,
+        OPCODE_FN_8XY3,
+        OPCODE_FN_8XY4,
+        OPCODE_FN_8XY5,
+        OPCODE_FN_8XY6,
+        OPCODE_FN_8XY7,
+        OPCODE_FN_8XYE,
+        OPCODE_FN_9XY0,
+        OPCODE_FN_ANNN,
+        OPCODE_FN_BNNN,
+        OPCODE_FN_CXNN,
+        OPCODE_FN_DXYN,
+        OPCODE_FN_EX9E,
+        OPCODE_FN_EXA1,
+        OPCODE_FN_FX07,
+        OPCODE_FN_FX0A,
+        OPCODE_FN_FX15,
+        OPCODE_FN_FX18,
+        OPCODE_FN_FX1E,
+        OPCODE_FN_FX29,
+        OPCODE_FN_FX33,
+        OPCODE_FN_FX55,
+        OPCODE_FN_FX65,
+        OPCODE_FN_COUNT //!< Number of opcode functions; also the id of an unknown instruction
+};
+
+//! \brief A fully decoded instruction. Unexported.
+//!
+//! Every possible 16-bit instruction has exactly one entry in the decode
+//! table, built once by OpcodeInit().  Operands are extracted up front so the
+//! opcode functions never need to pick apart the instruction themselves.
+struct opcode_decoded {
+        opcode_fn fn; //!< The function implementation, or NULL if unknown
+        unsigned short nnn; //!< 12-bit address operand
+        unsigned char nn; //!< 8-bit constant operand
+        unsigned char x; //!< Register index from the second-highest nibble
+        unsigned char y; //!< Register index from the second-lowest nibble
+        unsigned char n; //!< 4-bit constant operand from the lowest nibble
+        unsigned char id; //!< enum opcode_fn_id; OPCODE_FN_COUNT if unknown
+};
 
 //! \brief Opcode function debugging information. Unexported.
 //!
 //! Associates an opcode operation (function) with a name and description.
 //! This is used when running the built-in debugger UI.
 struct opcode_fn_map {
-        char *name; //!< Name of the function, like 6XNN
+        const char *name; //!< Name of the function, like 6XNN
         opcode_fn address; //!< Address of the function
-        char *description; //!< Description of what the opcode function does
+        const char *description; //!< Description of what the opcode function does
 };
 
+//! \brief Behaviors selected by an opcode_profile. Unexported.
+//!
+//! Opcode functions read these at run time via c->quirks. The threaded engine
+//! is instead compiled once per OPCODE_QUIRKS entry, with every field a
+//! compile-time constant.
+struct opcode_quirks {
+        int original; //!< Keep this emulator's original 8XY4, 8XY6, 8XYE and BNNN
+        int shiftVy; //!< 8XY6 and 8XYE shift VY into VX, rather than VX itself
+        int jumpVx; //!< BXNN jumps to XNN plus VX, rather than BNNN to NNN plus V0
+        int incrementI; //!< FX55 and FX65 leave I pointing past the last register
+        int resetVf; //!< 8XY1, 8XY2 and 8XY3 reset VF to zero
+};
+
+//! Quirks for each enum opcode_profile
+static const struct opcode_quirks OPCODE_QUIRKS[] = {
+        [OPCODE_PROFILE_DEFAULT] = { .original = 1 },
+        [OPCODE_PROFILE_COSMAC_VIP] = { .shiftVy = 1, .incrementI = 1, .resetVf = 1 },
+        [OPCODE_PROFILE_SCHIP] = { .jumpVx = 1 },
+        [OPCODE_PROFILE_XO_CHIP] = { .shiftVy = 1, .incrementI = 1 },
+};
+_Static_assert(sizeof(OPCODE_QUIRKS) / sizeof(OPCODE_QUIRKS[0]) == OPCODE_PROFILE_COUNT, "OPCODE_QUIRKS must cover enum opcode_profile");
+
 //! \brief State representing the active opcode. Unexported.
 //!
 //! State required to represent an instruction in the CHIP-8.
 //! Each instruction is represented by a function as described in
 //! https://en.wikipedia.org/wiki/CHIP-8#Opcode_table
+//!
+//! Everything touched per instruction shares the first cache line; debug
+//! metadata lives in the static const OPCODE_FN_MAP instead.
 struct opcode {
 // All instructions are 2 bytes store most-significant byte first. (Big Endian)
+        _Alignas(SYSTEM_CACHE_LINE) const struct opcode_decoded *decoded; //!< Decode table entry for instruction
+        opcode_fn fn; //!< The function implementation of the next instruction to execute
+        unsigned short instruction; //!< Address of the next instruction to execute
         unsigned short jumpToInstruction; //!< Address of next instruction to jump to, or zero
         int skipNextInstruction; //!< Boolean state
-        unsigned short instruction; //!< Address of the next instruction to execute
-        opcode_fn fn; //!< The function implementation of the next instruction to execute
-        struct opcode_fn_map debug_fn_map[35]; //!< Debug info
+        enum opcode_engine engine; //!< Engine used by OpcodeRun()
+        enum opcode_profile profile; //!< Variant being emulated
+        const struct opcode_quirks *quirks; //!< OPCODE_QUIRKS entry for profile
+        struct jit *jit; //!< JIT compiler state, created on first use
+
+        //! Predecoded instructions indexed by address; NULL until first fetched.
+        //! Entries are dropped by OpcodeInvalidate() whenever memory is written.
+        const struct opcode_decoded *icache[MEMORY_SIZE];
+
+        //! Fused instruction sequence starting at each address, as recognized
+        //! by the threaded engine. Dropped along with icache entries.
+        unsigned char fused[MEMORY_SIZE];
+        unsigned long fusions[OPCODE_FUSION_COUNT]; //!< Times each fused sequence has run
 };
 
 // Described in header file
@@ -47,22 +148,6 @@ unsigned short OpcodeInstruction(struct opcode *c) {
         return c->instruction;
 }
 
-// Describe in header file
-int OpcodeDescription(struct opcode *c, char *str, unsigned int maxLen) {
-        if (str == NULL) {
-                return 0;
-        }
-
-        for (int i=0; i<35; i++) {
-                if (c->fn == c->debug_fn_map[i].address) {
-                        struct opcode_fn_map data = c->debug_fn_map[i];
-                        snprintf(str, maxLen, "%s: %s%c", data.name, data.description, '\0');
-                }
-        }
-
-        return !0;
-}
-
 //! \brief Gets the top 8 bits of the 16-bit instruction
 //! \param[in] c Opcode state to be read
 //! \return The top 8 bits of the opcode instruction
@@ -105,45 +190,55 @@ unsigned int NibbleAt(struct opcode *c, unsigned int pos) {
         return UINT_MAX;
 }
 
+//! \brief Writes one byte of CHIP-8 memory
+//!
+//! Every store made on behalf of the running program must go through here so
+//! that any predecoded instruction covering the address is invalidated.
+//!
+//! \param[in,out] c Opcode state whose instruction cache is to be updated
+//! \param[in,out] s CHIP-8 system state to be updated
+//! \param[in] address Address in CHIP-8 memory to be written
+//! \param[in] value Byte to be written
+static void Store(struct opcode *c, struct system *s, unsigned int address, unsigned char value) {
+        s->memory[address] = value;
+        OpcodeInvalidate(c, address, 1);
+}
+
 // See full fn listing: https://en.wikipedia.org/wiki/CHIP-8#Opcode_table
 
 // Call: Calls RCA 1802 program at address NNN. Not necessary for most ROMs.
-static void Fn0NNN(struct opcode *c, struct system *s) {
+static void Fn0NNN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
         // Not Implemented.
 }
 
 // Display: Clears the screen.
-static void Fn00E0(struct opcode *c, struct system *s) {
+static void Fn00E0(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
         SystemClearScreen(s);
 }
 
 // Flow control: Returns from a subroutine.
-static void Fn00EE(struct opcode *c, struct system *s) {
+static void Fn00EE(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
         SystemStackPop(s);
 }
 
 // Flow control: goto NNN;
-static void Fn1NNN(struct opcode *c, struct system *s) {
-        unsigned int low_byte = LowByte(c);
-        unsigned int nibble = NibbleAt(c, 2);
-        unsigned int address = ((nibble << 8) | low_byte);
+static void Fn1NNN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int address = d->nnn;
         c->jumpToInstruction = address;
 }
 
 // Flow control: Call subroutine at NNN;
-static void Fn2NNN(struct opcode *c, struct system *s) {
-        unsigned int low_byte = LowByte(c);
-        unsigned int nibble = NibbleAt(c, 2);
-        unsigned int address = ((nibble << 8) | low_byte);
+static void Fn2NNN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int address = d->nnn;
 
         SystemStackPush(s);
         c->jumpToInstruction = address;
 }
 
 // Condition: Skip next instruction if VX equals NN.
-static void Fn3XNN(struct opcode *c, struct system *s) {
-        unsigned int nn = LowByte(c);
-        unsigned int x = NibbleAt(c, 2);
+static void Fn3XNN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int nn = d->nn;
+        unsigned int x = d->x;
 
         if (s->v[x] == nn) {
                 c->skipNextInstruction = 1;
@@ -151,9 +246,9 @@ static void Fn3XNN(struct opcode *c, struct system *s) {
 }
 
 // Condition: Skip next instruction if VX doesn't equal NN.
-static void Fn4XNN(struct opcode *c, struct system *s) {
-        unsigned int nn = LowByte(c);
-        unsigned int x = NibbleAt(c, 2);
+static void Fn4XNN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int nn = d->nn;
+        unsigned int x = d->x;
 
         if (s->v[x] != nn) {
                 c->skipNextInstruction = 1;
@@ -161,9 +256,9 @@ static void Fn4XNN(struct opcode *c, struct system *s) {
 }
 
 // Condition: Skip next instruction if VX equals VY.
-static void Fn5XY0(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
-        unsigned int y = NibbleAt(c, 1);
+static void Fn5XY0(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
 
         if (s->v[x] == s->v[y]) {
                 c->skipNextInstruction = 1;
@@ -171,70 +266,103 @@ static void Fn5XY0(struct opcode *c, struct system *s) {
 }
 
 // Constant expression: Sets VX to NN.
-static void Fn6XNN(struct opcode *c, struct system *s) {
-        unsigned int nn = LowByte(c);
-        unsigned int x = NibbleAt(c, 2);
+static void Fn6XNN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int nn = d->nn;
+        unsigned int x = d->x;
 
         s->v[x] = nn;
 }
 
 // Constant expression: Adds NN to VX (carry flag is not changed).
-static void Fn7XNN(struct opcode *c, struct system *s) {
-        unsigned int nn = LowByte(c);
-        unsigned int x = NibbleAt(c, 2);
+static void Fn7XNN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int nn = d->nn;
+        unsigned int x = d->x;
 
         s->v[x] += nn;
 }
 
 // Assignment: Sets VX to the value of VY.
-static void Fn8XY0(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
-        unsigned int y = NibbleAt(c, 1);
+static void Fn8XY0(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
 
         s->v[x] = s->v[y];
 }
 
-// Bitwise operation: Sets VX to: VX | VY.
-static void Fn8XY1(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
-        unsigned int y = NibbleAt(c, 1);
+// Bitwise operation: Sets VX to: VX | VY. Some variants then reset VF.
+static inline void Exec8XY1(const struct opcode_quirks *q, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
 
         s->v[x] = s->v[x] | s->v[y];
+
+        if (q->resetVf) {
+                s->v[15] = 0;
+        }
+}
+
+static void Fn8XY1(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        Exec8XY1(c->quirks, s, d);
 }
 
-// Bitwise operation: Sets VX to: VX & VY.
-static void Fn8XY2(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
-        unsigned int y = NibbleAt(c, 1);
+// Bitwise operation: Sets VX to: VX & VY. Some variants then reset VF.
+static inline void Exec8XY2(const struct opcode_quirks *q, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
 
         s->v[x] = s->v[x] & s->v[y];
+
+        if (q->resetVf) {
+                s->v[15] = 0;
+        }
 }
 
-// Bitwise operation: Sets VX to: VX ^ VY.
-static void Fn8XY3(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
-        unsigned int y = NibbleAt(c, 1);
+static void Fn8XY2(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        Exec8XY2(c->quirks, s, d);
+}
+
+// Bitwise operation: Sets VX to: VX ^ VY. Some variants then reset VF.
+static inline void Exec8XY3(const struct opcode_quirks *q, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
 
         s->v[x] = s->v[x] ^ s->v[y];
+
+        if (q->resetVf) {
+                s->v[15] = 0;
+        }
+}
+
+static void Fn8XY3(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        Exec8XY3(c->quirks, s, d);
 }
 
 // Math: Adds VY to VX. VF is set to 1 when there's a carry and 0 otherwise.
-static void Fn8XY4(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
-        unsigned int y = NibbleAt(c, 1);
+// Originally VF was left alone when there was no carry.
+static inline void Exec8XY4(const struct opcode_quirks *q, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
 
         int val = s->v[x] + s->v[y];
         s->v[x] = (unsigned char)val;
 
-        if ((int)(s->v[x]) != val) {
-                s->v[15] = 1;
+        if (q->original) {
+                if ((int)(s->v[x]) != val) {
+                        s->v[15] = 1;
+                }
+        } else {
+                s->v[15] = (val > 0xFF);
         }
 }
 
+static void Fn8XY4(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        Exec8XY4(c->quirks, s, d);
+}
+
 // Math: VY is subtracted from VX. VF is set to 0 when there's a borrow and 1 otherwise.
-static void Fn8XY5(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
-        unsigned int y = NibbleAt(c, 1);
+static void Fn8XY5(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
 
         int val = s->v[x] - s->v[y];
         s->v[x] = (unsigned char)val;
@@ -246,19 +374,31 @@ static void Fn8XY5(struct opcode *c, struct system *s) {
 }
 
 // Bitwise operation: Stores the least significant bit of VX in VF and then shifts VX to the right by 1.
-static void Fn8XY6(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
-        // unsigned int y = NibbleAt(c, 1);
+// Some variants shift VY into VX instead.
+static inline void Exec8XY6(const struct opcode_quirks *q, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
+
+        if (q->original) {
+                unsigned char lsb = s->v[x] | 0x01;
+                s->v[15] = lsb;
+                s->v[x] = (s->v[x] >> 1);
+                return;
+        }
+
+        unsigned char val = q->shiftVy ? s->v[y] : s->v[x];
+        s->v[x] = (val >> 1);
+        s->v[15] = val & 0x01;
+}
 
-        unsigned char lsb = s->v[x] | 0x01;
-        s->v[15] = lsb;
-        s->v[x] = (s->v[x] >> 1);
+static void Fn8XY6(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        Exec8XY6(c->quirks, s, d);
 }
 
 // Math: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
-static void Fn8XY7(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
-        unsigned int y = NibbleAt(c, 1);
+static void Fn8XY7(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
 
         int val = s->v[y] - s->v[x];
         s->v[x] = (unsigned char)val;
@@ -270,18 +410,31 @@ static void Fn8XY7(struct opcode *c, struct system *s) {
 }
 
 // Bitwise operation: Stores the most significant bit of VX in VF and then shifts VX to the left by 1.
-static void Fn8XYE(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+// Some variants shift VY into VX instead.
+static inline void Exec8XYE(const struct opcode_quirks *q, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
+
+        if (q->original) {
+                unsigned char msb = s->v[x] | 0x80;
+                s->v[15] = msb;
+                s->v[x] = (s->v[x] << 1);
+                return;
+        }
+
+        unsigned char val = q->shiftVy ? s->v[y] : s->v[x];
+        s->v[x] = (val << 1);
+        s->v[15] = val >> 7;
+}
 
-        unsigned char msb = s->v[x] | 0x80;
-        s->v[15] = msb;
-        s->v[x] = (s->v[x] << 1);
+static void Fn8XYE(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        Exec8XYE(c->quirks, s, d);
 }
 
 // Condition: Skips the next instruction if VX doesn't equal VY.
-static void Fn9XY0(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
-        unsigned int y = NibbleAt(c, 1);
+static void Fn9XY0(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
+        unsigned int y = d->y;
 
         if (s->v[x] != s->v[y]) {
                 c->skipNextInstruction = 1;
@@ -289,30 +442,36 @@ static void Fn9XY0(struct opcode *c, struct system *s) {
 }
 
 // Memory: Sets I to the address NNN.
-static void FnANNN(struct opcode *c, struct system *s) {
-        unsigned int low_byte = LowByte(c);
-        unsigned int nibble = NibbleAt(c, 2);
-        unsigned int address = ((nibble << 8) | low_byte);
+static void FnANNN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int address = d->nnn;
 
         s->i = address;
 }
 
-// Flow control: Jumps to the address NNN plus V0.
-static void FnBNNN(struct opcode *c, struct system *s) {
-        unsigned int low_byte = LowByte(c);
-        unsigned int nibble = NibbleAt(c, 2);
-        unsigned int address = ((nibble << 8) | low_byte);
+// Flow control: Jumps to the address NNN plus V0, or XNN plus VX on some
+// variants. Originally this set I instead of jumping.
+// Returns the address to jump to, or zero for no jump.
+static inline unsigned int ExecBNNN(const struct opcode_quirks *q, struct system *s, const struct opcode_decoded *d) {
+        unsigned int address = d->nnn;
 
-        s->i = (s->v[0] + address);
+        if (q->original) {
+                s->i = (s->v[0] + address);
+                return 0;
+        }
+
+        return (q->jumpVx ? s->v[d->x] : s->v[0]) + address;
+}
+
+static void FnBNNN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        c->jumpToInstruction = ExecBNNN(c->quirks, s, d);
 }
 
 // Random: Sets VX to the result of a bitwise AND on a random number (0-255) and NN.
-static void FnCXNN(struct opcode *c, struct system *s) {
-        unsigned int nn = LowByte(c);
-        unsigned int x = NibbleAt(c, 2);
+static void FnCXNN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int nn = d->nn;
+        unsigned int x = d->x;
 
-        int r = (unsigned int)(rand() % 255);
-        s->v[x] = nn & r;
+        s->v[x] = nn & SystemRandom(s);
 }
 
 // Display: Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels
@@ -322,17 +481,17 @@ static void FnCXNN(struct opcode *c, struct system *s) {
 // flipped from set to unset when the sprite is drawn, and to 0 if that doesn’t
 // happen.
 // I'm assuming (VX, VY) is the lower-left corner of the sprite, not the center.
-static void FnDXYN(struct opcode *c, struct system *s) {
-        unsigned int x = s->v[NibbleAt(c, 2)];
-        unsigned int y = s->v[NibbleAt(c, 1)];
-        unsigned int height = NibbleAt(c, 0);
+static void FnDXYN(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = s->v[d->x];
+        unsigned int y = s->v[d->y];
+        unsigned int height = d->n;
 
         SystemDrawSprite(s, x, y, height);
 }
 
 // Key operation: Skips the next instruction if the key stored in VX is pressed.
-static void FnEX9E(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+static void FnEX9E(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
         unsigned char key = s->v[x];
 
         if (SystemKeyIsPressed(s, key)) {
@@ -341,8 +500,8 @@ static void FnEX9E(struct opcode *c, struct system *s) {
 }
 
 // Key operation: Skips the next instruction if the key stored in VX isn't pressed.
-static void FnEXA1(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+static void FnEXA1(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
         unsigned char key = s->v[x];
 
         if (!SystemKeyIsPressed(s, key)) {
@@ -351,45 +510,45 @@ static void FnEXA1(struct opcode *c, struct system *s) {
 }
 
 // Timer: Sets VX to the value of the delay timer.
-static void FnFX07(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+static void FnFX07(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
 
         s->v[x] = SystemDelayTimer(s);
 }
 
 // Key operation: Block until a key press occurs, then store it in VX.
-static void FnFX0A(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+static void FnFX0A(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
 
         SystemWFKSet(s, x);
 }
 
 // Timer: Sets the delay timer to VX.
-static void FnFX15(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+static void FnFX15(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
 
         SystemSetTimers(s, s->v[x], -1);
 }
 
 // Sound: Sets the sound timer to VX.
-static void FnFX18(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+static void FnFX18(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
 
         SystemSetTimers(s, -1, s->v[x]);
         SystemSoundSetTrigger(s, 1);
 }
 
 // Memory: Adds VX to I.
-static void FnFX1E(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+static void FnFX1E(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
 
         s->i += s->v[x];
 }
 
 // Memory: Sets I to the location of the sprite for the character in
 // VX. Characters 0-F (hex) are represented by a 4x5 font.
-static void FnFX29(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+static void FnFX29(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
 
         unsigned char sprite = s->v[x];
 
@@ -402,8 +561,8 @@ static void FnFX29(struct opcode *c, struct system *s) {
 // words, take the decimal representation of VX, place the hundreds digit in
 // memory at location in I, the tens digit at location I+1, and the ones digit
 // at location I+2.)
-static void FnFX33(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+static void FnFX33(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
         unsigned char val = s->v[x];
 
         // Calculate starting at the ones digit, then tens, then hundreds.
@@ -412,105 +571,111 @@ static void FnFX33(struct opcode *c, struct system *s) {
         // s->memory[s->i+1] = tens digit
         // s->memory[s->i+2] = ones digit
         //
-        for (int i=0, j=3; i<3; i++, j--) {
-                s->memory[s->i + j] = val % 10;
+        for (int i=0, j=2; i<3; i++, j--) {
+                Store(c, s, s->i + j, val % 10);
                 val = val / 10;
         }
 }
 
 // Memory: Stores V0 to VX (inclusive) in memory starting at address I. I is
-// unmodified.
-static void FnFX55(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+// unmodified, except on variants that leave it at I + X + 1.
+static inline void ExecFX55(struct opcode *c, const struct opcode_quirks *q, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
 
         for (int i=0; i <= x; i++) {
-                s->memory[s->i + i] = s->v[i];
+                Store(c, s, s->i + i, s->v[i]);
+        }
+
+        if (q->incrementI) {
+                s->i += x + 1;
         }
 }
 
+static void FnFX55(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        ExecFX55(c, c->quirks, s, d);
+}
+
 // Memory: Fills V0 to VX (inclusive) with values from memory starting at
-// address I.  I is unmodified.
-static void FnFX65(struct opcode *c, struct system *s) {
-        unsigned int x = NibbleAt(c, 2);
+// address I.  I is unmodified, except on variants that leave it at I + X + 1.
+static inline void ExecFX65(const struct opcode_quirks *q, struct system *s, const struct opcode_decoded *d) {
+        unsigned int x = d->x;
 
         for (int i=0; i <= x; i++) {
                 s->v[i] = s->memory[s->i + i];
         }
-}
 
-struct opcode *OpcodeInit() {
-        struct opcode *c = (struct opcode *)malloc(sizeof(struct opcode));
-        memset(c, 0, sizeof(struct opcode));
-
-        c->instruction = 0;
-        c->fn = NULL;
-        c->skipNextInstruction = 0;
-        c->jumpToInstruction = 0; // Can be zero for "off" because normal memory starts at 0x200
-
-        c->debug_fn_map[0] = (struct opcode_fn_map){ "0NNN", Fn0NNN, "Call RCA 1802 program at address NNN. (NOP)" };
-        c->debug_fn_map[1] = (struct opcode_fn_map){ "00E0", Fn00E0, "Clear the screen" };
-        c->debug_fn_map[2] = (struct opcode_fn_map){ "00EE", Fn00EE, "Return from subroutine" };
-        c->debug_fn_map[3] = (struct opcode_fn_map){ "1NNN", Fn1NNN, "Goto NNN" };
-        c->debug_fn_map[4] = (struct opcode_fn_map){ "2NNN", Fn2NNN, "Call subroutine at NNN" };
-        c->debug_fn_map[5] = (struct opcode_fn_map){ "3XNN", Fn3XNN, "Skip next instruction if VX equals NN" };
-        c->debug_fn_map[6] = (struct opcode_fn_map){ "4XNN", Fn4XNN, "Skip next instruction if VX doesn't equal NN" };
-        c->debug_fn_map[7] = (struct opcode_fn_map){ "5XY0", Fn5XY0, "Skip next instruction if VX equals VY" };
-        c->debug_fn_map[8] = (struct opcode_fn_map){ "6XNN", Fn6XNN, "Set VX to NN" };
-        c->debug_fn_map[9] = (struct opcode_fn_map){ "7XNN", Fn7XNN, "Add NN to VX without changing carry flag" };
-        c->debug_fn_map[10] = (struct opcode_fn_map){ "8XY0", Fn8XY0, "Set VX to the value of VY" };
-        c->debug_fn_map[11] = (struct opcode_fn_map){ "8XY1", Fn8XY1, "Set VX to VX | VY" };
-        c->debug_fn_map[12] = (struct opcode_fn_map){ "8XY2", Fn8XY2, "Set VX to VX & VY" };
-        c->debug_fn_map[13] = (struct opcode_fn_map){ "8XY3", Fn8XY3, "Set VX to VX ^ VY" };
-        c->debug_fn_map[14] = (struct opcode_fn_map){ "8XY4", Fn8XY4, "Add VY to VX. FV is set to 1 on carry, otherwise 0" };
-        c->debug_fn_map[15] = (struct opcode_fn_map){ "8XY5", Fn8XY5, "Subtract VY from VX. VF is set to 0 on a borrow, otherwise 1" };
-        c->debug_fn_map[16] = (struct opcode_fn_map){ "8XY6", Fn8XY6, "Store the lsb of VX in VF then shift VX to the right by 1" };
-        c->debug_fn_map[17] = (struct opcode_fn_map){ "8XY7", Fn8XY7, "Set VX to VY minus VX. VF is set to 0 on a borrow, otherwise 1" };
-        c->debug_fn_map[18] = (struct opcode_fn_map){ "8XYE", Fn8XYE, "Store the msb of VX in VF then shift VX to the left by 1" };
-        c->debug_fn_map[19] = (struct opcode_fn_map){ "9XY0", Fn9XY0, "Skip next instruction if VX doesn't equal VY" };
-        c->debug_fn_map[20] = (struct opcode_fn_map){ "ANNN", FnANNN, "Set I to the addres NNN" };
-        c->debug_fn_map[21] = (struct opcode_fn_map){ "BNNN", FnBNNN, "Jump to the address NNN plus V0" };
-        c->debug_fn_map[22] = (struct opcode_fn_map){ "CXNN", FnCXNN, "Set VX to NN & R where R is a random number in [0-255]" };
-        c->debug_fn_map[23] = (struct opcode_fn_map){ "DXYN", FnDXYN, "Draw sprite at (VX, VY)" };
-        c->debug_fn_map[24] = (struct opcode_fn_map){ "EX9E", FnEX9E, "Skip next instruction if the key stored in VX is pressed" };
-        c->debug_fn_map[25] = (struct opcode_fn_map){ "EXA1", FnEXA1, "Skip next instruction if key stored in VX isn't pressed" };
-        c->debug_fn_map[26] = (struct opcode_fn_map){ "FX07", FnFX07, "Set VX to the value of the delay timer" };
-        c->debug_fn_map[27] = (struct opcode_fn_map){ "FX0A", FnFX0A, "Block until a key press occurs, storing it in VX" };
-        c->debug_fn_map[28] = (struct opcode_fn_map){ "FX15", FnFX15, "Set the delay timer to VX" };
-        c->debug_fn_map[29] = (struct opcode_fn_map){ "FX18", FnFX18, "Set the sound timer to VX" };
-        c->debug_fn_map[30] = (struct opcode_fn_map){ "FX1E", FnFX1E, "Add VX to I" };
-        c->debug_fn_map[31] = (struct opcode_fn_map){ "FX29", FnFX29, "Set I to the location of the sprite for the character in VX" };
-        c->debug_fn_map[32] = (struct opcode_fn_map){ "FX33", FnFX33, "Store big-endian binary-coded decimal representation of VX in memory starting at I" };
-        c->debug_fn_map[33] = (struct opcode_fn_map){ "FX55", FnFX55, "Store V0 through VX in memory starting at I" };
-        c->debug_fn_map[34] = (struct opcode_fn_map){ "FX65", FnFX65, "Fill V0 through VX with values from memory starting at I" };
+        if (q->incrementI) {
+                s->i += x + 1;
+        }
+}
 
-        return c;
+static void FnFX65(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        ExecFX65(c->quirks, s, d);
 }
 
-void OpcodeDeinit(struct opcode *c) {
-        if (NULL == c)
-                return;
+//! Debug information for every opcode function, indexed by enum opcode_fn_id.
+static const struct opcode_fn_map OPCODE_FN_MAP[] = {
+        [OPCODE_FN_0NNN] = { "0NNN", Fn0NNN, "Call RCA 1802 program at address NNN. (NOP)" },
+        [OPCODE_FN_00E0] = { "00E0", Fn00E0, "Clear the screen" },
+        [OPCODE_FN_00EE] = { "00EE", Fn00EE, "Return from subroutine" },
+        [OPCODE_FN_1NNN] = { "1NNN", Fn1NNN, "Goto NNN" },
+        [OPCODE_FN_2NNN] = { "2NNN", Fn2NNN, "Call subroutine at NNN" },
+        [OPCODE_FN_3XNN] = { "3XNN", Fn3XNN, "Skip next instruction if VX equals NN" },
+        [OPCODE_FN_4XNN] = { "4XNN", Fn4XNN, "Skip next instruction if VX doesn't equal NN" },
+        [OPCODE_FN_5XY0] = { "5XY0", Fn5XY0, "Skip next instruction if VX equals VY" },
+        [OPCODE_FN_6XNN] = { "6XNN", Fn6XNN, "Set VX to NN" },
+        [OPCODE_FN_7XNN] = { "7XNN", Fn7XNN, "Add NN to VX without changing carry flag" },
+        [OPCODE_FN_8XY0] = { "8XY0", Fn8XY0, "Set VX to the value of VY" },
+        [OPCODE_FN_8XY1] = { "8XY1", Fn8XY1, "Set VX to VX | VY" },
+        [OPCODE_FN_8XY2] = { "8XY2", Fn8XY2, "Set VX to VX & VY" },
+        [OPCODE_FN_8XY3] = { "8XY3", Fn8XY3, "Set VX to VX ^ VY" },
+        [OPCODE_FN_8XY4] = { "8XY4", Fn8XY4, "Add VY to VX. FV is set to 1 on carry, otherwise 0" },
+        [OPCODE_FN_8XY5] = { "8XY5", Fn8XY5, "Subtract VY from VX. VF is set to 0 on a borrow, otherwise 1" },
+        [OPCODE_FN_8XY6] = { "8XY6", Fn8XY6, "Store the lsb of VX in VF then shift VX to the right by 1" },
+        [OPCODE_FN_8XY7] = { "8XY7", Fn8XY7, "Set VX to VY minus VX. VF is set to 0 on a borrow, otherwise 1" },
+        [OPCODE_FN_8XYE] = { "8XYE", Fn8XYE, "Store the msb of VX in VF then shift VX to the left by 1" },
+        [OPCODE_FN_9XY0] = { "9XY0", Fn9XY0, "Skip next instruction if VX doesn't equal VY" },
+        [OPCODE_FN_ANNN] = { "ANNN", FnANNN, "Set I to the addres NNN" },
+        [OPCODE_FN_BNNN] = { "BNNN", FnBNNN, "Jump to the address NNN plus V0" },
+        [OPCODE_FN_CXNN] = { "CXNN", FnCXNN, "Set VX to NN & R where R is a random number in [0-255]" },
+        [OPCODE_FN_DXYN] = { "DXYN", FnDXYN, "Draw sprite at (VX, VY)" },
+        [OPCODE_FN_EX9E] = { "EX9E", FnEX9E, "Skip next instruction if the key stored in VX is pressed" },
+        [OPCODE_FN_EXA1] = { "EXA1", FnEXA1, "Skip next instruction if key stored in VX isn't pressed" },
+        [OPCODE_FN_FX07] = { "FX07", FnFX07, "Set VX to the value of the delay timer" },
+        [OPCODE_FN_FX0A] = { "FX0A", FnFX0A, "Block until a key press occurs, storing it in VX" },
+        [OPCODE_FN_FX15] = { "FX15", FnFX15, "Set the delay timer to VX" },
+        [OPCODE_FN_FX18] = { "FX18", FnFX18, "Set the sound timer to VX" },
+        [OPCODE_FN_FX1E] = { "FX1E", FnFX1E, "Add VX to I" },
+        [OPCODE_FN_FX29] = { "FX29", FnFX29, "Set I to the location of the sprite for the character in VX" },
+        [OPCODE_FN_FX33] = { "FX33", FnFX33, "Store big-endian binary-coded decimal representation of VX in memory starting at I" },
+        [OPCODE_FN_FX55] = { "FX55", FnFX55, "Store V0 through VX in memory starting at I" },
+        [OPCODE_FN_FX65] = { "FX65", FnFX65, "Fill V0 through VX with values from memory starting at I" },
+};
 
-        free(c);
-}
+_Static_assert(sizeof(OPCODE_FN_MAP) / sizeof(OPCODE_FN_MAP[0]) == OPCODE_FN_COUNT, "OPCODE_FN_MAP must cover enum opcode_fn_id");
 
-// Stores two-byte opcode from memory pointed to by pc into opcode c.
-void OpcodeFetch(struct opcode *c, struct system *s) {
-        // NOTE: opcodes are stored as Big-Endian 16-bit values in memory.
-        // We need to convert from Big-Endian to Little-Endian since I'm writing
-        // this on x86-64.
+// Describe in header file
+int OpcodeDescription(struct opcode *c, char *str, unsigned int maxLen) {
+        if (str == NULL) {
+                return 0;
+        }
 
-        // Fetch the first byte from memory.
-        // Left shift 8 bits, padding on the right with zeroes.
-        // Binary OR with the next byte from memory.
-        // eg.:
-        //     A200
-        //  OR 00B7
-        //  =======
-        //     A2B7
-        c->instruction = s->memory[s->pc] << 8 | s->memory[s->pc + 1];
+        if (c->decoded != NULL && c->decoded->id < OPCODE_FN_COUNT) {
+                struct opcode_fn_map data = OPCODE_FN_MAP[c->decoded->id];
+                snprintf(str, maxLen, "%s: %s%c", data.name, data.description, '\0');
+        }
+
+        return !0;
 }
 
-void OpcodeDecode(struct opcode *c) {
+//! \brief Maps an instruction to the function implementing it
+//!
+//! This is only used to build the decode table; OpcodeDecode() does a lookup
+//! into that table instead.
+//!
+//! \param[in] c Opcode state to be read
+//! \return The function implementation, or NULL if the instruction is unknown
+static opcode_fn DecodeFn(struct opcode *c) {
         unsigned int nibble = NibbleAt(c, 3);
 
         switch (nibble) {
@@ -518,116 +683,116 @@ void OpcodeDecode(struct opcode *c) {
                         unsigned int low_byte = LowByte(c);
                         switch (low_byte) {
                                 case 0xE0: {
-                                        c->fn = Fn00E0;
+                                        return Fn00E0;
                                 } break;
 
                                 case 0xEE: {
-                                        c->fn = Fn00EE;
+                                        return Fn00EE;
                                 } break;
 
                                 default: {
-                                        c->fn = Fn0NNN;
+                                        return Fn0NNN;
                                 } break;
                         }
                 } break;
 
                 case 1: {
-                        c->fn = Fn1NNN;
+                        return Fn1NNN;
                 } break;
 
                 case 2: {
-                        c->fn = Fn2NNN;
+                        return Fn2NNN;
                 } break;
 
                 case 3: {
-                        c->fn = Fn3XNN;
+                        return Fn3XNN;
                 } break;
 
                 case 4: {
-                        c->fn = Fn4XNN;
+                        return Fn4XNN;
                 } break;
 
                 case 5: {
-                        c->fn = Fn5XY0;
+                        return Fn5XY0;
                 } break;
 
                 case 6: {
-                        c->fn = Fn6XNN;
+                        return Fn6XNN;
                 } break;
 
                 case 7: {
-                        c->fn = Fn7XNN;
+                        return Fn7XNN;
                 } break;
 
                 case 8: {
                         unsigned int low_bit = NibbleAt(c, 0);
                         switch (low_bit) {
                                 case 0: {
-                                        c->fn = Fn8XY0;
+                                        return Fn8XY0;
                                 } break;
 
                                 case 1: {
-                                        c->fn = Fn8XY1;
+                                        return Fn8XY1;
                                 } break;
 
                                 case 2: {
-                                        c->fn = Fn8XY2;
+                                        return Fn8XY2;
                                 } break;
 
                                 case 3: {
-                                        c->fn = Fn8XY3;
+                                        return Fn8XY3;
                                 } break;
 
                                 case 4: {
-                                        c->fn = Fn8XY4;
+                                        return Fn8XY4;
                                 } break;
 
                                 case 5: {
-                                        c->fn = Fn8XY5;
+                                        return Fn8XY5;
                                 } break;
 
                                 case 6: {
-                                        c->fn = Fn8XY6;
+                                        return Fn8XY6;
                                 } break;
 
                                 case 7: {
-                                        c->fn = Fn8XY7;
+                                        return Fn8XY7;
                                 } break;
 
                                 case 0xE: {
-                                        c->fn = Fn8XYE;
+                                        return Fn8XYE;
                                 } break;
                         }
                 } break;
 
                 case 9: {
-                        c->fn = Fn9XY0;
+                        return Fn9XY0;
                 } break;
 
                 case 0xA: {
-                        c->fn = FnANNN;
+                        return FnANNN;
                 } break;
 
                 case 0xB: {
-                        c->fn = FnBNNN;
+                        return FnBNNN;
                 } break;
 
                 case 0xC: {
-                        c->fn = FnCXNN;
+                        return FnCXNN;
                 } break;
 
                 case 0xD: {
-                        c->fn = FnDXYN;
+                        return FnDXYN;
                 } break;
 
                 case 0xE: {
                         unsigned int low_byte = LowByte(c);
                         switch (low_byte) {
                                 case 0x9E: {
-                                        c->fn = FnEX9E;
+                                        return FnEX9E;
                                 } break;
                                 case 0xA1: {
-                                        c->fn = FnEXA1;
+                                        return FnEXA1;
                                 } break;
                         }
                 } break;
@@ -636,46 +801,187 @@ void OpcodeDecode(struct opcode *c) {
                         unsigned int low_byte = LowByte(c);
                         switch (low_byte) {
                                 case 0x07: {
-                                        c->fn = FnFX07;
+                                        return FnFX07;
                                 } break;
 
                                 case 0x0A: {
-                                        c->fn = FnFX0A;
+                                        return FnFX0A;
                                 } break;
 
                                 case 0x15: {
-                                        c->fn = FnFX15;
+                                        return FnFX15;
                                 } break;
 
                                 case 0x18: {
-                                        c->fn = FnFX18;
+                                        return FnFX18;
                                 } break;
 
                                 case 0x1E: {
-                                        c->fn = FnFX1E;
+                                        return FnFX1E;
                                 } break;
 
                                 case 0x29: {
-                                        c->fn = FnFX29;
+                                        return FnFX29;
                                 } break;
 
                                 case 0x33: {
-                                        c->fn = FnFX33;
+                                        return FnFX33;
                                 } break;
 
                                 case 0x55: {
-                                        c->fn = FnFX55;
+                                        return FnFX55;
                                 } break;
 
                                 case 0x65: {
-                                        c->fn = FnFX65;
+                                        return FnFX65;
                                 } break;
                         }
                 } break;
-                default: {
-                        printf("Unknown opcode: 0x%04X\n", c->instruction);
+        }
+
+        return NULL;
+}
+
+//! Every possible instruction, decoded.  Built once by DecodeTableBuild().
+static struct opcode_decoded DECODE_TABLE[USHRT_MAX + 1];
+static pthread_once_t decodeTableOnce = PTHREAD_ONCE_INIT;
+
+//! \brief Fills in DECODE_TABLE. Called exactly once via pthread_once().
+static void DecodeTableBuild() {
+        struct opcode c;
+        memset(&c, 0, sizeof(struct opcode));
+
+        for (unsigned int i = 0; i <= USHRT_MAX; i++) {
+                c.instruction = i;
+
+                struct opcode_decoded *d = &DECODE_TABLE[i];
+                d->fn = DecodeFn(&c);
+                d->nnn = (NibbleAt(&c, 2) << 8) | LowByte(&c);
+                d->nn = LowByte(&c);
+                d->x = NibbleAt(&c, 2);
+                d->y = NibbleAt(&c, 1);
+                d->n = NibbleAt(&c, 0);
+
+                d->id = OPCODE_FN_COUNT;
+                for (int j = 0; j < OPCODE_FN_COUNT; j++) {
+                        if (d->fn == OPCODE_FN_MAP[j].address) {
+                                d->id = j;
+                                break;
+                        }
+                }
+        }
+}
+
+//! \brief Gets the decoded instruction at an address
+//!
+//! Each address is only read and decoded the first time it is fetched; after
+//! that the predecoded entry is reused until a store invalidates it.
+//!
+//! \param[in,out] c Opcode state whose instruction cache is to be used
+//! \param[in] s CHIP-8 system state to be read
+//! \param[in] address Address of the instruction
+//! \return The decode table entry for the instruction at address
+static inline const struct opcode_decoded *PredecodedAt(struct opcode *c, struct system *s, unsigned int address) {
+        if (address + 1 >= MEMORY_SIZE) { // Runaway pc; nothing sensible to cache.
+                return &DECODE_TABLE[s->memory[address] << 8 | s->memory[address + 1]];
+        }
+
+        const struct opcode_decoded **cached = &c->icache[address];
+        if (*cached == NULL) {
+                *cached = &DECODE_TABLE[s->memory[address] << 8 | s->memory[address + 1]];
+        }
+
+        return *cached;
+}
+
+//! \brief Gets the decoded instruction at the CHIP-8's pc
+//! \see PredecodedAt()
+static inline const struct opcode_decoded *Predecoded(struct opcode *c, struct system *s) {
+        return PredecodedAt(c, s, s->pc);
+}
+
+//! \brief Executes up to count instructions one OpcodeFetch(), OpcodeDecode()
+//! and OpcodeExecute() at a time
+//! \see OpcodeRun()
+static unsigned int RunReference(struct opcode *c, struct system *s, unsigned int count) {
+        unsigned int executed = 0;
+
+        while (executed < count) {
+                OpcodeFetch(c, s);
+                OpcodeDecode(c);
+                if (c->fn == NULL) {
+                        break;
+                }
+
+                OpcodeExecute(c, s);
+                executed++;
+
+                if (c->fn == FnFX0A) {
+                        break;
                 }
         }
+
+        return executed;
+}
+
+#include "opcodethreaded.c"
+#include "opcodejit.c"
+
+struct opcode *OpcodeInit() {
+        pthread_once(&decodeTableOnce, DecodeTableBuild);
+
+        struct opcode *c = (struct opcode *)aligned_alloc(SYSTEM_CACHE_LINE, sizeof(struct opcode));
+        memset(c, 0, sizeof(struct opcode));
+
+        c->instruction = 0;
+        c->fn = NULL;
+        c->decoded = NULL;
+        c->engine = OPCODE_ENGINE_REFERENCE;
+        c->profile = OPCODE_PROFILE_DEFAULT;
+        c->quirks = &OPCODE_QUIRKS[OPCODE_PROFILE_DEFAULT];
+        c->jit = NULL;
+        c->skipNextInstruction = 0;
+        c->jumpToInstruction = 0; // Can be zero for "off" because normal memory starts at 0x200
+
+
+        return c;
+}
+
+void OpcodeDeinit(struct opcode *c) {
+        if (NULL == c)
+                return;
+
+        JitDeinit(c->jit);
+        free(c);
+}
+
+// Stores two-byte opcode from memory pointed to by pc into opcode c.
+void OpcodeFetch(struct opcode *c, struct system *s) {
+        // NOTE: opcodes are stored as Big-Endian 16-bit values in memory.
+        // We need to convert from Big-Endian to Little-Endian since I'm writing
+        // this on x86-64.
+
+        // Fetch the first byte from memory.
+        // Left shift 8 bits, padding on the right with zeroes.
+        // Binary OR with the next byte from memory.
+        // eg.:
+        //     A200
+        //  OR 00B7
+        //  =======
+        //     A2B7
+        //
+        // See Predecoded().
+        c->decoded = Predecoded(c, s);
+        c->instruction = (unsigned short)(c->decoded - DECODE_TABLE);
+}
+
+void OpcodeDecode(struct opcode *c) {
+        c->decoded = &DECODE_TABLE[c->instruction];
+        c->fn = c->decoded->fn;
+
+        if (c->fn == NULL) {
+                printf("Unknown opcode: 0x%04X\n", c->instruction);
+        }
 }
 
 void OpcodeExecute(struct opcode *c, struct system *s) {
@@ -684,7 +990,7 @@ void OpcodeExecute(struct opcode *c, struct system *s) {
                 return;
         }
 
-        c->fn(c, s);
+        c->fn(c, s, c->decoded);
 
         if (c->jumpToInstruction) {
                 s->pc = c->jumpToInstruction;
@@ -697,3 +1003,68 @@ void OpcodeExecute(struct opcode *c, struct system *s) {
                 }
         }
 }
+
+void OpcodeInvalidate(struct opcode *c, unsigned int address, unsigned int length) {
+        // An instruction starting one byte before address also covers it.
+        unsigned int start = (address > 0) ? address - 1 : 0;
+        unsigned int end = address + length;
+
+        for (unsigned int a = start; a < end && a < MEMORY_SIZE; a++) {
+                c->icache[a] = NULL;
+        }
+
+        FusedInvalidate(c, address, length);
+        JitInvalidate(c->jit, address, length);
+}
+
+void OpcodeSetEngine(struct opcode *c, enum opcode_engine engine) {
+        c->engine = engine;
+}
+
+// Described in header file
+void OpcodeSetProfile(struct opcode *c, enum opcode_profile profile) {
+        if (profile >= OPCODE_PROFILE_COUNT) {
+                return;
+        }
+
+        c->profile = profile;
+        c->quirks = &OPCODE_QUIRKS[profile];
+
+        // Fused sequences and translated blocks may have the old quirks built in.
+        OpcodeInvalidate(c, 0, MEMORY_SIZE);
+}
+
+unsigned int OpcodeRun(struct opcode *c, struct system *s, unsigned int count) {
+        switch (c->engine) {
+                case OPCODE_ENGINE_THREADED:
+                        return RunThreaded(c, s, count);
+
+                case OPCODE_ENGINE_JIT:
+                        return RunJit(c, s, count);
+
+                case OPCODE_ENGINE_REFERENCE:
+                default:
+                        return RunReference(c, s, count);
+        }
+}
+
+// Described in header file
+unsigned long OpcodeFusionCount(struct opcode *c, enum opcode_fusion fusion) {
+        if (fusion >= OPCODE_FUSION_COUNT) {
+                return 0;
+        }
+
+        return c->fusions[fusion];
+}
+
+// Described in header file
+const char *OpcodeName(unsigned short instruction) {
+        pthread_once(&decodeTableOnce, DecodeTableBuild);
+
+        unsigned char id = DECODE_TABLE[instruction].id;
+        if (id >= OPCODE_FN_COUNT) {
+                return NULL;
+        }
+
+        return OPCODE_FN_MAP[id].name;
+}
@@ -18,13 +18,19 @@
 //! 3. OpcodeExecute()
 //!
 //! OpcodeFetch() reads the instruction pointed to by the CHIP-8's program
-//! counter, then increments that pointer appropriately.
+//! counter, then increments that pointer appropriately.  Instructions are
+//! predecoded per address, so steady-state fetches don't touch CHIP-8 memory.
 //!
 //! OpcodeDecode() interprets the instruction read by OpcodeFetch() and sets up
-//! internal state to prepare for OpcodeExecute().
+//! internal state to prepare for OpcodeExecute().  Every possible instruction
+//! is decoded once up front into a 64K-entry table, so this is a single lookup.
 //!
 //! OpcodeExecute() executes the function that represents the instruction being
 //! pointed to and updates the internal state of the CHIP-8 system.
+//!
+//! OpcodeRun() executes many instructions at once using one of several
+//! interchangeable engines. The reference engine is simply a loop around the
+//! three routines above and serves as the correctness oracle for the others.
 
 #ifndef OPCODE_VERSION
 #define OPCODE_VERSION "0.1.0"
@@ -32,7 +38,39 @@
 struct opcode;
 struct system;
 
+//! Interpreter engines used by OpcodeRun()
+enum opcode_engine {
+        OPCODE_ENGINE_REFERENCE, //!< OpcodeFetch(), OpcodeDecode() and OpcodeExecute() in a loop
+        OPCODE_ENGINE_THREADED, //!< Direct-threaded dispatch via computed goto
+        OPCODE_ENGINE_JIT, //!< Blocks translated to native x86-64 code
+};
+
+//! \brief Behaviors that differ between CHIP-8 variants
+//!
+//! A profile decides what 8XY6 and 8XYE shift, whether FX55 and FX65 advance
+//! I, whether BNNN jumps via V0 or BXNN via VX, and whether 8XY1, 8XY2 and 8XY3
+//! reset VF. Every profile other than the default also sets VF last, from the
+//! true carry, borrow or shifted-out bit.
+enum opcode_profile {
+        OPCODE_PROFILE_DEFAULT, //!< This emulator's original behavior
+        OPCODE_PROFILE_COSMAC_VIP, //!< The original COSMAC VIP interpreter
+        OPCODE_PROFILE_SCHIP, //!< SUPER-CHIP 1.1 on the HP-48
+        OPCODE_PROFILE_XO_CHIP, //!< XO-CHIP as implemented by Octo
+        OPCODE_PROFILE_COUNT, //!< Number of profiles; not a profile itself
+};
+
+//! Instruction sequences the threaded engine executes as a single step
+enum opcode_fusion {
+        OPCODE_FUSION_SPRITE, //!< 6XNN, 6XNN, ANNN, DXYN: Set up and draw a sprite
+        OPCODE_FUSION_DELAY_WAIT, //!< FX07, 3XNN, 1NNN: Wait for the delay timer
+        OPCODE_FUSION_COUNTED_LOOP, //!< 7XNN, 3XNN, 1NNN: Count a register up to a limit
+        OPCODE_FUSION_COUNT, //!< Number of fused sequences; not a sequence itself
+};
+
 //! \brief Creates and initializes a new opcode object instance
+//!
+//! The first call also builds the process-wide decode table.
+//!
 //! \return The initialized opcode object
 struct opcode *
 OpcodeInit();
@@ -61,7 +99,8 @@ OpcodeFetch(struct opcode *opcode, struct system *system);
 //! OpcodeExecute().
 //!
 //! Each opcode is represented internally by a function and stored as a function
-//! pointer: opcode_fn.
+//! pointer: opcode_fn.  The function and its pre-extracted operands are looked
+//! up in the decode table built by OpcodeInit().
 //!
 //! \param[in,out] opcode Opcode state to be updated
 //! \see CHIP-8 Opcode listing: https://en.wikipedia.org/wiki/CHIP-8#Opcode_table
@@ -77,6 +116,77 @@ OpcodeDecode(struct opcode *opcode);
 void
 OpcodeExecute(struct opcode *opcode, struct system *system);
 
+//! \brief Selects the engine used by OpcodeRun()
+//!
+//! Defaults to OPCODE_ENGINE_REFERENCE.
+//!
+//! \param[in,out] opcode Opcode state to be updated
+//! \param[in] engine Which engine to use
+void
+OpcodeSetEngine(struct opcode *opcode, enum opcode_engine engine);
+
+//! \brief Selects the variant whose quirks are emulated
+//!
+//! Defaults to OPCODE_PROFILE_DEFAULT. The threaded engine is compiled once per
+//! profile with the quirks as constants, so no profile runs slower than
+//! another. Changing the profile discards all predecoded and translated code.
+//!
+//! \param[in,out] opcode Opcode state to be updated
+//! \param[in] profile Which variant to emulate
+void
+OpcodeSetProfile(struct opcode *opcode, enum opcode_profile profile);
+
+//! \brief Executes up to count instructions
+//!
+//! Equivalent to calling OpcodeFetch(), OpcodeDecode() and OpcodeExecute()
+//! count times, except that it returns early after executing FX0A, because
+//! the system then waits for a keypress, or upon reaching an unknown
+//! instruction, which is not executed.
+//!
+//! Afterward, OpcodeInstruction() and OpcodeDescription() describe the last
+//! instruction that was reached.
+//!
+//! \param[in,out] opcode Opcode state to be updated
+//! \param[in,out] system CHIP-8 system state to be read and updated
+//! \param[in] count Maximum number of instructions to execute
+//! \return The number of instructions executed
+unsigned int
+OpcodeRun(struct opcode *opcode, struct system *system, unsigned int count);
+
+//! \brief Discards predecoded instructions overlapping a range of memory
+//!
+//! OpcodeFetch() caches the decoded instruction at each address it reads.
+//! Stores made by opcodes (FX33, FX55) invalidate the cache themselves; anything
+//! else that writes CHIP-8 memory after the first fetch must call this.
+//!
+//! \param[in,out] opcode Opcode state whose instruction cache is to be updated
+//! \param[in] address First address of CHIP-8 memory that was written
+//! \param[in] length Number of bytes that were written
+void
+OpcodeInvalidate(struct opcode *opcode, unsigned int address, unsigned int length);
+
+//! \brief Returns how often a fused instruction sequence has run
+//!
+//! OPCODE_ENGINE_THREADED recognizes the sequences in enum opcode_fusion as
+//! they are predecoded and runs each as one step, with exactly the same result
+//! as running its instructions one by one.
+//!
+//! \param[in] opcode Opcode state to be read
+//! \param[in] fusion Which sequence to count
+//! \return The number of times the sequence has run since OpcodeInit()
+unsigned long
+OpcodeFusionCount(struct opcode *opcode, enum opcode_fusion fusion);
+
+//! \brief Names the opcode implementing an instruction
+//!
+//! Uses the same decode table as OpcodeDecode(), building it if necessary, so
+//! this does not need an opcode object.
+//!
+//! \param[in] instruction Two-byte instruction, as returned by OpcodeInstruction()
+//! \return The opcode's name, eg. "8XY4", or NULL if the instruction is unknown
+const char *
+OpcodeName(unsigned short instruction);
+
 //! \brief Returns the two-byte instruction to be executed
 //!
 //! Each instruction is a two-byte value representing an opcode, of which there
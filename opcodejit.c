@@ -0,0 +1,643 @@
+/******************************************************************************
+  File: opcodejit.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+
+//! \file opcodejit.c
+//!
+//! x86-64 block JIT engine, included by opcode.c.
+//!
+//! CHIP-8 code is translated one block at a time into native code in an
+//! executable code cache. A block ends at flow control (00EE, 1NNN, 2NNN,
+//! BNNN), at DXYN or FX0A, and at FX33 or FX55, since those may overwrite
+//! code. Instructions that may skip the next one (3XNN, 4XNN, 5XY0, 9XY0,
+//! EX9E, EXA1) branch over the next instruction's code within the block, so
+//! the common "skip; jump" loop is one block rather than two. When the skipped
+//! instruction is itself a terminator, the block exits there unless the skip
+//! is taken, and translation carries on after it.
+//!
+//! Translated blocks take the opcode and system state and the number of
+//! instructions they may execute as arguments. They only update the pc on
+//! exit, and return how many of those instructions are left over, with
+//! JIT_STOP set if OpcodeRun() must return (FX0A). They also leave the last
+//! instruction executed in the opcode state.
+//!
+//! Simple register and index operations, skips, calls and returns are emitted
+//! inline. Everything else calls the same opcode functions the interpreters
+//! use, which in turn call into system.c (SystemDrawSprite() and friends).
+//! The remaining block terminators go through OpcodeExecute() itself.
+//!
+//! Each instruction after the first checks that some of the count remains, so
+//! a block can stop part way through rather than falling back to an
+//! interpreter whenever it doesn't fit within a small OpcodeRun().
+//!
+//! Quirks of the selected profile are built into inline code as it is
+//! translated; OpcodeSetProfile() discards every block.
+//!
+//! Blocks are invalidated through OpcodeInvalidate() just like the predecoded
+//! instruction cache. When the code cache fills up it is simply emptied.
+//!
+//! On other architectures the JIT engine falls back to the threaded engine.
+
+//! Maximum number of CHIP-8 instructions in a single translated block
+#define JIT_MAX_BLOCK_LENGTH 64
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <stddef.h> // offsetof
+#include <sys/mman.h> // mmap, mprotect, munmap
+
+//! Size of the executable code cache
+#define JIT_CACHE_SIZE (1024 * 1024)
+
+//! Upper bound on the native code emitted for a single block
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK_LENGTH * 192 + 128)
+
+//! Set in a block's return value if OpcodeRun() must return after it
+#define JIT_STOP 0x80000000u
+
+//! \brief Translated block entry point
+//! \return Instructions left of count, possibly with JIT_STOP set
+typedef unsigned int (*jit_fn)(struct opcode *c, struct system *s, unsigned int count);
+
+//! \brief A translated block. Unexported.
+struct jit_block {
+        jit_fn fn; //!< Native code for the block, or NULL if not translated
+        unsigned short length; //!< Number of CHIP-8 instructions translated
+};
+
+//! \brief JIT compiler state. Unexported.
+struct jit {
+        unsigned char *cache; //!< Executable code cache
+        size_t used; //!< Bytes of the code cache in use
+        struct jit_block blocks[MEMORY_SIZE]; //!< Translated blocks indexed by starting address
+
+        //! Non-zero for each address translated into some block since the
+        //! code cache was last emptied. Most writes are to data, and can skip
+        //! looking for blocks to invalidate.
+        unsigned char translated[MEMORY_SIZE];
+};
+
+//! \brief Executes a single decoded instruction via OpcodeExecute()
+//!
+//! Called from translated code to handle block terminators.
+//!
+//! \param[in,out] c Opcode state to be updated
+//! \param[in,out] s CHIP-8 system state, with pc pointing at the instruction
+//! \param[in] d The decoded instruction to be executed
+static void JitExecute(struct opcode *c, struct system *s, const struct opcode_decoded *d) {
+        c->decoded = d;
+        c->fn = d->fn;
+        c->instruction = (unsigned short)(d - DECODE_TABLE);
+        OpcodeExecute(c, s);
+}
+
+//! \brief Creates JIT state with an empty code cache
+//! \return The initialized JIT state, or NULL if no executable memory is available
+static struct jit *JitInit() {
+        struct jit *j = (struct jit *)malloc(sizeof(struct jit));
+        if (j == NULL) {
+                return NULL;
+        }
+        memset(j, 0, sizeof(struct jit));
+
+        j->cache = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (j->cache == MAP_FAILED) {
+                fprintf(stderr, "Couldn't map JIT code cache\n");
+                free(j);
+                return NULL;
+        }
+
+        return j;
+}
+
+//! \brief Releases the code cache and frees the JIT state
+//! \param[in,out] j JIT state to be reclaimed
+static void JitDeinit(struct jit *j) {
+        if (j == NULL) {
+                return;
+        }
+
+        munmap(j->cache, JIT_CACHE_SIZE);
+        free(j);
+}
+
+//! \brief Discards translated blocks overlapping a range of CHIP-8 memory
+//! \param[in,out] j JIT state to be updated
+//! \param[in] address First address that was written
+//! \param[in] length Number of bytes written
+static void JitInvalidate(struct jit *j, unsigned int address, unsigned int length) {
+        if (j == NULL) {
+                return;
+        }
+
+        unsigned int end = address + length;
+        unsigned int a = address;
+        while (a < end && a < MEMORY_SIZE && !j->translated[a]) {
+                a++;
+        }
+        if (a == end || a == MEMORY_SIZE) {
+                return; // Only data was written.
+        }
+
+        unsigned int span = JIT_MAX_BLOCK_LENGTH * 2;
+        unsigned int start = (address >= span) ? address - span : 0;
+
+        for (a = start; a < end && a < MEMORY_SIZE; a++) {
+                struct jit_block *b = &j->blocks[a];
+                if (b->fn != NULL && a + b->length * 2 > address) {
+                        b->fn = NULL;
+                }
+        }
+}
+
+//------------------------------------------------------------------------------
+// x86-64 code emission
+//
+// Translated code keeps the system state in rbx and the opcode state in r12.
+// CHIP-8 registers are addressed as [rbx + disp32]. r13d holds the number of
+// instructions the block may still execute.
+//------------------------------------------------------------------------------
+
+//! \brief Native code being emitted. Unexported.
+struct jit_emitter {
+        unsigned char *p; //!< Next byte to be written
+};
+
+static void Emit8(struct jit_emitter *e, unsigned char byte) {
+        *e->p++ = byte;
+}
+
+static void Emit16(struct jit_emitter *e, unsigned short value) {
+        memcpy(e->p, &value, sizeof(value));
+        e->p += sizeof(value);
+}
+
+static void Emit32(struct jit_emitter *e, unsigned int value) {
+        memcpy(e->p, &value, sizeof(value));
+        e->p += sizeof(value);
+}
+
+static void Emit64(struct jit_emitter *e, const void *pointer) {
+        memcpy(e->p, &pointer, sizeof(pointer));
+        e->p += sizeof(pointer);
+}
+
+//! \brief Points a rel32 operand emitted earlier at the next byte to be written
+static void EmitPatch(struct jit_emitter *e, unsigned char *rel32) {
+        unsigned int rel = (unsigned int)(e->p - (rel32 + 4));
+        memcpy(rel32, &rel, sizeof(rel));
+}
+
+//! \brief Emits an instruction with a [rbx + disp32] memory operand
+//! \param[in,out] e Emitter to write to
+//! \param[in] opcode The x86 opcode byte(s) preceding the ModRM byte
+//! \param[in] length Number of opcode bytes
+//! \param[in] reg The ModRM reg field: a register or an opcode extension
+//! \param[in] disp Offset from the start of struct system
+static void EmitRbx(struct jit_emitter *e, const unsigned char *opcode, int length, int reg, size_t disp) {
+        for (int i = 0; i < length; i++) {
+                Emit8(e, opcode[i]);
+        }
+        Emit8(e, 0x80 | (reg << 3) | 0x3); // mod=10 (disp32), rm=rbx
+        Emit32(e, (unsigned int)disp);
+}
+
+#define V_OFFSET(x) (offsetof(struct system, v) + (x))
+#define I_OFFSET offsetof(struct system, i)
+#define PC_OFFSET offsetof(struct system, pc)
+
+//! mov byte [rbx + disp], imm8
+static void EmitStoreByte(struct jit_emitter *e, size_t disp, unsigned char value) {
+        EmitRbx(e, (unsigned char[]){ 0xC6 }, 1, 0, disp);
+        Emit8(e, value);
+}
+
+//! mov word [rbx + disp], imm16
+static void EmitStoreWord(struct jit_emitter *e, size_t disp, unsigned short value) {
+        EmitRbx(e, (unsigned char[]){ 0x66, 0xC7 }, 2, 0, disp);
+        Emit16(e, value);
+}
+
+//! add byte [rbx + disp], imm8
+static void EmitAddByte(struct jit_emitter *e, size_t disp, unsigned char value) {
+        EmitRbx(e, (unsigned char[]){ 0x80 }, 1, 0, disp);
+        Emit8(e, value);
+}
+
+//! cmp byte [rbx + disp], imm8
+static void EmitCompareByte(struct jit_emitter *e, size_t disp, unsigned char value) {
+        EmitRbx(e, (unsigned char[]){ 0x80 }, 1, 7, disp);
+        Emit8(e, value);
+}
+
+//! mov al, byte [rbx + disp]
+static void EmitLoadAl(struct jit_emitter *e, size_t disp) {
+        EmitRbx(e, (unsigned char[]){ 0x8A }, 1, 0, disp);
+}
+
+//! mov rax, imm64; call rax
+static void EmitCallAddress(struct jit_emitter *e, const void *address) {
+        Emit8(e, 0x48); Emit8(e, 0xB8); Emit64(e, address); // mov rax, imm64
+        Emit8(e, 0xFF); Emit8(e, 0xD0); // call rax
+}
+
+//! \brief Emits a call to an opcode function: fn(r12, rbx, d)
+static void EmitCall(struct jit_emitter *e, opcode_fn fn, const struct opcode_decoded *d) {
+        Emit8(e, 0x4C); Emit8(e, 0x89); Emit8(e, 0xE7); // mov rdi, r12
+        Emit8(e, 0x48); Emit8(e, 0x89); Emit8(e, 0xDE); // mov rsi, rbx
+        Emit8(e, 0x48); Emit8(e, 0xBA); Emit64(e, d); // mov rdx, imm64
+        EmitCallAddress(e, *(void **)&fn);
+}
+
+//! \brief Emits a call to a system function: fn(rbx)
+static void EmitSystemCall(struct jit_emitter *e, void (*fn)(struct system *)) {
+        Emit8(e, 0x48); Emit8(e, 0x89); Emit8(e, 0xDF); // mov rdi, rbx
+        EmitCallAddress(e, *(void **)&fn);
+}
+
+//! \brief Emits a return from the block
+//!
+//! \param[in,out] e Emitter to write to
+//! \param[in] d The instruction executed last, recorded in the opcode state
+//! \param[in] stop Whether OpcodeRun() must return after the block
+static void EmitExit(struct jit_emitter *e, const struct opcode_decoded *d, int stop) {
+        Emit8(e, 0x48); Emit8(e, 0xB8); Emit64(e, d); // mov rax, imm64
+        Emit8(e, 0x49); Emit8(e, 0x89); Emit8(e, 0x84); Emit8(e, 0x24); // mov [r12 + disp32], rax
+        Emit32(e, (unsigned int)offsetof(struct opcode, decoded));
+        Emit8(e, 0x44); Emit8(e, 0x89); Emit8(e, 0xE8); // mov eax, r13d
+        if (stop) {
+                Emit8(e, 0x0D); Emit32(e, JIT_STOP); // or eax, imm32
+        }
+        Emit8(e, 0x41); Emit8(e, 0x5D); // pop r13
+        Emit8(e, 0x41); Emit8(e, 0x5C); // pop r12
+        Emit8(e, 0x5B); // pop rbx
+        Emit8(e, 0xC3); // ret
+}
+
+//! \brief Emits a jump to be patched with EmitPatch()
+//! \param[in,out] e Emitter to write to
+//! \param[in] condition The second byte of a two-byte jcc, or zero for jmp
+//! \return The jump's rel32 operand
+static unsigned char *EmitJump(struct jit_emitter *e, unsigned char condition) {
+        if (condition) {
+                Emit8(e, 0x0F); Emit8(e, condition); // jcc rel32
+        } else {
+                Emit8(e, 0xE9); // jmp rel32
+        }
+        unsigned char *rel32 = e->p;
+        Emit32(e, 0);
+        return rel32;
+}
+
+//! \brief Emits pc = next + 2 if the preceding compare set ZF == skipIfZero,
+//! otherwise pc = next
+static void EmitSkip(struct jit_emitter *e, unsigned short next, int skipIfZero) {
+        EmitStoreWord(e, PC_OFFSET, next);
+        Emit8(e, skipIfZero ? 0x75 : 0x74); // jne or je, rel8
+        unsigned char *rel = e->p;
+        Emit8(e, 0);
+        EmitStoreWord(e, PC_OFFSET, next + 2);
+        *rel = (unsigned char)(e->p - rel - 1);
+}
+
+//! \brief A block exit for running out of count, emitted after the rest of
+//! the block. Unexported.
+struct jit_stub {
+        unsigned char *jump; //!< rel32 operand of the jump to the exit
+        unsigned short pc; //!< Address of the next instruction
+        const struct opcode_decoded *last; //!< The instruction executed last
+};
+
+//! \brief Emits a jump over the next instruction's code if the preceding
+//! compare set ZF == skipIfZero
+//!
+//! \param[in,out] e Emitter to write to
+//! \param[in] skipIfZero Whether to skip if ZF is set rather than clear
+//! \param[out] stub Exit for running out of count after skipping
+//! \return The jump's rel32 operand, to be patched with EmitPatch()
+static unsigned char *EmitSkipOver(struct jit_emitter *e, int skipIfZero, struct jit_stub *stub) {
+        Emit8(e, skipIfZero ? 0x75 : 0x74); Emit8(e, 14); // jne or je, rel8
+        Emit8(e, 0x45); Emit8(e, 0x85); Emit8(e, 0xED); // test r13d, r13d
+        stub->jump = EmitJump(e, 0x84); // jz rel32
+        return EmitJump(e, 0); // jmp rel32
+}
+
+//! \brief Checks whether the instruction at an address can be translated
+static int JitTranslatable(struct system *s, unsigned int address) {
+        return address + 1 < MEMORY_SIZE && DECODE_TABLE[s->memory[address] << 8 | s->memory[address + 1]].id != OPCODE_FN_COUNT;
+}
+
+//! \brief Translates the block starting at address
+//!
+//! \param[in,out] j JIT state to be updated
+//! \param[in] q Quirks to build into inline code
+//! \param[in] s CHIP-8 system state whose memory is read
+//! \param[in] address Address of the first instruction in the block
+//! \return The translated block, or NULL if the first instruction is unknown
+static struct jit_block *JitTranslate(struct jit *j, const struct opcode_quirks *q, struct system *s, unsigned int address) {
+        if (!JitTranslatable(s, address)) {
+                return NULL;
+        }
+
+        if (JIT_CACHE_SIZE - j->used < JIT_MAX_BLOCK_BYTES) {
+                // Out of space; drop everything and start over.
+                memset(j->blocks, 0, sizeof(j->blocks));
+                memset(j->translated, 0, sizeof(j->translated));
+                j->used = 0;
+        }
+
+        if (0 != mprotect(j->cache, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE)) {
+                return NULL;
+        }
+
+        unsigned char *start = j->cache + j->used;
+        struct jit_emitter emitter = { .p = start };
+        struct jit_emitter *e = &emitter;
+
+        // Prologue: save callee-saved registers, which also leaves the stack
+        // 16-byte aligned.
+        Emit8(e, 0x53); // push rbx
+        Emit8(e, 0x41); Emit8(e, 0x54); // push r12
+        Emit8(e, 0x41); Emit8(e, 0x55); // push r13
+        Emit8(e, 0x48); Emit8(e, 0x89); Emit8(e, 0xF3); // mov rbx, rsi
+        Emit8(e, 0x49); Emit8(e, 0x89); Emit8(e, 0xFC); // mov r12, rdi
+        Emit8(e, 0x41); Emit8(e, 0x89); Emit8(e, 0xD5); // mov r13d, edx
+
+        const struct opcode_decoded *d = NULL;
+        unsigned int pc = address;
+        int length = 0;
+        int terminated = 0;
+        int exits = 0;
+
+        // Exits for running out of count, at most two per instruction.
+        struct jit_stub stubs[JIT_MAX_BLOCK_LENGTH * 2];
+        int stubCount = 0;
+
+        // A skip's taken path jumps over the next instruction. over is that
+        // jump while the next instruction is being translated; landing is
+        // the jump once it has been, along with the skip itself.
+        unsigned char *over = NULL;
+        unsigned char *landing = NULL;
+        const struct opcode_decoded *skip = NULL;
+        const struct opcode_decoded *landingSkip = NULL;
+
+        while (!terminated && length < JIT_MAX_BLOCK_LENGTH && JitTranslatable(s, pc)) {
+                if (landing != NULL) {
+                        EmitPatch(e, landing);
+                        landing = NULL;
+                }
+
+                unsigned char *skipped = over;
+                const struct opcode_decoded *skippedBy = skip;
+                over = NULL;
+
+                // The first instruction always runs; OpcodeRun() has a
+                // non-zero count.
+                Emit8(e, 0x41); Emit8(e, 0xFF); Emit8(e, 0xCD); // dec r13d
+                if (length > 0) {
+                        stubs[stubCount++] = (struct jit_stub){ EmitJump(e, 0x88), pc, d }; // js rel32
+                }
+
+                d = &DECODE_TABLE[s->memory[pc] << 8 | s->memory[pc + 1]];
+                length++;
+                pc += 2;
+                exits = 0;
+
+                // Skips only branch within the block if the next instruction
+                // is translated too.
+                int inlineSkip = (length < JIT_MAX_BLOCK_LENGTH && JitTranslatable(s, pc));
+                int skipIfZero = 0;
+
+                switch (d->id) {
+                        case OPCODE_FN_0NNN: // Not implemented.
+                                break;
+
+                        case OPCODE_FN_00EE:
+                                EmitStoreWord(e, PC_OFFSET, pc - 2);
+                                EmitSystemCall(e, SystemStackPop);
+                                EmitRbx(e, (unsigned char[]){ 0x66, 0x83 }, 2, 0, PC_OFFSET); // add word [pc], imm8
+                                Emit8(e, 2);
+                                exits = 1;
+                                break;
+
+                        case OPCODE_FN_1NNN:
+                                EmitStoreWord(e, PC_OFFSET, d->nnn ? d->nnn : pc);
+                                exits = 1;
+                                break;
+
+                        case OPCODE_FN_2NNN:
+                                EmitStoreWord(e, PC_OFFSET, pc - 2);
+                                EmitSystemCall(e, SystemStackPush);
+                                EmitStoreWord(e, PC_OFFSET, d->nnn ? d->nnn : pc);
+                                exits = 1;
+                                break;
+
+                        case OPCODE_FN_3XNN:
+                        case OPCODE_FN_4XNN:
+                                EmitCompareByte(e, V_OFFSET(d->x), d->nn);
+                                skipIfZero = (d->id == OPCODE_FN_3XNN);
+                                break;
+
+                        case OPCODE_FN_5XY0:
+                        case OPCODE_FN_9XY0:
+                                EmitLoadAl(e, V_OFFSET(d->x));
+                                EmitRbx(e, (unsigned char[]){ 0x3A }, 1, 0, V_OFFSET(d->y)); // cmp al, [vy]
+                                skipIfZero = (d->id == OPCODE_FN_5XY0);
+                                break;
+
+                        case OPCODE_FN_6XNN:
+                                EmitStoreByte(e, V_OFFSET(d->x), d->nn);
+                                break;
+
+                        case OPCODE_FN_7XNN:
+                                EmitAddByte(e, V_OFFSET(d->x), d->nn);
+                                break;
+
+                        case OPCODE_FN_8XY0:
+                        case OPCODE_FN_8XY1:
+                        case OPCODE_FN_8XY2:
+                        case OPCODE_FN_8XY3: {
+                                static const unsigned char ops[OPCODE_FN_COUNT] = {
+                                        [OPCODE_FN_8XY0] = 0x88, // mov
+                                        [OPCODE_FN_8XY1] = 0x08, // or
+                                        [OPCODE_FN_8XY2] = 0x20, // and
+                                        [OPCODE_FN_8XY3] = 0x30, // xor
+                                };
+                                EmitLoadAl(e, V_OFFSET(d->y));
+                                EmitRbx(e, &ops[d->id], 1, 0, V_OFFSET(d->x)); // op [vx], al
+                                if (q->resetVf && d->id != OPCODE_FN_8XY0) {
+                                        EmitStoreByte(e, V_OFFSET(15), 0);
+                                }
+                        } break;
+
+                        case OPCODE_FN_ANNN:
+                                EmitStoreWord(e, I_OFFSET, d->nnn);
+                                break;
+
+                        case OPCODE_FN_EX9E:
+                        case OPCODE_FN_EXA1: {
+                                int (*pressed)(struct system *, int) = SystemKeyIsPressed;
+                                Emit8(e, 0x48); Emit8(e, 0x89); Emit8(e, 0xDF); // mov rdi, rbx
+                                EmitRbx(e, (unsigned char[]){ 0x0F, 0xB6 }, 2, 6, V_OFFSET(d->x)); // movzx esi, [vx]
+                                EmitCallAddress(e, *(void **)&pressed);
+                                Emit8(e, 0x85); Emit8(e, 0xC0); // test eax, eax
+                                skipIfZero = (d->id == OPCODE_FN_EXA1);
+                        } break;
+
+                        case OPCODE_FN_FX1E:
+                                EmitRbx(e, (unsigned char[]){ 0x0F, 0xB6 }, 2, 0, V_OFFSET(d->x)); // movzx eax, [vx]
+                                EmitRbx(e, (unsigned char[]){ 0x66, 0x01 }, 2, 0, I_OFFSET); // add [i], ax
+                                break;
+
+                        case OPCODE_FN_BNNN:
+                        case OPCODE_FN_DXYN:
+                        case OPCODE_FN_FX0A:
+                        case OPCODE_FN_FX33:
+                        case OPCODE_FN_FX55:
+                                EmitStoreWord(e, PC_OFFSET, pc - 2);
+                                EmitCall(e, JitExecute, d);
+                                exits = 1;
+                                break;
+
+                        default:
+                                EmitCall(e, d->fn, d);
+                                break;
+                }
+
+                switch (d->id) {
+                        case OPCODE_FN_3XNN:
+                        case OPCODE_FN_4XNN:
+                        case OPCODE_FN_5XY0:
+                        case OPCODE_FN_9XY0:
+                        case OPCODE_FN_EX9E:
+                        case OPCODE_FN_EXA1:
+                                if (inlineSkip) {
+                                        struct jit_stub *stub = &stubs[stubCount++];
+                                        over = EmitSkipOver(e, skipIfZero, stub);
+                                        stub->pc = pc + 2;
+                                        stub->last = d;
+                                        skip = d;
+                                } else {
+                                        EmitSkip(e, pc, skipIfZero);
+                                        exits = 1;
+                                }
+                                break;
+
+                        default:
+                                break;
+                }
+
+                if (exits) {
+                        EmitExit(e, d, d->id == OPCODE_FN_FX0A);
+                        // Nothing falls through, so the block ends here unless
+                        // this instruction could have been skipped.
+                        terminated = (skipped == NULL);
+                }
+
+                landing = skipped;
+                landingSkip = skippedBy;
+        }
+
+        if (!exits) {
+                EmitStoreWord(e, PC_OFFSET, pc);
+                EmitExit(e, d, 0);
+        }
+
+        if (landing != NULL) {
+                // The skip before the final instruction was taken.
+                EmitPatch(e, landing);
+                EmitStoreWord(e, PC_OFFSET, pc);
+                EmitExit(e, landingSkip, 0);
+        }
+
+        for (int i = 0; i < stubCount; i++) {
+                EmitPatch(e, stubs[i].jump);
+                EmitStoreWord(e, PC_OFFSET, stubs[i].pc);
+                Emit8(e, 0x45); Emit8(e, 0x31); Emit8(e, 0xED); // xor r13d, r13d
+                EmitExit(e, stubs[i].last, 0);
+        }
+
+        mprotect(j->cache, JIT_CACHE_SIZE, PROT_READ | PROT_EXEC);
+        __builtin___clear_cache((char *)start, (char *)e->p);
+
+        j->used += e->p - start;
+
+        struct jit_block *b = &j->blocks[address];
+        *(void **)&b->fn = start;
+        b->length = length;
+        memset(&j->translated[address], 1, pc - address);
+
+        return b;
+}
+
+//! \brief Executes up to count instructions using translated native code
+//! \see OpcodeRun()
+static unsigned int RunJit(struct opcode *c, struct system *s, unsigned int count) {
+        if (c->jit == NULL) {
+                c->jit = JitInit();
+                if (c->jit == NULL) {
+                        return RunThreaded(c, s, count);
+                }
+        }
+
+        struct jit *j = c->jit;
+        unsigned int executed = 0;
+        unsigned int result = 0;
+
+        while (executed < count) {
+                unsigned int address = s->pc;
+                if (address >= MEMORY_SIZE) {
+                        break;
+                }
+
+                struct jit_block *b = &j->blocks[address];
+                if (b->fn == NULL && NULL == JitTranslate(j, c->quirks, s, address)) {
+                        break;
+                }
+
+                unsigned int remaining = count - executed;
+                result = b->fn(c, s, remaining);
+                executed += remaining - (result & ~JIT_STOP);
+
+                if (result & JIT_STOP) {
+                        break;
+                }
+        }
+
+        if (executed > 0) {
+                c->fn = c->decoded->fn;
+                c->instruction = (unsigned short)(c->decoded - DECODE_TABLE);
+        }
+
+        if (executed < count && !(result & JIT_STOP)) {
+                executed += RunThreaded(c, s, count - executed);
+        }
+
+        return executed;
+}
+
+#undef V_OFFSET
+#undef I_OFFSET
+#undef PC_OFFSET
+
+#else // x86-64 Linux
+
+struct jit;
+
+static void JitDeinit(struct jit *j) {
+}
+
+static void JitInvalidate(struct jit *j, unsigned int address, unsigned int length) {
+}
+
+//! \brief No JIT for this platform; falls back to the threaded engine
+//! \see OpcodeRun()
+static unsigned int RunJit(struct opcode *c, struct system *s, unsigned int count) {
+        return RunThreaded(c, s, count);
+}
+
+#endif // x86-64 Linux
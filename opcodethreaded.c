@@ -0,0 +1,135 @@
+/******************************************************************************
+  File: opcodethreaded.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+
+//! \file opcodethreaded.c
+//!
+//! Direct-threaded interpreter engine, included by opcode.c.
+//!
+//! The reference engine makes three out-of-line calls per instruction, calls
+//! the opcode function indirectly and then applies the jump and skip flags it
+//! left behind. This engine is a single function instead: every opcode is a
+//! label, each handler updates the pc itself and then jumps straight to the
+//! next instruction's handler via a computed goto (GCC's labels as values).
+//!
+//! Results must match the reference engine exactly, so anything that isn't
+//! flow control simply calls the same opcode function.
+//!
+//! The engine itself lives in opcodethreadedrun.c, which is compiled once per
+//! enum opcode_profile so that quirks never cost a branch at run time.
+//!
+//! Common instruction sequences (see enum opcode_fusion) are recognized the
+//! first time their leading instruction is dispatched and from then on run as
+//! a single fused handler, provided the whole sequence fits in the remaining
+//! instruction budget.
+
+//! \brief Fused sequence starting at an address. Unexported.
+//!
+//! Recognized sequences are in the same order as enum opcode_fusion.
+enum fused {
+        FUSED_UNKNOWN, //!< Not looked at since the address was last invalidated
+        FUSED_NONE, //!< No recognized sequence starts here
+        FUSED_SPRITE, //!< OPCODE_FUSION_SPRITE
+        FUSED_DELAY_WAIT, //!< OPCODE_FUSION_DELAY_WAIT
+        FUSED_COUNTED_LOOP, //!< OPCODE_FUSION_COUNTED_LOOP
+};
+
+//! Bytes spanned by the longest fused sequence
+#define FUSED_MAX_SPAN 8
+
+//! \brief Forgets fused sequences overlapping a range of written memory
+//! \see OpcodeInvalidate()
+static void FusedInvalidate(struct opcode *c, unsigned int address, unsigned int length) {
+        unsigned int start = (address >= FUSED_MAX_SPAN - 1) ? address - (FUSED_MAX_SPAN - 1) : 0;
+        unsigned int end = address + length;
+
+        for (unsigned int a = start; a < end && a < MEMORY_SIZE; a++) {
+                c->fused[a] = FUSED_UNKNOWN;
+        }
+}
+
+#ifdef __GNUC__
+
+//! \brief Recognizes the fused sequence starting at pc, if any
+//!
+//! Predecodes every instruction in the sequence, so fused handlers can read
+//! them straight from the instruction cache.
+//!
+//! \param[in,out] c Opcode state whose instruction cache is to be used
+//! \param[in] s CHIP-8 system state to be read; pc + FUSED_MAX_SPAN must be
+//! within memory
+//! \return The enum fused value for pc, other than FUSED_UNKNOWN
+static unsigned char Fuse(struct opcode *c, struct system *s) {
+        opcode_fn fn[FUSED_MAX_SPAN / 2];
+        for (int i = 0; i < FUSED_MAX_SPAN / 2; i++) {
+                fn[i] = PredecodedAt(c, s, s->pc + i * 2)->fn;
+        }
+
+        if (fn[0] == Fn6XNN && fn[1] == Fn6XNN && fn[2] == FnANNN && fn[3] == FnDXYN) {
+                return FUSED_SPRITE;
+        }
+
+        if (fn[0] == FnFX07 && fn[1] == Fn3XNN && fn[2] == Fn1NNN) {
+                return FUSED_DELAY_WAIT;
+        }
+
+        if (fn[0] == Fn7XNN && fn[1] == Fn3XNN && fn[2] == Fn1NNN) {
+                return FUSED_COUNTED_LOOP;
+        }
+
+        return FUSED_NONE;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // Labels as values are a GNU extension.
+
+#define RUN_THREADED RunThreadedDefault
+#define QUIRKS (&OPCODE_QUIRKS[OPCODE_PROFILE_DEFAULT])
+#include "opcodethreadedrun.c"
+
+#define RUN_THREADED RunThreadedCosmacVip
+#define QUIRKS (&OPCODE_QUIRKS[OPCODE_PROFILE_COSMAC_VIP])
+#include "opcodethreadedrun.c"
+
+#define RUN_THREADED RunThreadedSchip
+#define QUIRKS (&OPCODE_QUIRKS[OPCODE_PROFILE_SCHIP])
+#include "opcodethreadedrun.c"
+
+#define RUN_THREADED RunThreadedXoChip
+#define QUIRKS (&OPCODE_QUIRKS[OPCODE_PROFILE_XO_CHIP])
+#include "opcodethreadedrun.c"
+
+#pragma GCC diagnostic pop
+
+//! \brief Executes up to count instructions with the engine for c's profile
+//! \see OpcodeRun()
+static unsigned int RunThreaded(struct opcode *c, struct system *s, unsigned int count) {
+        switch (c->profile) {
+                case OPCODE_PROFILE_COSMAC_VIP:
+                        return RunThreadedCosmacVip(c, s, count);
+
+                case OPCODE_PROFILE_SCHIP:
+                        return RunThreadedSchip(c, s, count);
+
+                case OPCODE_PROFILE_XO_CHIP:
+                        return RunThreadedXoChip(c, s, count);
+
+                case OPCODE_PROFILE_DEFAULT:
+                default:
+                        return RunThreadedDefault(c, s, count);
+        }
+}
+
+#else // __GNUC__
+
+//! \brief Computed goto is unavailable; falls back to the reference engine
+//! \see OpcodeRun()
+static unsigned int RunThreaded(struct opcode *c, struct system *s, unsigned int count) {
+        return RunReference(c, s, count);
+}
+
+#endif // __GNUC__
@@ -0,0 +1,211 @@
+/******************************************************************************
+  File: opcodethreadedrun.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+
+//! \file opcodethreadedrun.c
+//!
+//! Body of the threaded engine, included by opcodethreaded.c once per
+//! enum opcode_profile.
+//!
+//! Before each inclusion RUN_THREADED must name the function to define and
+//! QUIRKS must point at a constant OPCODE_QUIRKS entry. Quirk-dependent opcodes
+//! call the same Exec functions as the reference engine, which the compiler
+//! inlines and specializes for those constant quirks.
+
+//! \brief Executes up to count instructions using computed-goto dispatch
+//!
+//! QUIRKS is an OPCODE_QUIRKS entry, so each quirk is a constant here.
+//!
+//! \see OpcodeRun()
+static unsigned int RUN_THREADED(struct opcode *c, struct system *s, unsigned int count) {
+        // Indexed by enum opcode_fn_id.
+        static void *const handlers[] = {
+                [OPCODE_FN_0NNN] = &&Op0NNN,
+                [OPCODE_FN_00E0] = &&Op00E0,
+                [OPCODE_FN_00EE] = &&Op00EE,
+                [OPCODE_FN_1NNN] = &&Op1NNN,
+                [OPCODE_FN_2NNN] = &&Op2NNN,
+                [OPCODE_FN_3XNN] = &&Op3XNN,
+                [OPCODE_FN_4XNN] = &&Op4XNN,
+                [OPCODE_FN_5XY0] = &&Op5XY0,
+                [OPCODE_FN_6XNN] = &&Op6XNN,
+                [OPCODE_FN_7XNN] = &&Op7XNN,
+                [OPCODE_FN_8XY0] = &&Op8XY0,
+                [OPCODE_FN_8XY1] = &&Op8XY1,
+                [OPCODE_FN_8XY2] = &&Op8XY2,
+                [OPCODE_FN_8XY3] = &&Op8XY3,
+                [OPCODE_FN_8XY4] = &&Op8XY4,
+                [OPCODE_FN_8XY5] = &&Op8XY5,
+                [OPCODE_FN_8XY6] = &&Op8XY6,
+                [OPCODE_FN_8XY7] = &&Op8XY7,
+                [OPCODE_FN_8XYE] = &&Op8XYE,
+                [OPCODE_FN_9XY0] = &&Op9XY0,
+                [OPCODE_FN_ANNN] = &&OpANNN,
+                [OPCODE_FN_BNNN] = &&OpBNNN,
+                [OPCODE_FN_CXNN] = &&OpCXNN,
+                [OPCODE_FN_DXYN] = &&OpDXYN,
+                [OPCODE_FN_EX9E] = &&OpEX9E,
+                [OPCODE_FN_EXA1] = &&OpEXA1,
+                [OPCODE_FN_FX07] = &&OpFX07,
+                [OPCODE_FN_FX0A] = &&OpFX0A,
+                [OPCODE_FN_FX15] = &&OpFX15,
+                [OPCODE_FN_FX18] = &&OpFX18,
+                [OPCODE_FN_FX1E] = &&OpFX1E,
+                [OPCODE_FN_FX29] = &&OpFX29,
+                [OPCODE_FN_FX33] = &&OpFX33,
+                [OPCODE_FN_FX55] = &&OpFX55,
+                [OPCODE_FN_FX65] = &&OpFX65,
+                [OPCODE_FN_COUNT] = &&OpUnknown
+        };
+        _Static_assert(sizeof(handlers) / sizeof(handlers[0]) == OPCODE_FN_COUNT + 1, "handlers must cover enum opcode_fn_id");
+
+        // Indexed by enum fused.
+        static void *const fusedHandlers[] = {
+                NULL, NULL, &&FusedSprite, &&FusedDelayWait, &&FusedCountedLoop
+        };
+        static const unsigned char fusedLength[] = { 0, 0, 4, 3, 3 };
+
+        const struct opcode_decoded *d = c->decoded;
+        unsigned int executed = 0;
+
+// Fetches the instruction at pc and jumps to its handler, or stops once count
+// instructions have been executed.
+#define DISPATCH()                                      \
+        do {                                            \
+                if (executed == count) goto done;       \
+                d = Predecoded(c, s);                   \
+                executed++;                             \
+                goto *handlers[d->id];                  \
+        } while (0)
+
+// Like the reference engine, a jump to address zero is treated as no jump.
+#define JUMP(address) (s->pc = (address) ? (address) : s->pc + 2)
+#define SKIP_IF(condition) (s->pc += (condition) ? 4 : 2)
+#define CALL_AND_NEXT(fn) do { fn(c, s, d); s->pc += 2; DISPATCH(); } while (0)
+
+// Runs the fused sequence starting at pc instead, if there is one and it fits
+// within count. The sequence's first instruction has already been counted.
+#define FUSE()                                                                  \
+        do {                                                                    \
+                if (s->pc + FUSED_MAX_SPAN > MEMORY_SIZE) break;                \
+                unsigned char f = c->fused[s->pc];                              \
+                if (f == FUSED_UNKNOWN) f = c->fused[s->pc] = Fuse(c, s);       \
+                if (f != FUSED_NONE && count - executed + 1 >= fusedLength[f])  \
+                        goto *fusedHandlers[f];                                 \
+        } while (0)
+
+// Finishes a fused 3XNN, 1NNN tail at pc + 2, counting whichever of the two
+// instructions actually ran.
+#define SKIP_OR_JUMP(skip, jump)                                                \
+        do {                                                                    \
+                if (s->v[skip->x] == skip->nn) {                                \
+                        s->pc += 6; executed += 1; d = skip;                    \
+                } else {                                                        \
+                        s->pc += 4; JUMP(jump->nnn); executed += 2; d = jump;   \
+                }                                                               \
+        } while (0)
+
+        DISPATCH();
+
+Op0NNN: s->pc += 2; DISPATCH();
+Op00E0: CALL_AND_NEXT(Fn00E0);
+Op00EE: SystemStackPop(s); s->pc += 2; DISPATCH();
+Op1NNN: JUMP(d->nnn); DISPATCH();
+Op2NNN: SystemStackPush(s); JUMP(d->nnn); DISPATCH();
+Op3XNN: SKIP_IF(s->v[d->x] == d->nn); DISPATCH();
+Op4XNN: SKIP_IF(s->v[d->x] != d->nn); DISPATCH();
+Op5XY0: SKIP_IF(s->v[d->x] == s->v[d->y]); DISPATCH();
+Op6XNN: FUSE(); s->v[d->x] = d->nn; s->pc += 2; DISPATCH();
+Op7XNN: FUSE(); s->v[d->x] += d->nn; s->pc += 2; DISPATCH();
+Op8XY0: s->v[d->x] = s->v[d->y]; s->pc += 2; DISPATCH();
+Op8XY1: Exec8XY1(QUIRKS, s, d); s->pc += 2; DISPATCH();
+Op8XY2: Exec8XY2(QUIRKS, s, d); s->pc += 2; DISPATCH();
+Op8XY3: Exec8XY3(QUIRKS, s, d); s->pc += 2; DISPATCH();
+Op8XY4: Exec8XY4(QUIRKS, s, d); s->pc += 2; DISPATCH();
+Op8XY5: CALL_AND_NEXT(Fn8XY5);
+Op8XY6: Exec8XY6(QUIRKS, s, d); s->pc += 2; DISPATCH();
+Op8XY7: CALL_AND_NEXT(Fn8XY7);
+Op8XYE: Exec8XYE(QUIRKS, s, d); s->pc += 2; DISPATCH();
+Op9XY0: SKIP_IF(s->v[d->x] != s->v[d->y]); DISPATCH();
+OpANNN: s->i = d->nnn; s->pc += 2; DISPATCH();
+OpBNNN: { unsigned int address = ExecBNNN(QUIRKS, s, d); JUMP(address); } DISPATCH();
+OpCXNN: CALL_AND_NEXT(FnCXNN);
+OpDXYN: CALL_AND_NEXT(FnDXYN);
+OpEX9E: SKIP_IF(SystemKeyIsPressed(s, s->v[d->x])); DISPATCH();
+OpEXA1: SKIP_IF(!SystemKeyIsPressed(s, s->v[d->x])); DISPATCH();
+OpFX07: FUSE(); CALL_AND_NEXT(FnFX07);
+OpFX0A: FnFX0A(c, s, d); s->pc += 2; goto done; // Nothing more to do until a key is pressed.
+OpFX15: CALL_AND_NEXT(FnFX15);
+OpFX18: CALL_AND_NEXT(FnFX18);
+OpFX1E: s->i += s->v[d->x]; s->pc += 2; DISPATCH();
+OpFX29: CALL_AND_NEXT(FnFX29);
+OpFX33: CALL_AND_NEXT(FnFX33);
+OpFX55: ExecFX55(c, QUIRKS, s, d); s->pc += 2; DISPATCH();
+OpFX65: ExecFX65(QUIRKS, s, d); s->pc += 2; DISPATCH();
+
+FusedSprite: {
+        const struct opcode_decoded *y = c->icache[s->pc + 2];
+        const struct opcode_decoded *i = c->icache[s->pc + 4];
+        const struct opcode_decoded *draw = c->icache[s->pc + 6];
+
+        s->v[d->x] = d->nn;
+        s->v[y->x] = y->nn;
+        s->i = i->nnn;
+        FnDXYN(c, s, draw);
+        s->pc += 8;
+        executed += 3;
+        d = draw;
+
+        c->fusions[OPCODE_FUSION_SPRITE]++;
+        DISPATCH();
+}
+
+FusedDelayWait: {
+        const struct opcode_decoded *skip = c->icache[s->pc + 2];
+        const struct opcode_decoded *jump = c->icache[s->pc + 4];
+
+        FnFX07(c, s, d);
+        SKIP_OR_JUMP(skip, jump);
+
+        c->fusions[OPCODE_FUSION_DELAY_WAIT]++;
+        DISPATCH();
+}
+
+FusedCountedLoop: {
+        const struct opcode_decoded *skip = c->icache[s->pc + 2];
+        const struct opcode_decoded *jump = c->icache[s->pc + 4];
+
+        s->v[d->x] += d->nn;
+        SKIP_OR_JUMP(skip, jump);
+
+        c->fusions[OPCODE_FUSION_COUNTED_LOOP]++;
+        DISPATCH();
+}
+
+OpUnknown:
+        executed--;
+        printf("Unknown opcode: 0x%04X\n", (unsigned int)(d - DECODE_TABLE));
+
+done:
+        if (d != NULL) {
+                c->decoded = d;
+                c->fn = d->fn;
+                c->instruction = (unsigned short)(d - DECODE_TABLE);
+        }
+
+        return executed;
+
+#undef SKIP_OR_JUMP
+#undef FUSE
+#undef CALL_AND_NEXT
+#undef SKIP_IF
+#undef JUMP
+#undef DISPATCH
+}
+
+#undef QUIRKS
+#undef RUN_THREADED
@@ -0,0 +1,121 @@
+/******************************************************************************
+  File: pacer.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+#include <errno.h> // EINTR
+#include <stdlib.h> // malloc, free
+#include <string.h> // memset
+#include <time.h> // clock_gettime, clock_nanosleep
+
+#include "pacer.h"
+
+//! \file pacer.c
+
+#define NS_PER_S 1000000000ull
+#define NS_TO_MS(x) ((x) / 1000000.0) //!< Convert nanoseconds to milliseconds
+
+//! Pacer state
+struct pacer {
+        unsigned long long periodNs;
+        unsigned long long deadline; //!< End of the current period, CLOCK_MONOTONIC ns
+        unsigned int maxCatchUp;
+        struct pacer_stats stats;
+        unsigned long sleeps; //!< Waits that slept, for jitterMeanMs
+        unsigned long long jitterNs; //!< Total lateness of those
+};
+
+#ifdef PACER_CLOCK
+// Supplied by whoever defines PACER_CLOCK; test/pacer_test.c runs on a fake clock.
+static unsigned long long Now();
+static void SleepUntil(unsigned long long deadline);
+#else
+//! \brief Reads CLOCK_MONOTONIC
+//! \return nanoseconds
+static unsigned long long Now() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * NS_PER_S + now.tv_nsec;
+}
+
+//! \brief Sleeps until the given CLOCK_MONOTONIC time
+//! \param[in] deadline nanoseconds
+static void SleepUntil(unsigned long long deadline) {
+        struct timespec until = { .tv_sec = deadline / NS_PER_S, .tv_nsec = deadline % NS_PER_S };
+        while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL)) {
+                // Interrupted by a signal; the deadline hasn't moved.
+        }
+}
+#endif // PACER_CLOCK
+
+struct pacer *PacerInit(double hz, unsigned int maxCatchUp) {
+        struct pacer *pacer = (struct pacer *)malloc(sizeof(struct pacer));
+        if (NULL == pacer) {
+                return NULL;
+        }
+
+        memset(pacer, 0, sizeof(struct pacer));
+        pacer->maxCatchUp = maxCatchUp;
+        PacerSetHz(pacer, hz);
+        PacerReset(pacer);
+
+        return pacer;
+}
+
+void PacerDeinit(struct pacer *pacer) {
+        free(pacer);
+}
+
+void PacerSetHz(struct pacer *pacer, double hz) {
+        unsigned long long periodNs = NS_PER_S / hz;
+        if (periodNs == pacer->periodNs) {
+                return;
+        }
+
+        pacer->deadline += periodNs - pacer->periodNs;
+        pacer->periodNs = periodNs;
+}
+
+unsigned int PacerWait(struct pacer *pacer) {
+        unsigned long long now = Now();
+        pacer->stats.waits++;
+
+        if (now < pacer->deadline) {
+                SleepUntil(pacer->deadline);
+
+                unsigned long long late = Now() - pacer->deadline;
+                pacer->sleeps++;
+                pacer->jitterNs += late;
+                pacer->stats.jitterMeanMs = NS_TO_MS((double)pacer->jitterNs / pacer->sleeps);
+                if (NS_TO_MS(late) > pacer->stats.jitterMaxMs) {
+                        pacer->stats.jitterMaxMs = NS_TO_MS(late);
+                }
+
+                pacer->deadline += pacer->periodNs;
+                return 1;
+        }
+
+        // The work overran. Every deadline up to now is due.
+        pacer->stats.overruns++;
+        unsigned long long missed = (now - pacer->deadline) / pacer->periodNs;
+
+        if (missed > pacer->maxCatchUp) {
+                // Too far behind to catch up; start over from now.
+                pacer->stats.skipped += missed - pacer->maxCatchUp;
+                pacer->deadline = now + pacer->periodNs;
+                return 1 + pacer->maxCatchUp;
+        }
+
+        pacer->deadline += (missed + 1) * pacer->periodNs;
+        return 1 + missed;
+}
+
+void PacerReset(struct pacer *pacer) {
+        pacer->deadline = Now() + pacer->periodNs;
+}
+
+struct pacer_stats PacerStats(struct pacer *pacer) {
+        return pacer->stats;
+}
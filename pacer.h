@@ -0,0 +1,87 @@
+/******************************************************************************
+  File: pacer.h
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+#ifndef PACER_VERSION
+#define PACER_VERSION "0.1.0"
+
+//! \file pacer.h
+//!
+//! Runs a loop at a fixed rate.
+//!
+//! Each period ends at an absolute CLOCK_MONOTONIC deadline one period after
+//! the last, so time spent doing work or oversleeping doesn't accumulate as
+//! drift. A loop that falls behind catches up on a limited number of missed
+//! periods and skips the rest.
+//!
+//! Usage:
+//!
+//!     struct pacer *pacer = PacerInit(60, 0);
+//!     while (running) {
+//!             DoWork();
+//!             PacerWait(pacer);
+//!     }
+//!     PacerDeinit(pacer);
+
+//! Timing of a pacer's loop so far
+struct pacer_stats {
+        unsigned long waits; //!< Calls to PacerWait()
+        unsigned long overruns; //!< Calls to PacerWait() made after the deadline had passed
+        unsigned long skipped; //!< Periods dropped instead of caught up
+        double jitterMeanMs; //!< Average lateness waking up at a deadline
+        double jitterMaxMs; //!< Worst lateness waking up at a deadline
+};
+
+struct pacer;
+
+//! \brief Creates and initializes a new pacer object
+//!
+//! The first period begins now.
+//!
+//! \param[in] hz Periods per second
+//! \param[in] maxCatchUp Most missed periods PacerWait() reports at once
+//! \return The initialized pacer object
+struct pacer *
+PacerInit(double hz, unsigned int maxCatchUp);
+
+//! \brief De-initializes and frees memory for the given pacer object
+//! \param[in,out] pacer The initialized pacer object to be cleaned and reclaimed
+void
+PacerDeinit(struct pacer *pacer);
+
+//! \brief Changes the rate, starting with the current period
+//! \param[in,out] pacer pacer to update
+//! \param[in] hz Periods per second
+void
+PacerSetHz(struct pacer *pacer, double hz);
+
+//! \brief Waits for the end of the current period
+//!
+//! Sleeps until the deadline unless it has already passed. If it has, returns
+//! straight away with the number of periods that are due, so the caller can
+//! catch up on them; anything beyond maxCatchUp is skipped instead.
+//!
+//! \param[in,out] pacer pacer to wait on
+//! \return Periods to do the work of before calling again; 1 when keeping up
+unsigned int
+PacerWait(struct pacer *pacer);
+
+//! \brief Starts a new period now
+//!
+//! Call after the loop has been deliberately idle, so that PacerWait() doesn't
+//! treat the idle time as missed periods.
+//!
+//! \param[in,out] pacer pacer to update
+void
+PacerReset(struct pacer *pacer);
+
+//! \brief Returns timing of the pacer's loop so far
+//! \param[in] pacer pacer to query
+//! \return jitter and overrun statistics
+struct pacer_stats
+PacerStats(struct pacer *pacer);
+
+#endif // PACER_VERSION
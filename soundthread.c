@@ -1,7 +1,7 @@
 /******************************************************************************
   File: soundthread.c
   Created: 2019-07-25
-  Updated: 2019-07-31
+  Updated: 2026-10-17
   Author: Aaron Oman
   Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
  ******************************************************************************/
@@ -13,7 +13,12 @@
 //! Sound playback is triggered via the CHIP-8's sound timer.
 //! When the timer reaches zero, a sound is played back.
 //! The specifications seem loose on what this means exactly, so this emulator
-//! plays back a tone of 440hz for 200ms.
+//! plays back a tone of 440hz for SOUND_MS milliseconds.
+//!
+//! While fast-forwarding, most beeps are skipped; see TurboSkip().
+//!
+//! Between beeps the thread sleeps in SystemSoundWait(), which wakes it when
+//! sound is triggered, when the current tone should stop or on quit.
 //!
 //! \param[in] context struct thread_args casted to void*
 //! \return NULL
@@ -29,13 +34,18 @@ void *SoundThread(void *context) {
                 return NULL;
         }
 
-        struct timer *timer = TimerInit(200);
+        struct timer *timer = TimerInit(SOUND_MS);
         int playing = 0;
+        unsigned int turboBeeps = 0;
 
-        while (!ThreadSyncShouldShutdown(ctx->threadSync)) {
-                if (SystemSoundTriggered(ctx->sys)) {
-                        TimerReset(timer);
+        while (!ThreadSyncShouldShutdown(ctx->threadSync) && !SystemShouldQuit(ctx->sys)) {
+                if (SystemSoundWait(ctx->sys, playing ? TimerDeadline(timer) : NULL)) {
                         SystemSoundSetTrigger(ctx->sys, 0);
+                        if (TurboSkip(ctx, &turboBeeps)) {
+                                continue;
+                        }
+
+                        TimerReset(timer);
                         playing = 1;
                         SoundPlay(sound);
                 }
@@ -46,6 +56,7 @@ void *SoundThread(void *context) {
                 }
         }
 
+        free(timer);
         SoundDeinit(sound);
 
         return NULL;
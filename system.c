@@ -5,11 +5,15 @@
   Author: Aaron Oman
   Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
  ******************************************************************************/
+#include <errno.h> // ETIMEDOUT
 #include <string.h> // memset
-#include <stdlib.h> // malloc, free
+#include <stdlib.h> // aligned_alloc, free
 #include <stdio.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <time.h> // struct timespec
 
+#include "opcode.h"
 #include "system.h"
 
 #define GRAPHICS_WIDTH 64
@@ -21,42 +25,110 @@
 #define NUM_KEYS 16
 #define FONT_SIZE 80
 
-struct system_wfk { // wait for key
-        unsigned char reg; // 0 - 16
-        int waiting;
-        int justChanged;
-        pthread_rwlock_t lock;
+// I and pc are 16 bits wide and opcodes add small offsets to them, so
+// addresses well past MEMORY_SIZE can be formed. Those land in scratch space
+// belonging to the same instance.
+#define ADDRESSABLE_SIZE (0x10000 + 16)
+
+// Wait for key state is packed into a single atomic word so that it always
+// changes as a whole.
+#define WFK_REG 0x0F // Register to store the pressed key in
+#define WFK_WAITING 0x10 // Waiting for a keypress
+#define WFK_JUST_CHANGED 0x20 // A keypress ended the wait
+
+// The keypad is a single atomic word, so a key check is one load and the mask
+// and edge counts are always consistent with each other.
+#define KEYS_MASK 0xFFFFull // Bit N is set while key N is pressed
+#define KEYS_LAST_SHIFT 16 // Key most recently pressed, 4 bits
+#define KEYS_PRESSES_SHIFT 20 // Presses so far, 12 bits, wrapping
+#define KEYS_EDGES_SHIFT 32 // Presses and releases so far, 32 bits, wrapping
+
+// Lets a thread with nothing to do sleep until another thread has news for it.
+// Unexported.
+struct system_sleep {
+        pthread_mutex_t lock; // Held from a sleeper's last check until it waits
+        pthread_cond_t wake; // Broadcast by SleepWake(); uses CLOCK_MONOTONIC
+        atomic_int sleepers; // Threads holding or waiting on wake
 };
 
+// Timers are one word each: the value they were set to and the timer clock
+// reading when that happened. Their current value is worked out on read.
+#define TIMER_HZ 60
+#define TIMER_VALUE_SHIFT 56 // Value when set, 8 bits
+#define TIMER_SET_MASK ((1ull << TIMER_VALUE_SHIFT) - 1) // Timer clock when set, ns
+#define NS_PER_S 1000000000ull
+
+// The timer clock counts nanoseconds from SystemInit(), stopping while the
+// debugger is enabled. While running it holds the CLOCK_MONOTONIC time at
+// which it read zero. While stopped it holds its reading plus this bit.
+#define TIMER_CLOCK_STOPPED (1ull << 63)
+
+// A posted debugger command and its argument share one atomic word.
+#define DEBUG_COMMAND_MASK 0xF
+#define DEBUG_ARGUMENT_SHIFT 4
+
 struct system_debug {
-        int enabled;
-        int fetchAndDecode;
-        int execute;
-        pthread_rwlock_t lock;
+        atomic_int enabled;
+        atomic_uint command; // DEBUG_* fields
+        struct system_sleep sleep; // Woken on commands, on disabling and on quit
 };
 
+// Completed frames are handed to the graphics thread through a triple buffer.
+// The emulation thread fills the back buffer, the graphics thread reads the
+// front buffer and the third is swapped with either of them in one exchange.
+#define FRAME_INDEX 0x3 // Index of the buffer between back and front
+#define FRAME_FRESH 0x4 // That buffer holds a frame the reader hasn't seen
+
+// State shared with the UI and sound threads is lock-free. Scalars are
+// atomics and frames go through a triple buffer. Everything written by a
+// different thread gets its own cache line, so the emulation thread never
+// blocks and only misses in cache when something has actually changed.
 struct system_private {
-        struct system_wfk wfk;
-        struct system_debug debug;
+        // Owned by the emulation thread.
+        _Alignas(SYSTEM_CACHE_LINE) unsigned int frameBack; // Buffer to publish next
+        int gfxDirty; // gfx has changed since the last published frame
+        unsigned long long random; // xorshift64* state for CXNN; never 0
+
+        _Alignas(SYSTEM_CACHE_LINE) atomic_uint frameMiddle; // FRAME_* bits
+
+        // Owned by the graphics thread.
+        _Alignas(SYSTEM_CACHE_LINE) unsigned int frameFront; // Buffer being read
 
         // There are two timer registers that count at 60 Hz. When set above
-        // zero they will count down to zero.
-        unsigned char delayTimer;
-        unsigned char soundTimer;
+        // zero they will count down to zero. Nothing ticks them; see TimerRead().
+        _Alignas(SYSTEM_CACHE_LINE) _Atomic unsigned long long timerClock; // TIMER_CLOCK_* bits
+        _Atomic unsigned long long delayTimer; // TIMER_* fields
+        _Atomic unsigned long long soundTimer;
+
+        // In virtual time the timers tick after a fixed number of instructions
+        // instead of by the clock; see SystemVirtualTimeSet().
+        atomic_uint virtualHz; // Instructions per emulated second, or 0 for the clock
+        unsigned int virtualCycles; // Instruction periods into the current tick
+        _Atomic unsigned long long virtualTicks;
 
-        int soundTimerTriggered;
+        _Alignas(SYSTEM_CACHE_LINE) _Atomic unsigned long long keys; // KEYS_* fields
 
-        int shouldQuit; // Inidicates if program is closed or otherwise quit.
+        _Alignas(SYSTEM_CACHE_LINE) atomic_uint wfk; // WFK_* bits
+        unsigned int wfkPresses; // KEYS_PRESSES_SHIFT field when the wait began
+        struct system_sleep wfkSleep; // Woken on key presses and on quit
 
-        pthread_rwlock_t timerRwLock;
-        pthread_rwlock_t soundRwLock;
-        pthread_rwlock_t gfxRwLock;
-        pthread_rwlock_t shouldQuitLock;
-        pthread_rwlock_t keyLock;
+        _Alignas(SYSTEM_CACHE_LINE) atomic_int soundTimerTriggered;
+        struct system_sleep soundSleep; // Woken on sound triggers and on quit
+
+        _Alignas(SYSTEM_CACHE_LINE) atomic_int shouldQuit; // Inidicates if program is closed or otherwise quit.
+        atomic_int fastForward; // Held down by the user
+        struct system_debug debug;
+
+        // Each instance owns its memory and framebuffer.
+        _Alignas(SYSTEM_CACHE_LINE) unsigned char memory[ADDRESSABLE_SIZE];
+        unsigned char gfx[GRAPHICS_MEM_SIZE];
+        unsigned char frames[3][GRAPHICS_MEM_SIZE];
 };
 
-static unsigned char MEMORY[MEMORY_SIZE];
-static unsigned char GFX[GRAPHICS_MEM_SIZE];
+//! The system whose batch of cycles is running on this thread, if any.
+//! Accessors read the batch snapshot instead of shared state while it's set.
+static _Thread_local struct system *cycling = NULL;
+
 
 static unsigned char fontset[FONT_SIZE] = {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -77,71 +149,142 @@ static unsigned char fontset[FONT_SIZE] = {
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-struct system *SystemInit(int isDebugEnabled) {
-        struct system_private *prv = (struct system_private *)malloc(sizeof(struct system_private));
-        memset(prv, 0, sizeof(struct system_private));
+//! \brief Initializes a struct system_sleep. Unexported.
+//! \param[out] sleep State to initialize
+//! \param[in] name What it's for, used in error messages
+//! \return 1 on success, otherwise 0
+static int SleepInit(struct system_sleep *sleep, const char *name) {
+        if (0 != pthread_mutex_init(&sleep->lock, NULL)) {
+                fprintf(stderr, "Couldn't initialize system %s mutex", name);
+                return 0;
+        }
 
-        struct system *s = (struct system *)malloc(sizeof(struct system));
-        memset(s, 0, sizeof(struct system));
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        int err = pthread_cond_init(&sleep->wake, &attr);
+        pthread_condattr_destroy(&attr);
 
-        s->memory = MEMORY;
-        memset(MEMORY, 0, MEMORY_SIZE);
+        if (0 != err) {
+                fprintf(stderr, "Couldn't initialize system %s condition variable", name);
+                pthread_mutex_destroy(&sleep->lock);
+                return 0;
+        }
 
-        s->gfx = GFX;
-        memset(GFX, 0, GRAPHICS_MEM_SIZE);
+        atomic_init(&sleep->sleepers, 0);
 
-        s->pc = 0x200;
+        return 1;
+}
 
-        s->fontp = 0;
-        for (int i=s->fontp; i<FONT_SIZE; i++) {
-                s->memory[i] = fontset[i];
+//! \brief Destroys a struct system_sleep. Unexported.
+//! \param[in,out] sleep State to destroy
+//! \param[in] name What it's for, used in error messages
+static void SleepDeinit(struct system_sleep *sleep, const char *name) {
+        if (0 != pthread_cond_destroy(&sleep->wake)) {
+                fprintf(stderr, "Couldn't destroy system %s condition variable", name);
         }
 
-        s->prv = prv;
+        if (0 != pthread_mutex_destroy(&sleep->lock)) {
+                fprintf(stderr, "Couldn't destroy system %s mutex", name);
+        }
+}
 
-        s->prv->debug.enabled = isDebugEnabled;
-        s->prv->debug.fetchAndDecode = 1;
-        s->prv->debug.execute = 0;
+//! \brief Starts a sleep; checks and waits happen between this and SleepEnd(). Unexported.
+//!
+//! The fence pairs with the one in SleepWake(): either the sleeper's checks
+//! see the change, or the waker sees the sleeper and takes the lock.
+static void SleepBegin(struct system_sleep *sleep) {
+        pthread_mutex_lock(&sleep->lock);
+        atomic_fetch_add_explicit(&sleep->sleepers, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+}
 
-        pthread_rwlockattr_t attr;
-        pthread_rwlockattr_init(&attr);
-        pthread_rwlockattr_setpshared(&attr, 1);
+//! \brief Ends a sleep started by SleepBegin(). Unexported.
+static void SleepEnd(struct system_sleep *sleep) {
+        atomic_fetch_sub_explicit(&sleep->sleepers, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&sleep->lock);
+}
 
-        if (0 != pthread_rwlock_init(&s->prv->keyLock, &attr)) {
-                fprintf(stderr, "Couldn't initialize system key rwlock");
-                return NULL;
+//! \brief Wakes anything sleeping on sleep. Unexported.
+//!
+//! Call after publishing the change that should end the sleep. Nobody is
+//! usually asleep, so this is just a fence and a load.
+static void SleepWake(struct system_sleep *sleep) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (0 == atomic_load_explicit(&sleep->sleepers, memory_order_relaxed)) {
+                return;
         }
 
-        if (0 != pthread_rwlock_init(&s->prv->debug.lock, &attr)) {
-                fprintf(stderr, "Couldn't initialize system debugUi rwlock");
-                return NULL;
-        }
+        pthread_mutex_lock(&sleep->lock);
+        pthread_cond_broadcast(&sleep->wake);
+        pthread_mutex_unlock(&sleep->lock);
+}
+
+//! \brief Reads CLOCK_MONOTONIC. Unexported.
+//! \return nanoseconds
+static unsigned long long MonotonicNs() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * NS_PER_S + now.tv_nsec;
+}
 
-        if (0 != pthread_rwlock_init(&s->prv->shouldQuitLock, &attr)) {
-                fprintf(stderr, "Couldn't initialize system shouldQuit rwlock");
+struct system *SystemInit(int isDebugEnabled) {
+        struct system_private *prv = (struct system_private *)aligned_alloc(SYSTEM_CACHE_LINE, sizeof(struct system_private));
+        struct system *s = (struct system *)aligned_alloc(SYSTEM_CACHE_LINE, sizeof(struct system));
+        if (NULL == prv || NULL == s) {
+                free(prv);
+                free(s);
                 return NULL;
         }
 
-        if (0 != pthread_rwlock_init(&s->prv->wfk.lock, &attr)) {
-                fprintf(stderr, "Couldn't initialize system wfk rwlock");
-                return NULL;
+        memset(prv, 0, sizeof(struct system_private));
+        memset(s, 0, sizeof(struct system));
+
+        s->memory = prv->memory;
+        s->gfx = prv->gfx;
+
+        s->pc = 0x200;
+
+        s->fontp = 0;
+        for (int i=s->fontp; i<FONT_SIZE; i++) {
+                s->memory[i] = fontset[i];
         }
 
-        if (0 != pthread_rwlock_init(&s->prv->timerRwLock, &attr)) {
-                fprintf(stderr, "Couldn't initialize system timer rwlock");
+        s->prv = prv;
+
+        // Undo whatever was set up before a failure.
+        if (!SleepInit(&prv->wfkSleep, "wfk")) {
+                free(prv);
+                free(s);
                 return NULL;
         }
 
-        if (0 != pthread_rwlock_init(&s->prv->soundRwLock, &attr)) {
-                fprintf(stderr, "Couldn't initialize system sound rwlock");
+        if (!SleepInit(&prv->soundSleep, "sound")) {
+                SleepDeinit(&prv->wfkSleep, "wfk");
+                free(prv);
+                free(s);
                 return NULL;
         }
 
-        if (0 != pthread_rwlock_init(&s->prv->gfxRwLock, &attr)) {
-                fprintf(stderr, "Couldn't initialize system gfx rwlock");
+        if (!SleepInit(&prv->debug.sleep, "debug")) {
+                SleepDeinit(&prv->soundSleep, "sound");
+                SleepDeinit(&prv->wfkSleep, "wfk");
+                free(prv);
+                free(s);
                 return NULL;
         }
 
+        s->prv->frameFront = 0;
+        s->prv->frameMiddle = 1;
+        s->prv->frameBack = 2;
+
+        s->prv->timerClock = isDebugEnabled ? TIMER_CLOCK_STOPPED : MonotonicNs();
+
+        SystemRandomSeed(s, 0);
+
+        s->prv->debug.enabled = isDebugEnabled;
+        s->prv->debug.command = SYSTEM_DEBUG_NONE;
+
         return s;
 }
 
@@ -149,37 +292,11 @@ void SystemDeinit(struct system *s) {
         if (NULL == s)
                 return;
 
-        if (NULL != s->prv)
-                free(s->prv);
-
-        if (0 != pthread_rwlock_destroy(&s->prv->keyLock)) {
-                fprintf(stderr, "Couldn't destroy system key rwlock");
-        }
-
-        if (0 != pthread_rwlock_destroy(&s->prv->debug.lock)) {
-                fprintf(stderr, "Couldn't destroy system debugUi rwlock");
-        }
-
-        if (0 != pthread_rwlock_destroy(&s->prv->shouldQuitLock)) {
-                fprintf(stderr, "Couldn't destroy system shouldQuit rwlock");
-        }
-
-        if (0 != pthread_rwlock_destroy(&s->prv->wfk.lock)) {
-                fprintf(stderr, "Couldn't destroy system wfk rwlock");
-        }
-
-        if (0 != pthread_rwlock_destroy(&s->prv->timerRwLock)) {
-                fprintf(stderr, "Couldn't destroy system timer rwlock");
-        }
-
-        if (0 != pthread_rwlock_destroy(&s->prv->soundRwLock)) {
-                fprintf(stderr, "Couldn't destroy system sound rwlock");
-        }
-
-        if (0 != pthread_rwlock_destroy(&s->prv->gfxRwLock)) {
-                fprintf(stderr, "Couldn't destroy system gfx rwlock");
-        }
+        SleepDeinit(&s->prv->wfkSleep, "wfk");
+        SleepDeinit(&s->prv->soundSleep, "sound");
+        SleepDeinit(&s->prv->debug.sleep, "debug");
 
+        free(s->prv);
         free(s);
 }
 
@@ -192,6 +309,28 @@ unsigned short SystemFontSprite(struct system *s, unsigned int index) {
         return s->fontp + (index * 5);
 }
 
+void SystemRandomSeed(struct system *s, unsigned long long seed) {
+        // SplitMix64 spreads nearby seeds apart, and only maps one seed to 0,
+        // which xorshift can't leave.
+        unsigned long long z = seed + 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        z ^= z >> 31;
+
+        s->prv->random = z ? z : 0x9E3779B97F4A7C15ull;
+}
+
+unsigned char SystemRandom(struct system *s) {
+        unsigned long long x = s->prv->random;
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        s->prv->random = x;
+
+        // The high bits of the product are the best mixed.
+        return (x * 0x2545F4914F6CDD1Dull) >> 56;
+}
+
 int SystemLoadProgram(struct system *s, unsigned char *m, unsigned int size) {
         unsigned char *mem = &s->memory[0x200];
         unsigned short max_size = MEMORY_SIZE - 0x200;
@@ -227,30 +366,48 @@ void SystemStackPop(struct system *s) {
         s->pc = s->stack[s->sp];
 }
 
-int SystemGfxLock(struct system *s) {
-        return pthread_rwlock_rdlock(&s->prv->gfxRwLock);
+//! \brief Hands the current framebuffer to the graphics thread. Unexported.
+//!
+//! Copies gfx into the back buffer, then swaps it into the middle, marked as
+//! fresh. Whatever the middle held becomes the next back buffer; the reader
+//! never holds it, so the writer never waits.
+static void GfxPublish(struct system *s) {
+        struct system_private *p = s->prv;
+
+        memcpy(p->frames[p->frameBack], s->gfx, GRAPHICS_MEM_SIZE);
+        unsigned int old = atomic_exchange_explicit(&p->frameMiddle, p->frameBack | FRAME_FRESH, memory_order_acq_rel);
+        p->frameBack = old & FRAME_INDEX;
+        p->gfxDirty = 0;
 }
 
-int SystemGfxUnlock(struct system *s) {
-        return pthread_rwlock_unlock(&s->prv->gfxRwLock);
+//! \brief Notes a framebuffer change. Unexported.
+//!
+//! While SystemRunCycles() is running a batch the frame is published once the
+//! batch is done; otherwise, right away.
+static void GfxChanged(struct system *s) {
+        s->prv->gfxDirty = 1;
+        if (cycling != s) {
+                GfxPublish(s);
+        }
 }
 
-void SystemClearScreen(struct system *s) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->gfxRwLock)) {
-                fprintf(stderr, "Failed to lock system gfx rw lock");
-                return;
+const unsigned char *SystemGfxFrame(struct system *s) {
+        struct system_private *p = s->prv;
+
+        if (atomic_load_explicit(&p->frameMiddle, memory_order_relaxed) & FRAME_FRESH) {
+                unsigned int old = atomic_exchange_explicit(&p->frameMiddle, p->frameFront, memory_order_acq_rel);
+                p->frameFront = old & FRAME_INDEX;
         }
 
+        return p->frames[p->frameFront];
+}
+
+void SystemClearScreen(struct system *s) {
         memset(s->gfx, 0, GRAPHICS_MEM_SIZE);
-        pthread_rwlock_unlock(&s->prv->gfxRwLock);
+        GfxChanged(s);
 }
 
 void SystemDrawSprite(struct system *s, unsigned int x_pos, unsigned int y_pos, unsigned int height) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->gfxRwLock)) {
-                fprintf(stderr, "Failed to lock system gfx rw lock");
-                return;
-        }
-
         s->v[15] = 0;
 
         for (int y = 0; y < height; y++) {
@@ -266,6 +423,9 @@ void SystemDrawSprite(struct system *s, unsigned int x_pos, unsigned int y_pos,
                         int y_off = (y_pos + y) * GRAPHICS_WIDTH;
                         int x_off = (x_pos + x);
                         int pos = y_off + x_off;
+                        if (pos >= GRAPHICS_MEM_SIZE) {
+                                continue; // Off the bottom of the screen.
+                        }
 
                         if (s->gfx[pos] == 0xFF) {
                                 s->v[15] = 1;
@@ -274,257 +434,477 @@ void SystemDrawSprite(struct system *s, unsigned int x_pos, unsigned int y_pos,
                         s->gfx[pos] ^= 0xFF;
                 }
         }
-        pthread_rwlock_unlock(&s->prv->gfxRwLock);
+
+        GfxChanged(s);
 }
 
 void SystemWFKSet(struct system *s, unsigned char reg) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->wfk.lock)) {
-                fprintf(stderr, "Failed to lock system wfk rwlock");
-                return;
-        }
-        s->prv->wfk.waiting = 1;
-        s->prv->wfk.justChanged = 0;
-        s->prv->wfk.reg = reg;
-        pthread_rwlock_unlock(&s->prv->wfk.lock);
+        unsigned long long keys = atomic_load_explicit(&s->prv->keys, memory_order_relaxed);
+        s->prv->wfkPresses = (keys >> KEYS_PRESSES_SHIFT) & 0xFFF;
+
+        atomic_store_explicit(&s->prv->wfk, WFK_WAITING | (reg & WFK_REG), memory_order_release);
 }
 
 int SystemWFKWaiting(struct system *s) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->wfk.lock)) {
-                fprintf(stderr, "Failed to lock system wfk rwlock");
+        return (atomic_load_explicit(&s->prv->wfk, memory_order_acquire) & WFK_WAITING) != 0;
+}
+
+void SystemWFKOccurred(struct system *s, unsigned char key) {
+        unsigned int wfk = atomic_load_explicit(&s->prv->wfk, memory_order_acquire);
+        s->v[wfk & WFK_REG] = key;
+
+        // Publishes the register write along with the new state.
+        atomic_store_explicit(&s->prv->wfk, WFK_JUST_CHANGED | (wfk & WFK_REG), memory_order_release);
+}
+
+int SystemWFKPoll(struct system *s) {
+        if (!SystemWFKWaiting(s)) {
                 return 0;
         }
-        int result = s->prv->wfk.waiting;
-        pthread_rwlock_unlock(&s->prv->wfk.lock);
 
-        return result;
+        unsigned long long keys = atomic_load_explicit(&s->prv->keys, memory_order_relaxed);
+        if (((keys >> KEYS_PRESSES_SHIFT) & 0xFFF) == s->prv->wfkPresses) {
+                return 0;
+        }
+
+        SystemWFKOccurred(s, (keys >> KEYS_LAST_SHIFT) & 0xF);
+        return 1;
 }
 
-void SystemWFKOccurred(struct system *s, unsigned char key) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->wfk.lock)) {
-                fprintf(stderr, "Failed to lock system wfk rwlock");
-                return;
+int SystemWFKBlock(struct system *s) {
+        struct system_sleep *sleep = &s->prv->wfkSleep;
+        int ended = 0;
+
+        SleepBegin(sleep);
+        while (SystemWFKWaiting(s) && !SystemShouldQuit(s) && !SystemDebugIsEnabled(s)) {
+                if ((ended = SystemWFKPoll(s))) {
+                        break;
+                }
+                pthread_cond_wait(&sleep->wake, &sleep->lock);
         }
-        s->prv->wfk.waiting = 0;
-        s->prv->wfk.justChanged = 1;
-        s->v[s->prv->wfk.reg] = key;
-        pthread_rwlock_unlock(&s->prv->wfk.lock);
+        SleepEnd(sleep);
+
+        return ended;
 }
 
 int SystemWFKChanged(struct system *s) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->wfk.lock)) {
-                fprintf(stderr, "Failed to lock system wfk rwlock");
-                return 0;
-        }
-        int result = s->prv->wfk.justChanged;
-        pthread_rwlock_unlock(&s->prv->wfk.lock);
-
-        return result;
+        return (atomic_load_explicit(&s->prv->wfk, memory_order_acquire) & WFK_JUST_CHANGED) != 0;
 }
 
 void SystemWFKStop(struct system *s) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->wfk.lock)) {
-                fprintf(stderr, "Failed to lock system wfk rwlock");
-                return;
-        }
-        s->prv->wfk.justChanged = 0;
-        pthread_rwlock_unlock(&s->prv->wfk.lock);
+        atomic_fetch_and_explicit(&s->prv->wfk, ~(unsigned int)WFK_JUST_CHANGED, memory_order_acq_rel);
 }
 
-void SystemDecrementTimers(struct system *s) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->timerRwLock)) {
-                fprintf(stderr, "Failed to lock system timer rw lock");
-                return;
+//! \brief Reads the clock timers run on. Unexported.
+//! \return nanoseconds since SystemInit(), not counting time spent debugging
+static unsigned long long TimerClockNow(struct system *s) {
+        unsigned long long clock = atomic_load_explicit(&s->prv->timerClock, memory_order_acquire);
+        if (clock & TIMER_CLOCK_STOPPED) {
+                return clock & ~TIMER_CLOCK_STOPPED;
         }
 
-        if (s->prv->delayTimer > 0) {
-                s->prv->delayTimer--;
+        return MonotonicNs() - clock;
+}
+
+//! \brief Stops or restarts the timer clock, keeping its reading. Unexported.
+static void TimerClockSetStopped(struct system *s, int stopped) {
+        unsigned long long clock = atomic_load_explicit(&s->prv->timerClock, memory_order_relaxed);
+        unsigned long long next;
+
+        do {
+                if (((clock & TIMER_CLOCK_STOPPED) != 0) == (stopped != 0)) {
+                        return;
+                }
+
+                if (stopped) {
+                        next = (MonotonicNs() - clock) | TIMER_CLOCK_STOPPED;
+                } else {
+                        next = MonotonicNs() - (clock & ~TIMER_CLOCK_STOPPED);
+                }
+        } while (!atomic_compare_exchange_weak_explicit(&s->prv->timerClock, &clock, next, memory_order_acq_rel, memory_order_relaxed));
+}
+
+//! \brief How long ago a timer was set. Unexported.
+//!
+//! Only the low bits of the timer clock are kept, so this wraps every couple
+//! of years; that's far longer than a timer can run.
+//!
+//! \param[in] timer TIMER_* fields
+//! \param[in] now Timer clock reading
+//! \return nanoseconds, negative if another thread set it after now was read
+static long long TimerElapsed(unsigned long long timer, unsigned long long now) {
+        long long elapsed = (now - timer) & TIMER_SET_MASK;
+        return (elapsed > (long long)(TIMER_SET_MASK >> 1)) ? elapsed - (long long)TIMER_SET_MASK - 1 : elapsed;
+}
+
+//! \brief Works out a timer's value at the given time. Unexported.
+//! \param[in] timer TIMER_* fields
+//! \param[in] now Timer clock reading
+//! \return value of the timer
+static unsigned char TimerValue(unsigned long long timer, unsigned long long now) {
+        unsigned int value = timer >> TIMER_VALUE_SHIFT;
+        long long elapsed = TimerElapsed(timer, now);
+
+        if (value == 0 || elapsed <= 0) {
+                return value;
         }
 
-        if (s->prv->soundTimer > 0) {
-                s->prv->soundTimer--;
+        // Any timer has run out after 255 ticks; this also keeps ticks from overflowing.
+        if (elapsed >= 256 * NS_PER_S / TIMER_HZ) {
+                return 0;
         }
 
-        pthread_rwlock_unlock(&s->prv->timerRwLock);
+        unsigned long long ticks = elapsed * TIMER_HZ / NS_PER_S;
+        return (ticks >= value) ? 0 : value - ticks;
 }
 
-int SystemDelayTimer(struct system *s) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->timerRwLock)) {
-                fprintf(stderr, "Failed to lock system timer rw lock");
-                return -1;
+//! \brief Returns a timer's current value. Unexported.
+static unsigned char TimerRead(struct system *s, _Atomic unsigned long long *timer) {
+        unsigned long long value = atomic_load_explicit(timer, memory_order_relaxed);
+        if ((value >> TIMER_VALUE_SHIFT) == 0) {
+                return 0; // Idle timers don't need the clock.
         }
 
-        int result = s->prv->delayTimer;
-        pthread_rwlock_unlock(&s->prv->timerRwLock);
+        return TimerValue(value, TimerClockNow(s));
+}
 
-        return result;
+//! \brief Sets a timer, which counts down from now. Unexported.
+static void TimerSet(struct system *s, _Atomic unsigned long long *timer, unsigned char value) {
+        unsigned long long set = (value == 0) ? 0 : TimerClockNow(s) & TIMER_SET_MASK;
+        atomic_store_explicit(timer, (unsigned long long)value << TIMER_VALUE_SHIFT | set, memory_order_relaxed);
 }
 
-int SystemSoundTimer(struct system *s) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->timerRwLock)) {
-                fprintf(stderr, "Failed to lock system timer rw lock");
-                return -1;
-        }
+//! \brief Decrements a timer unless it's already zero. Unexported.
+//!
+//! The timer may be set concurrently, so this never overwrites a new value
+//! with one derived from the old value.
+//!
+//! \return 1 if this took the timer from 1 to 0, otherwise 0
+static int TimerDecrement(struct system *s, _Atomic unsigned long long *timer) {
+        unsigned long long now = TimerClockNow(s);
+        unsigned long long value = atomic_load_explicit(timer, memory_order_relaxed);
+        unsigned char current;
 
-        int result = s->prv->soundTimer;
-        pthread_rwlock_unlock(&s->prv->timerRwLock);
+        do {
+                if ((current = TimerValue(value, now)) == 0) {
+                        return 0;
+                }
+                // value now holds the latest timer if this fails; try again.
+        } while (!atomic_compare_exchange_weak_explicit(timer, &value, (unsigned long long)(current - 1) << TIMER_VALUE_SHIFT | (now & TIMER_SET_MASK), memory_order_relaxed, memory_order_relaxed));
 
-        return result;
+        return current == 1;
 }
 
-void SystemSetTimers(struct system *s, int dt, int st) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->timerRwLock)) {
-                fprintf(stderr, "Failed to lock system timer rw lock");
-                return;
+//! \brief When the sound timer will run out and trigger sound. Unexported.
+//! \param[out] expiry CLOCK_MONOTONIC time
+//! \return 0 if the sound timer isn't due to trigger sound while the clock runs, otherwise 1
+static int SoundTimerExpiry(struct system *s, struct timespec *expiry) {
+        unsigned long long clock = atomic_load_explicit(&s->prv->timerClock, memory_order_acquire);
+        unsigned long long timer = atomic_load_explicit(&s->prv->soundTimer, memory_order_relaxed);
+        unsigned long long value = timer >> TIMER_VALUE_SHIFT;
+
+        if ((clock & TIMER_CLOCK_STOPPED) || value == 0 ||
+            !atomic_load_explicit(&s->prv->soundTimerTriggered, memory_order_relaxed)) {
+                return 0;
         }
 
-        if (dt != -1) {
-                s->prv->delayTimer = dt;
+        unsigned long long now = MonotonicNs();
+        unsigned long long at = now - TimerElapsed(timer, now - clock) + (value * NS_PER_S + TIMER_HZ - 1) / TIMER_HZ;
+        expiry->tv_sec = at / NS_PER_S;
+        expiry->tv_nsec = at % NS_PER_S;
+
+        return 1;
+}
+
+void SystemDecrementTimers(struct system *s) {
+        TimerDecrement(s, &s->prv->delayTimer);
+        if (TimerDecrement(s, &s->prv->soundTimer) && atomic_load_explicit(&s->prv->soundTimerTriggered, memory_order_relaxed)) {
+                SleepWake(&s->prv->soundSleep);
         }
-        if (st != -1) {
-                s->prv->soundTimer = st;
+}
+
+//! \brief Instruction periods in a virtual tick. Unexported.
+//!
+//! Spreads hz evenly over ticks, even when it isn't a multiple of TIMER_HZ.
+static unsigned int VirtualTickLength(unsigned int hz, unsigned long long tick) {
+        return (tick + 1) * hz / TIMER_HZ - tick * hz / TIMER_HZ;
+}
+
+//! \brief Ends a virtual tick: ticks the timers and presents the frame. Unexported.
+static void VirtualTick(struct system *s) {
+        SystemDecrementTimers(s);
+        if (s->prv->gfxDirty) {
+                GfxPublish(s);
         }
-        pthread_rwlock_unlock(&s->prv->timerRwLock);
+
+        s->prv->virtualCycles = 0;
+        atomic_fetch_add_explicit(&s->prv->virtualTicks, 1, memory_order_release);
 }
 
-int SystemSoundTriggered(struct system *s) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->soundRwLock)) {
-                fprintf(stderr, "Failed to lock system timer rw lock");
-                return 0;
+void SystemVirtualTimeSet(struct system *s, unsigned int cyclesHz) {
+        if (cyclesHz != atomic_load_explicit(&s->prv->virtualHz, memory_order_relaxed)) {
+                s->prv->virtualCycles = 0;
         }
+        atomic_store_explicit(&s->prv->virtualHz, cyclesHz, memory_order_relaxed);
 
-        int result = (s->prv->soundTimerTriggered && s->prv->soundTimer == 0);
-        pthread_rwlock_unlock(&s->prv->soundRwLock);
+        TimerClockSetStopped(s, cyclesHz != 0 || SystemDebugIsEnabled(s));
+        SleepWake(&s->prv->soundSleep); // Its expiry has moved.
+}
 
-        return result;
+unsigned int SystemVirtualTime(struct system *s) {
+        return atomic_load_explicit(&s->prv->virtualHz, memory_order_relaxed);
 }
 
-void SystemSoundSetTrigger(struct system *s, int v) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->soundRwLock)) {
-                fprintf(stderr, "Failed to lock system timer rw lock");
-                return;
+unsigned long long SystemVirtualTicks(struct system *s) {
+        return atomic_load_explicit(&s->prv->virtualTicks, memory_order_acquire);
+}
+
+unsigned int SystemVirtualTickRemaining(struct system *s) {
+        unsigned int hz = SystemVirtualTime(s);
+        if (hz == 0) {
+                return 0;
         }
 
-        s->prv->soundTimerTriggered = v;
-        pthread_rwlock_unlock(&s->prv->soundRwLock);
+        return VirtualTickLength(hz, SystemVirtualTicks(s)) - s->prv->virtualCycles;
 }
 
-int SystemShouldQuit(struct system *s) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->shouldQuitLock)) {
-                fprintf(stderr, "Failed to lock system shouldQuit rwlock");
-                return 0;
+int SystemDelayTimer(struct system *s) {
+        if (cycling == s) {
+                return s->cycleDelayTimer;
         }
 
-        int result = s->prv->shouldQuit;
-        pthread_rwlock_unlock(&s->prv->shouldQuitLock);
+        return TimerRead(s, &s->prv->delayTimer);
+}
 
-        return result;
+int SystemSoundTimer(struct system *s) {
+        return TimerRead(s, &s->prv->soundTimer);
 }
 
-void SystemSignalQuit(struct system *s) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->shouldQuitLock)) {
-                fprintf(stderr, "Failed to lock system shouldQuit rwlock");
-                return;
+void SystemSetTimers(struct system *s, int dt, int st) {
+        if (dt != -1) {
+                TimerSet(s, &s->prv->delayTimer, dt);
+                if (cycling == s) { // FX15 inside a batch
+                        s->cycleDelayTimer = dt;
+                }
         }
+        if (st != -1) {
+                TimerSet(s, &s->prv->soundTimer, st);
+                SleepWake(&s->prv->soundSleep); // It may be waiting for the old value to run out.
+        }
+}
 
-        s->prv->shouldQuit = 1;
-        pthread_rwlock_unlock(&s->prv->shouldQuitLock);
+int SystemSoundTriggered(struct system *s) {
+        return atomic_load_explicit(&s->prv->soundTimerTriggered, memory_order_relaxed) &&
+                TimerRead(s, &s->prv->soundTimer) == 0;
 }
 
-int SystemDebugIsEnabled(struct system *s) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->debug.lock)) {
-                fprintf(stderr, "Failed to lock system shouldQuit rwlock");
-                return 0;
+void SystemSoundSetTrigger(struct system *s, int v) {
+        atomic_store_explicit(&s->prv->soundTimerTriggered, v, memory_order_relaxed);
+        if (v) {
+                SleepWake(&s->prv->soundSleep);
         }
+}
 
-        int result = s->prv->debug.enabled;
-        pthread_rwlock_unlock(&s->prv->debug.lock);
-
-        return result;
+//! \brief Is a before b? Unexported.
+static int TimespecBefore(const struct timespec *a, const struct timespec *b) {
+        return (a->tv_sec != b->tv_sec) ? a->tv_sec < b->tv_sec : a->tv_nsec < b->tv_nsec;
 }
 
-int SystemDebugShouldFetchAndDecode(struct system *s) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->debug.lock)) {
-                fprintf(stderr, "Failed to lock system shouldQuit rwlock");
-                return 0;
+int SystemSoundWait(struct system *s, const struct timespec *deadline) {
+        struct system_sleep *sleep = &s->prv->soundSleep;
+        int triggered;
+
+        SleepBegin(sleep);
+        while (!(triggered = SystemSoundTriggered(s)) && !SystemShouldQuit(s)) {
+                // Nothing ticks the sound timer, so wake up when it runs out.
+                const struct timespec *until = deadline;
+                struct timespec expiry;
+                if (SoundTimerExpiry(s, &expiry) && (NULL == deadline || TimespecBefore(&expiry, deadline))) {
+                        until = &expiry;
+                }
+
+                if (NULL == until) {
+                        pthread_cond_wait(&sleep->wake, &sleep->lock);
+                } else if (ETIMEDOUT == pthread_cond_timedwait(&sleep->wake, &sleep->lock, until) && until == deadline) {
+                        triggered = SystemSoundTriggered(s);
+                        break;
+                }
         }
+        SleepEnd(sleep);
 
-        int result = s->prv->debug.fetchAndDecode;
-        pthread_rwlock_unlock(&s->prv->debug.lock);
+        return triggered;
+}
 
-        return result;
+int SystemShouldQuit(struct system *s) {
+        return atomic_load_explicit(&s->prv->shouldQuit, memory_order_acquire);
 }
 
-int SystemDebugShouldExecute(struct system *s) {
-        if (0 != pthread_rwlock_rdlock(&s->prv->debug.lock)) {
-                fprintf(stderr, "Failed to lock system shouldQuit rwlock");
-                return 0;
-        }
+void SystemSignalQuit(struct system *s) {
+        atomic_store_explicit(&s->prv->shouldQuit, 1, memory_order_release);
+        SleepWake(&s->prv->wfkSleep);
+        SleepWake(&s->prv->soundSleep);
+        SleepWake(&s->prv->debug.sleep);
+        SleepWake(&s->prv->wfkSleep); // Breaking in during FX0A
+}
 
-        int result = s->prv->debug.execute;
-        pthread_rwlock_unlock(&s->prv->debug.lock);
+int SystemFastForward(struct system *s) {
+        return atomic_load_explicit(&s->prv->fastForward, memory_order_relaxed);
+}
 
-        return result;
+void SystemFastForwardSet(struct system *s, int onOrOff) {
+        atomic_store_explicit(&s->prv->fastForward, onOrOff, memory_order_relaxed);
+}
+
+int SystemDebugIsEnabled(struct system *s) {
+        return atomic_load_explicit(&s->prv->debug.enabled, memory_order_acquire);
 }
 
 void SystemDebugSetEnabled(struct system *s, int onOrOff) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->debug.lock)) {
-                fprintf(stderr, "Failed to lock system shouldQuit rwlock");
-                return;
-        }
+        atomic_store_explicit(&s->prv->debug.enabled, onOrOff, memory_order_release);
 
-        s->prv->debug.enabled = onOrOff;
-        pthread_rwlock_unlock(&s->prv->debug.lock);
+        // The debugger ticks timers itself, once per step.
+        TimerClockSetStopped(s, onOrOff || SystemVirtualTime(s) != 0);
+        SleepWake(&s->prv->soundSleep);
+        SleepWake(&s->prv->debug.sleep);
+        SleepWake(&s->prv->wfkSleep);
 }
 
-void SystemDebugSetFetchAndDecode(struct system *s, int onOrOff) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->debug.lock)) {
-                fprintf(stderr, "Failed to lock system shouldQuit rwlock");
-                return;
-        }
+void SystemDebugPost(struct system *s, enum system_debug_command command, unsigned int argument) {
+        atomic_store_explicit(&s->prv->debug.command, argument << DEBUG_ARGUMENT_SHIFT | command, memory_order_release);
+        SleepWake(&s->prv->debug.sleep);
+}
 
-        s->prv->debug.fetchAndDecode = onOrOff;
-        pthread_rwlock_unlock(&s->prv->debug.lock);
+enum system_debug_command SystemDebugTake(struct system *s, unsigned int *argument) {
+        unsigned int command = atomic_exchange_explicit(&s->prv->debug.command, SYSTEM_DEBUG_NONE, memory_order_acq_rel);
+        *argument = command >> DEBUG_ARGUMENT_SHIFT;
+        return command & DEBUG_COMMAND_MASK;
 }
 
-void SystemDebugSetExecute(struct system *s, int onOrOff) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->debug.lock)) {
-                fprintf(stderr, "Failed to lock system shouldQuit rwlock");
-                return;
+enum system_debug_command SystemDebugWait(struct system *s, unsigned int *argument) {
+        struct system_sleep *sleep = &s->prv->debug.sleep;
+
+        SleepBegin(sleep);
+        while (SYSTEM_DEBUG_NONE == atomic_load_explicit(&s->prv->debug.command, memory_order_relaxed) &&
+               SystemDebugIsEnabled(s) && !SystemShouldQuit(s)) {
+                pthread_cond_wait(&sleep->wake, &sleep->lock);
         }
+        SleepEnd(sleep);
 
-        s->prv->debug.execute = onOrOff;
-        pthread_rwlock_unlock(&s->prv->debug.lock);
+        return SystemDebugTake(s, argument);
 }
 
 int SystemKeyIsPressed(struct system *s, int key) {
-        int result = 0;
         if (key < 0 || key > 0xF) {
-                return result;
+                return 0;
         }
 
-        if (0 != pthread_rwlock_rdlock(&s->prv->keyLock)) {
-                fprintf(stderr, "Failed to lock system key rwlock");
-                return 0;
+        if (cycling == s) {
+                return (s->cycleKeys & (1 << key)) ? 0xFF : 0;
         }
 
-        result = s->key[key];
+        unsigned long long keys = atomic_load_explicit(&s->prv->keys, memory_order_relaxed);
+        return (keys & (1u << key)) ? 0xFF : 0;
+}
+
+void SystemKeySetPressed(struct system *s, int key, int pressed) {
+        unsigned long long bit = 1ull << key;
+        unsigned long long keys = atomic_load_explicit(&s->prv->keys, memory_order_relaxed);
+        unsigned long long next;
 
-        pthread_rwlock_unlock(&s->prv->keyLock);
+        do {
+                if (((keys & bit) != 0) == (pressed != 0)) {
+                        return; // Not an edge; eg. a repeated key down event.
+                }
 
-        return result;
+                next = (keys ^ bit) + (1ull << KEYS_EDGES_SHIFT);
+                if (pressed) {
+                        unsigned long long presses = ((keys >> KEYS_PRESSES_SHIFT) + 1) & 0xFFF;
+                        next &= ~(0xFFFull << KEYS_PRESSES_SHIFT | 0xFull << KEYS_LAST_SHIFT);
+                        next |= presses << KEYS_PRESSES_SHIFT | (unsigned long long)key << KEYS_LAST_SHIFT;
+                }
+        } while (!atomic_compare_exchange_weak_explicit(&s->prv->keys, &keys, next, memory_order_relaxed, memory_order_relaxed));
+
+        if (pressed) {
+                SleepWake(&s->prv->wfkSleep);
+        }
 }
 
-void SystemKeySetPressed(struct system *s, int key, int pressed) {
-        if (0 != pthread_rwlock_wrlock(&s->prv->keyLock)) {
-                fprintf(stderr, "Failed to lock system key rwlock");
-                return;
+unsigned short SystemKeyMask(struct system *s) {
+        return atomic_load_explicit(&s->prv->keys, memory_order_relaxed) & KEYS_MASK;
+}
+
+unsigned int SystemKeyEdges(struct system *s) {
+        return atomic_load_explicit(&s->prv->keys, memory_order_relaxed) >> KEYS_EDGES_SHIFT;
+}
+
+//! \brief Runs up to n instructions against sampled shared state. Unexported.
+static unsigned int RunBatch(struct system *s, struct opcode *opcode, unsigned int n) {
+        s->cycleKeys = SystemKeyMask(s);
+
+        s->cycleDelayTimer = SystemDelayTimer(s);
+
+        cycling = s;
+        unsigned int executed = OpcodeRun(opcode, s, n);
+        cycling = NULL;
+
+        return executed;
+}
+
+unsigned int SystemRunCycles(struct system *s, struct opcode *opcode, unsigned int n) {
+        if (SystemShouldQuit(s) || SystemDebugIsEnabled(s)) {
+                return 0;
+        }
+
+        unsigned int hz = SystemVirtualTime(s);
+
+        SystemWFKPoll(s);
+        if (SystemWFKWaiting(s)) {
+                // Virtual time passes while waiting, as the clock would.
+                while (hz != 0 && n > 0) {
+                        unsigned int length = VirtualTickLength(hz, SystemVirtualTicks(s));
+                        unsigned int idle = length - s->prv->virtualCycles;
+                        if (idle > n) {
+                                idle = n;
+                        }
+
+                        n -= idle;
+                        s->prv->virtualCycles += idle;
+                        if (s->prv->virtualCycles == length) {
+                                VirtualTick(s);
+                        }
+                }
+                return 0;
+        }
+
+        if (hz == 0) {
+                unsigned int executed = RunBatch(s, opcode, n);
+                if (s->prv->gfxDirty) {
+                        GfxPublish(s);
+                }
+                return executed;
         }
 
-        if (0 == pressed) {
-                s->key[key] = 0;
-        } else {
-                s->key[key] = 0xFF;
+        // Each tick's instructions run as their own batch, so the delay
+        // timer sampled for a batch is exact.
+        unsigned int executed = 0;
+        while (executed < n) {
+                unsigned int length = VirtualTickLength(hz, SystemVirtualTicks(s));
+                unsigned int slice = length - s->prv->virtualCycles;
+                if (slice > n - executed) {
+                        slice = n - executed;
+                }
+
+                unsigned int ran = RunBatch(s, opcode, slice);
+                executed += ran;
+                s->prv->virtualCycles += ran;
+                if (s->prv->virtualCycles == length) {
+                        VirtualTick(s);
+                }
+
+                if (ran < slice || SystemWFKWaiting(s)) {
+                        break; // At FX0A or an unknown instruction.
+                }
         }
 
-        pthread_rwlock_unlock(&s->prv->keyLock);
+        return executed;
 }
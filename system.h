@@ -10,9 +10,11 @@
 //! This is the core system emulation package.
 //!
 //! Generally speaking, the emulation occurs on the main thread with other
-//! subsystems operating in separate threads.  Threadsafe synchronization
-//! primitives are used in system methods to allow threadsafe data access and
-//! manipulation.
+//! subsystems operating in separate threads.  Shared state is lock-free:
+//! scalars are C11 atomics and completed frames are handed to the graphics
+//! thread through a triple buffer.  The emulation thread never blocks on
+//! another thread.  Threads with nothing to do, like the sound thread between
+//! beeps, sleep on condition variables until there is.
 //!
 //! There are two small logical subsystems of this package to handle tricky
 //! state management:
@@ -31,14 +33,23 @@
 //! include guard
 #define SYSTEM_VERSION "0.1.0"
 
+#include <time.h> // struct timespec
+
+struct opcode;
 struct system_private;
 
+//! Size of a CPU cache line, in bytes
+#define SYSTEM_CACHE_LINE 64
+
+//! The first cache line holds everything nearly every instruction touches and
+//! is only ever accessed by the emulation thread. State shared with other
+//! threads starts on the second line, so their writes don't keep evicting it.
 struct system {
         //! 4k System memory map:
         //! 0x000-0x1FF - Chip 8 interpreter (contains font set in emu)
         //! 0x050-0x0A0 - Used for the built in 4x5 pixel font set (0-F)
         //! 0x200-0xFFF - Program ROM and work RAM
-        unsigned char *memory;
+        _Alignas(SYSTEM_CACHE_LINE) unsigned char *memory;
 
         //! CPU registers: The Chip 8 has 15 8-bit general purpose registers
         //! named V0,V1 up to VE. The 16th register is used for the ‘carry
@@ -48,21 +59,23 @@ struct system {
 
         unsigned short i; //!< index register
         unsigned short pc; //!< Program counter can be [0x000..0xFFF]
-
-        //! The graphics of the Chip 8 are black and white and the screen has a
-        //! total of 2048 pixels (64 x 32). This can easily be implemented using
-        //! an array that hold the pixel state (1 or 0)
-        unsigned char *gfx;
+        unsigned short sp; //!< Stack pointer, indexes head element of stack
 
         //! The stack allows storing up to 16 addresses. Each address in the
         //! stack is the location of a caller, so the stack works like function
         //! calls.
         unsigned short stack[16]; //!< Function call stack
-        unsigned short sp; //!< Stack pointer, indexes head element of stack
 
-        //! The Chip 8 has a HEX based keypad (0x0-0xF), you can use an
-        //! array to store the current state of the key.
-        unsigned char key[16]; //!< Keyboard state (key pressed or not)
+        //! Pressed keys, bit N for key N, sampled by SystemRunCycles(). Unexported.
+        unsigned short cycleKeys;
+
+        //! The graphics of the Chip 8 are black and white and the screen has a
+        //! total of 2048 pixels (64 x 32). This can easily be implemented using
+        //! an array that hold the pixel state (1 or 0)
+        _Alignas(SYSTEM_CACHE_LINE) unsigned char *gfx;
+
+        //! Delay timer sampled by SystemRunCycles(). Unexported.
+        unsigned char cycleDelayTimer;
 
         unsigned short fontp; //!< Pointer to font sprits in CHIP-8 memory
 
@@ -70,8 +83,12 @@ struct system {
 };
 
 //! \brief Creates and initializes a new system object instance
+//!
+//! Every instance owns its memory and framebuffer, so any number of them can
+//! run side by side, each on its own thread.
+//!
 //! \param[in] isDebugEnabled whether to run with the integrated debugging UI
-//! \return The initialized system object
+//! \return The initialized system object, or NULL if it couldn't be set up
 struct system *
 SystemInit(int isDebugEnabled);
 
@@ -97,6 +114,32 @@ SystemIncrementPC(struct system *system);
 unsigned short
 SystemFontSprite(struct system *system, unsigned int index);
 
+//! \brief Restarts the system's random number sequence
+//!
+//! Each system has its own generator, so instances don't share a sequence or
+//! a lock. The same seed always gives the same sequence. SystemInit() seeds
+//! with 0.
+//!
+//! Not threadsafe; call from the emulation thread.
+//!
+//! \param[in,out] system system state to be updated
+//! \param[in] seed Any value
+//!
+//! \see SystemRandom()
+void
+SystemRandomSeed(struct system *system, unsigned long long seed);
+
+//! \brief Draws the next random byte, for CXNN
+//!
+//! Not threadsafe; call from the emulation thread.
+//!
+//! \param[in,out] system system state to be updated
+//! \return A number uniform over 0-255
+//!
+//! \see SystemRandomSeed()
+unsigned char
+SystemRandom(struct system *system);
+
 //! \brief Copies ROM into the CHIP-8's memory
 //! \param[in,out] system system state memory to be updated
 //! \param[in] rom program ROM to be loaded into CHIP-8
@@ -115,32 +158,22 @@ SystemStackPush(struct system *system);
 void
 SystemStackPop(struct system *system);
 
-//! \brief Atomically locks the CHIP-8's graphics memory
-//!
-//! Threadsafe.
-//!
-//! Lock graphics memory so a separate thread can use it for rendering.
-//!
-//! \param[in,out] system system state to be updated
-//! \return 0 if the lock is held otherwise non-zero
-int
-SystemGfxLock(struct system *system);
-
-//! \brief Atomically unlocks the CHIP-8's graphics memory
+//! \brief Returns the newest complete frame
 //!
-//! Threadsafe.
+//! Threadsafe for a single reader, normally the graphics thread.
 //!
-//! We need to lock graphics memory for rendering via a separate thread, this
-//! routine just unlocks it after that has been done.
+//! The emulation thread publishes a frame after each SystemRunCycles() batch
+//! that drew anything, or after each draw outside of a batch. Neither side
+//! ever waits for the other and a frame never shows a half-drawn sprite.
 //!
-//! \param[in,out] system system state to be updated.
-//! \return 0 if lock has been released otherwise non-zero
-int
-SystemGfxUnlock(struct system *system);
+//! \param[in,out] system system state to be read
+//! \return 64 x 32 pixels, valid until the next call
+const unsigned char *
+SystemGfxFrame(struct system *system);
 
 //! \brief resets CHIP-8's video memory to zeroes
 //!
-//! Threadsafe.
+//! Call from the emulation thread; other threads use SystemGfxFrame().
 //!
 //! \param[in,out] system system state to be updated.
 void
@@ -148,7 +181,7 @@ SystemClearScreen(struct system *system);
 
 //! \brief Draws a sprite in video memory
 //!
-//! Threadsafe.
+//! Call from the emulation thread; other threads use SystemGfxFrame().
 //!
 //! Display: Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels
 //! and a height of N pixels. Each row of 8 pixels is read as bit-coded starting
@@ -173,6 +206,8 @@ SystemDrawSprite(struct system *system, unsigned int x, unsigned int y, unsigned
 //! CHIP-8, indexed [0..F]
 //! Store that index in the specified register when it occurs.
 //!
+//! Only keys pressed after this call end the wait; see SystemWFKPoll().
+//!
 //! \param[in,out] system system state to be updated
 //! \param[in] reg which register to store the pressed hex key index in
 //!
@@ -214,6 +249,39 @@ SystemWFKWaiting(struct system *system);
 void
 SystemWFKOccurred(struct system *system, unsigned char key);
 
+//! \brief Stops waiting if a key has been pressed since SystemWFKSet()
+//!
+//! Compares the keypad's press count with the one recorded when the wait
+//! began, so a key that was already held doesn't count, and calls
+//! SystemWFKOccurred() with the key pressed most recently. Keeps the register
+//! write on the emulation thread. Called by SystemRunCycles().
+//!
+//! Not threadsafe; call from the emulation thread.
+//!
+//! \param[in,out] system system state to be updated
+//! \return non-zero if the wait just ended, otherwise 0
+//!
+//! \see SystemWFKSet()
+//! \see SystemWFKOccurred()
+int
+SystemWFKPoll(struct system *system);
+
+//! \brief Sleeps until a key ends the wait, the debugger is enabled or the
+//! program quits
+//!
+//! Uses no CPU while waiting: key presses, SystemDebugSetEnabled() and
+//! SystemSignalQuit() wake it. Returns immediately if the system isn't waiting
+//! for a key. The wait itself carries on while debugging.
+//!
+//! Not threadsafe; call from the emulation thread.
+//!
+//! \param[in,out] system system state to be updated
+//! \return non-zero if a key ended the wait, otherwise 0
+//!
+//! \see SystemWFKPoll()
+int
+SystemWFKBlock(struct system *system);
+
 //! \brief Has the system just transitioned out of a WFK state?
 //!
 //! Threadsafe.
@@ -249,10 +317,71 @@ SystemWFKStop(struct system *system);
 //!
 //! Threadsafe.
 //!
+//! Timers count down at 60Hz by themselves, their values worked out from the
+//! clock when read. While the debugger is enabled that clock stops and the
+//! debugger calls this once per step instead.
+//!
 //! \param[in,out] system system state to be updated
+//!
+//! \see SystemVirtualTimeSet()
 void
 SystemDecrementTimers(struct system *system);
 
+//! \brief Runs emulated time off instructions executed instead of the clock
+//!
+//! In virtual time every cyclesHz / 60 instruction periods make a tick,
+//! spread evenly when that doesn't divide. SystemRunCycles() ends each tick by
+//! decrementing the timers, which triggers sound, and by publishing the frame
+//! for SystemGfxFrame(), so a program's output depends only on the
+//! instructions it ran and the keys it saw, not on how fast the host is.
+//! Periods spent waiting for a key pass idle, so timers keep counting.
+//!
+//! The timer clock stays stopped while in virtual time.
+//!
+//! Not threadsafe; call from the emulation thread.
+//!
+//! \param[in,out] system system state to be updated
+//! \param[in] cyclesHz Instructions per emulated second, or 0 to go back to
+//!            the clock
+//!
+//! \see SystemVirtualTicks()
+void
+SystemVirtualTimeSet(struct system *system, unsigned int cyclesHz);
+
+//! \brief Whether emulated time is virtual
+//!
+//! Threadsafe.
+//!
+//! \param[in] system system state to be read
+//! \return Instructions per emulated second, or 0 while timers run off the clock
+//!
+//! \see SystemVirtualTimeSet()
+unsigned int
+SystemVirtualTime(struct system *system);
+
+//! \brief Counts ticks of virtual time
+//!
+//! Threadsafe.
+//!
+//! \param[in] system system state to be read
+//! \return Ticks completed since SystemInit()
+//!
+//! \see SystemVirtualTimeSet()
+unsigned long long
+SystemVirtualTicks(struct system *system);
+
+//! \brief Instruction periods left before the next virtual tick
+//!
+//! Not threadsafe; call from the emulation thread.
+//!
+//! \param[in] system system state to be read
+//! \return Periods until SystemRunCycles() ends the current tick, or 0 while
+//!         timers run off the clock
+//!
+//! \see SystemVirtualTimeSet()
+unsigned int
+SystemVirtualTickRemaining(struct system *system);
+
 //! \brief Returns the value of the delay timer
 //!
 //! Threadsafe.
@@ -305,6 +434,18 @@ SystemSoundTriggered(struct system *system);
 void
 SystemSoundSetTrigger(struct system *system, int triggeredStatus);
 
+//! \brief Sleeps until sound is triggered, a deadline passes or the program quits
+//!
+//! Threadsafe.
+//! Called by SoundThread() so that it uses no CPU between beeps.
+//!
+//! \param[in,out] system system state to be read
+//! \param[in] deadline CLOCK_MONOTONIC time to give up at, or NULL to wait indefinitely
+//! \return non-zero if sound has been triggered, otherwise 0
+//! \see SystemSoundTriggered()
+int
+SystemSoundWait(struct system *system, const struct timespec *deadline);
+
 //! \brief Returns whether the system is in a "Ready to Shutdown" state.
 //!
 //! Threadsafe.
@@ -320,125 +461,105 @@ SystemShouldQuit(struct system *system);
 void
 SystemSignalQuit(struct system *system);
 
-//! \brief Has the embedded graphical debugger been enabled?
+//! \brief Returns whether the user is holding fast-forward
 //!
 //! Threadsafe.
 //!
 //! \param[in] system system state to be read
-//! \return 0 if debugging is _NOT_ enabled, otherwise non-zero
-//!
-//! \see SystemDebugSetEnabled()
-//! \see SystemDebugShouldFetchAndDecode()
-//! \see SystemDebugShouldExecute()
-//! \see SystemDebugSetFetchAndDecode()
-//! \see SystemDebugSetExecute()
-//! \see main()
-//! \see TimerThread()
+//! \return 1 while fast-forwarding, otherwise 0
 int
-SystemDebugIsEnabled(struct system *system);
+SystemFastForward(struct system *system);
 
-//! \brief Tell the system to enable or disable the embedded graphical debugger
+//! \brief Starts or stops fast-forwarding
 //!
-//! Threadsafe.
-//!
-//! \param[in] system system state to be udpated
-//! \param[in,out] onOrOff 0 to disable debugger, or non-zero to enable
+//! Threadsafe. The emulation loop stops pacing itself while this is on, and
+//! graphics and sound skip most of their work.
 //!
-//! \see SystemDebugIsEnabled()
-//! \see SystemDebugShouldFetchAndDecode()
-//! \see SystemDebugShouldExecute()
-//! \see SystemDebugSetFetchAndDecode()
-//! \see SystemDebugSetExecute()
-//! \see UIWidgets()
+//! \param[in,out] system system state to be updated
+//! \param[in] onOrOff 1 to fast-forward, 0 to run at normal speed
 void
-SystemDebugSetEnabled(struct system *system, int onOrOff);
+SystemFastForwardSet(struct system *system, int onOrOff);
+
+//! Commands the debugger UI posts to the emulation thread
+enum system_debug_command {
+        SYSTEM_DEBUG_NONE, //!< No command is pending
+        SYSTEM_DEBUG_STEP, //!< Execute argument instructions, then pause
+        SYSTEM_DEBUG_RUN_TO, //!< Run at normal speed until pc is argument, then pause
+        SYSTEM_DEBUG_BREAK, //!< Stop whatever is running and pause
+        SYSTEM_DEBUG_CONTINUE, //!< Leave the debugger
+};
 
-//! \brief Should the system perform opcode fetch and decode?
+//! \brief Has the embedded graphical debugger been enabled?
 //!
 //! Threadsafe.
 //!
-//! When the debugging UI is enabled, we need to stop the normal flow of:
-//! opcode:fetch -> opcode:decode -> opcode:execute.
-//!
-//! This query tells us whether it is time to do one step through that flow or
-//! not.
-//!
 //! \param[in] system system state to be read
-//! \return 0 if fetch and decode should _not_ happen, otherwise non-zero
+//! \return 0 if debugging is _NOT_ enabled, otherwise non-zero
 //!
-//! \see SystemDebugIsEnabled()
 //! \see SystemDebugSetEnabled()
-//! \see SystemDebugShouldExecute()
-//! \see SystemDebugSetFetchAndDecode()
-//! \see SystemDebugSetExecute()
+//! \see SystemDebugPost()
 //! \see main()
 int
-SystemDebugShouldFetchAndDecode(struct system *system);
+SystemDebugIsEnabled(struct system *system);
 
-//! \brief Should the system perform opcode execution?
+//! \brief Tell the system to enable or disable the embedded graphical debugger
 //!
 //! Threadsafe.
 //!
-//! When the debugging UI is enabled, we need to stop the normal flow of:
-//! opcode:fetch -> opcode:decode -> opcode:execute.
-//!
-//! This query tells us whether opcode execution should occur this "tick."
-//!
-//! After doing a fetch and decode, we usually want to inspect the system state
-//! in the debugger, so we don't want to automatically perform the execute. We
-//! need a pause between fetch+decode and then execute.
+//! The delay and sound timers stop while the debugger is enabled.
 //!
-//! \param[in] system system state to be read
-//! \return 0 if execute should _not_ happen, otherwise non-zero
+//! \param[in] system system state to be udpated
+//! \param[in,out] onOrOff 0 to disable debugger, or non-zero to enable
 //!
 //! \see SystemDebugIsEnabled()
-//! \see SystemDebugSetEnabled()
-//! \see SystemDebugShouldFetchAndDecode()
-//! \see SystemDebugSetFetchAndDecode()
-//! \see SystemDebugSetExecute()
-//! \see main()
-int
-SystemDebugShouldExecute(struct system *system);
+//! \see SystemDebugPost()
+//! \see UIWidgets()
+void
+SystemDebugSetEnabled(struct system *system, int onOrOff);
 
-//! \brief Tell the system whether fetch and decode should occur this tick or not.
+//! \brief Sends a command to the debugger on the emulation thread
 //!
 //! Threadsafe.
 //!
-//! When the debugging UI is enabled, we need to stop the normal flow of:
-//! opcode:fetch -> opcode:decode -> opcode:execute.
+//! Only the latest command is kept; one posted before the last was taken
+//! replaces it.
 //!
 //! \param[in,out] system system state to be updated
-//! \param[in] onOrOff 0 to indicate fetch and decode should _not_ occur, otherwise non-zero
+//! \param[in] command What to do
+//! \param[in] argument Instruction count or address, up to 0x0FFFFFFF
 //!
-//! \see SystemDebugIsEnabled()
-//! \see SystemDebugSetEnabled()
-//! \see SystemDebugShouldFetchAndDecode()
-//! \see SystemDebugShouldExecute()
-//! \see SystemDebugSetExecute()
-//! \see main()
+//! \see SystemDebugTake()
+//! \see SystemDebugWait()
 //! \see UIWidgets()
 void
-SystemDebugSetFetchAndDecode(struct system *system, int onOrOff);
+SystemDebugPost(struct system *system, enum system_debug_command command, unsigned int argument);
 
-//! \brief Tell the system whether execute should occur this tick or not.
+//! \brief Takes the pending debugger command, if any
 //!
 //! Threadsafe.
 //!
-//! When the debugging UI is enabled, we need to stop the normal flow of:
-//! opcode:fetch -> opcode:decode -> opcode:execute.
+//! \param[in,out] system system state to be updated
+//! \param[out] argument Argument posted with the command
+//! \return The command, or SYSTEM_DEBUG_NONE if nothing is pending
+//!
+//! \see SystemDebugPost()
+enum system_debug_command
+SystemDebugTake(struct system *system, unsigned int *argument);
+
+//! \brief Sleeps until a debugger command is posted, then takes it
+//!
+//! Threadsafe.
+//! Uses no CPU while the debugger is paused. Also returns, with
+//! SYSTEM_DEBUG_NONE, when the debugger is disabled or the program quits.
 //!
 //! \param[in,out] system system state to be updated
-//! \param[in] onOrOff 0 to indicate execute should _not_ occur, otherwise non-zero
+//! \param[out] argument Argument posted with the command
+//! \return The command
 //!
-//! \see SystemDebugIsEnabled()
-//! \see SystemDebugSetEnabled()
-//! \see SystemDebugShouldFetchAndDecode()
-//! \see SystemDebugShouldExecute()
-//! \see SystemDebugSetFetchAndDecode()
-//! \see main()
-//! \see UIWidgets()
-void
-SystemDebugSetExecute(struct system *system, int onOrOff);
+//! \see SystemDebugPost()
+//! \see SystemDebugTake()
+enum system_debug_command
+SystemDebugWait(struct system *system, unsigned int *argument);
 
 //! \brief Is the key at the given index pressed?
 //!
@@ -460,7 +581,9 @@ SystemKeyIsPressed(struct system *system, int key);
 //!
 //! Threadsafe.
 //!
-//! Called via InputCheck() in input.c.
+//! Called via InputCheck() in input.c. The whole keypad is one atomic word;
+//! only actual changes count as edges, so repeated key down events for a held
+//! key are ignored.
 //!
 //! \param[in,out] system system state to be updated
 //! \param[in] key Index of hex key that has been pressed [0..F]
@@ -470,4 +593,54 @@ SystemKeyIsPressed(struct system *system, int key);
 void
 SystemKeySetPressed(struct system *system, int key, int pressed);
 
+//! \brief Returns every key's state at once
+//!
+//! Threadsafe.
+//!
+//! \param[in] system system state to be read
+//! \return Bit N set if key N is pressed
+//!
+//! \see SystemKeySetPressed()
+unsigned short
+SystemKeyMask(struct system *system);
+
+//! \brief Counts key presses and releases
+//!
+//! Threadsafe.
+//!
+//! \param[in] system system state to be read
+//! \return The number of presses and releases since SystemInit(), wrapping
+//!
+//! \see SystemKeySetPressed()
+unsigned int
+SystemKeyEdges(struct system *system);
+
+//! \brief Runs up to n instructions in a tight loop
+//!
+//! Shared state is sampled once per batch rather than once per instruction:
+//! nothing runs if the system should quit, the debugger is enabled or a key is
+//! still being waited for (see SystemWFKPoll()); and for the whole batch SystemKeyIsPressed() and
+//! SystemDelayTimer() return the key and delay timer states as they were when
+//! the batch started, without touching shared state. Other threads are
+//! unaffected.
+//!
+//! Returns early after FX0A, which starts waiting for a key, and at unknown
+//! instructions, exactly like OpcodeRun(). If the batch drew anything, the
+//! result is then published for SystemGfxFrame().
+//!
+//! In virtual time the batch is split at tick boundaries and frames are only
+//! published as ticks end. While waiting for a key the n periods pass idle;
+//! see SystemVirtualTimeSet().
+//!
+//! Not threadsafe; call from the emulation thread.
+//!
+//! \param[in,out] system system state to be updated
+//! \param[in,out] opcode Opcode state used to run instructions
+//! \param[in] n Maximum number of instructions to run
+//! \return The number of instructions executed
+//!
+//! \see OpcodeRun()
+unsigned int
+SystemRunCycles(struct system *system, struct opcode *opcode, unsigned int n);
+
 #endif // SYSTEM_VERSION
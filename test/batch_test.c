@@ -0,0 +1,128 @@
+/******************************************************************************
+  File: batch_test.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+#include <stdio.h>
+#include <unistd.h> // close, unlink, write
+
+#include "gstest.h"
+
+// batch.c is a program of its own; keep its main() out of the way.
+#define main BatchMain
+#include "../batch.c"
+#undef main
+
+int GSTestNumTestsRun = 0;
+char GSTestErrMsg[GSTestErrMsgSize];
+
+//------------------------------------------------------------------------------
+// Helper functions and globals
+//------------------------------------------------------------------------------
+
+//! \brief Writes a ROM to a new temporary file
+//! \param[out] path Buffer of at least 32 bytes for the file's path
+//! \param[in] rom Program to write
+//! \param[in] size Size of rom in bytes
+//! \return 1 on success, otherwise 0
+static int WriteRom(char *path, const unsigned char *rom, size_t size) {
+        strcpy(path, "/tmp/batch_test_XXXXXX");
+        int fd = mkstemp(path);
+        if (fd < 0) {
+                return 0;
+        }
+
+        int ok = (write(fd, rom, size) == (ssize_t)size);
+        close(fd);
+        return ok;
+}
+
+//------------------------------------------------------------------------------
+// Tests
+//------------------------------------------------------------------------------
+
+char *TestBatchScenarioKeyWait() {
+        unsigned char program[] = {
+                0xF0, 0x0A, // 0x200: Wait for a key, storing it in V0
+                0x12, 0x06, // 0x202: Goto 0x206
+                0xFF, 0xFF, // 0x204: Unknown; only reached if 0x202 is skipped
+                0x12, 0x06, // 0x206: Goto 0x206
+        };
+        char path[32];
+        GSTestAssert(WriteRom(path, program, sizeof(program)), "couldn't write %s", path);
+
+        char line[64];
+        snprintf(line, sizeof(line), "%s frames=5 keys=2:3+", path);
+
+        struct headless_job defaults = { 0, 0, NULL, 0, 0 };
+        enum opcode_engine engines[] = { OPCODE_ENGINE_REFERENCE, OPCODE_ENGINE_THREADED, OPCODE_ENGINE_JIT };
+
+        for (int e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+                struct batch_job job;
+                int ok = ParseScenario(line, &defaults, &job);
+                GSTestAssert(ok, "couldn't parse \"%s\"", line);
+                GSTestAssert(job.run.keyCount == 1, "got %d keys, want %d", job.run.keyCount, 1);
+                GSTestAssert(job.run.keys[0].frame == 2 && job.run.keys[0].key == 3 && job.run.keys[0].pressed,
+                             "got %llu:%X%c, want 2:3+", job.run.keys[0].frame, job.run.keys[0].key, job.run.keys[0].pressed ? '+' : '-');
+
+                // The press at frame 2 ends the wait; the jump after FX0A must still run.
+                struct batch batch = { .engine = engines[e], .profile = OPCODE_PROFILE_DEFAULT };
+                BatchRunJob(&batch, &job);
+                GSTestAssert(job.error == NULL, "engine %d: %s", engines[e], job.error);
+                GSTestAssert(!job.result.unknownInstruction, "engine %d: skipped the instruction after FX0A", engines[e]);
+                GSTestAssert(job.result.frames == 5, "engine %d: got %llu frames, want %d", engines[e], job.result.frames, 5);
+
+                free(job.rom);
+                free(job.scenario);
+                free((void *)job.run.keys);
+        }
+
+        unlink(path);
+
+        return NULL;
+}
+
+char *TestBatchScenarioNumbers() {
+        struct headless_job defaults = { 0, 0, NULL, 0, 0 };
+        struct batch_job job;
+
+        const char *good = "PONG cycles=100 frames=20 seed=0x10";
+        int ok = ParseScenario(good, &defaults, &job);
+        GSTestAssert(ok, "couldn't parse \"%s\"", good);
+        GSTestAssert(job.run.cycles == 100, "got %llu, want %d", job.run.cycles, 100);
+        GSTestAssert(job.run.frames == 20, "got %llu, want %d", job.run.frames, 20);
+        GSTestAssert(job.run.seed == 16, "got %llu, want %d", job.run.seed, 16);
+        free(job.rom);
+        free(job.scenario);
+
+        const char *bad[] = { "PONG cycles=", "PONG cycles=10k", "PONG frames=x", "PONG frames=20.5", "PONG seed=0x", "PONG seed=12z" };
+        for (int i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+                ok = ParseScenario(bad[i], &defaults, &job);
+                GSTestAssert(!ok, "parsed \"%s\"", bad[i]);
+                free(job.rom);
+                free(job.scenario);
+        }
+
+        return NULL;
+}
+
+static char *RunAllTests() {
+        GSTestRun(TestBatchScenarioKeyWait);
+        GSTestRun(TestBatchScenarioNumbers);
+        return NULL;
+}
+
+int main(int argC, char **argV) {
+        printf("batch_test:\n");
+        char *result = RunAllTests();
+        if (result != NULL) {
+                printf("\t%s\n", result);
+        } else {
+                printf("\tALL TESTS PASSED\n");
+        }
+        printf("\ttests run: %d\n", GSTestNumTestsRun);
+
+        return result != NULL;
+}
@@ -36,6 +36,66 @@ void free(void *p) {
         libcFree(p);
 }
 
+//! Exercises calls, loops, skips, arithmetic, BCD stores and drawing.
+unsigned char testProgram[] = {
+        0x6A, 0x0A, // 0x200: VA = 10
+        0x6B, 0x00, // 0x202: VB = 0
+        0xA3, 0x00, // 0x204: I = 0x300
+        0x22, 0x12, // 0x206: Call 0x212
+        0x7A, 0xFF, // 0x208: VA -= 1
+        0x3A, 0x00, // 0x20A: Skip if VA == 0
+        0x12, 0x06, // 0x20C: Goto 0x206
+        0xFB, 0x33, // 0x20E: BCD of VB at I
+        0x12, 0x10, // 0x210: Goto 0x210
+        0x7B, 0x07, // 0x212: VB += 7
+        0x8C, 0xB0, // 0x214: VC = VB
+        0x8C, 0xA4, // 0x216: VC += VA
+        0x8C, 0xBE, // 0x218: VC <<= 1
+        0x4C, 0x00, // 0x21A: Skip if VC != 0
+        0x00, 0xE0, // 0x21C: Clear screen
+        0xDA, 0xB5, // 0x21E: Draw 5 rows at (VA, VB)
+        0x00, 0xEE, // 0x220: Return
+};
+
+//! System state captured after running testProgram
+struct test_snapshot {
+        unsigned char v[16];
+        unsigned short i;
+        unsigned short pc;
+        unsigned short sp;
+        unsigned char bcd[3];
+        unsigned char gfx[64 * 32];
+        unsigned int executed;
+};
+
+//! \brief Runs testProgram with the given engine and captures the result
+//! \param[in] engine Engine used by OpcodeRun()
+//! \param[in] batch Instructions to execute per call to OpcodeRun()
+//! \param[in] count Total instructions to execute
+//! \param[out] snapshot Captured state
+void RunTestProgram(enum opcode_engine engine, unsigned int batch, unsigned int count, struct test_snapshot *snapshot) {
+        struct system *s = SystemInit(0);
+        struct opcode *c = OpcodeInit();
+        SystemLoadProgram(s, testProgram, sizeof(testProgram));
+        OpcodeSetEngine(c, engine);
+
+        memset(snapshot, 0, sizeof(struct test_snapshot));
+        while (snapshot->executed < count) {
+                unsigned int remaining = count - snapshot->executed;
+                snapshot->executed += OpcodeRun(c, s, remaining < batch ? remaining : batch);
+        }
+
+        memcpy(snapshot->v, s->v, sizeof(snapshot->v));
+        snapshot->i = s->i;
+        snapshot->pc = s->pc;
+        snapshot->sp = s->sp;
+        memcpy(snapshot->bcd, &s->memory[0x300], sizeof(snapshot->bcd));
+        memcpy(snapshot->gfx, s->gfx, sizeof(snapshot->gfx));
+
+        OpcodeDeinit(c);
+        SystemDeinit(s);
+}
+
 //------------------------------------------------------------------------------
 // Tests
 //------------------------------------------------------------------------------
@@ -56,7 +116,7 @@ char *TestOpcodeInstruction() {
 char *TestOpcodeDescription() {
         struct opcode *c = OpcodeInit();
 
-        // c->debug_fn_map[34] = (struct opcode_fn_map){ "FX65", FnFX65, "Fill V0 through VX with values from memory starting at I" };
+        // OPCODE_FN_MAP[34] = { "FX65", FnFX65, "Fill V0 through VX with values from memory starting at I" }
         char *expected = "FX65: Fill V0 through VX with values from memory starting at I";
         unsigned short opcode = 0xF065;
         c->instruction = opcode;
@@ -165,6 +225,77 @@ char *TestOpcodeDecode() {
         return NULL;
 }
 
+char *TestOpcodeDecodeTable() {
+        struct opcode *c = OpcodeInit();
+
+        c->instruction = 0xD3A5;
+        OpcodeDecode(c);
+        GSTestAssert(c->fn == FnDXYN, "Expected c->fn(%p) to be FnDXYN(%p)", c->fn, FnDXYN);
+        GSTestAssert(c->decoded->x == 0x3, "got 0x%X, want 0x%X", c->decoded->x, 0x3);
+        GSTestAssert(c->decoded->y == 0xA, "got 0x%X, want 0x%X", c->decoded->y, 0xA);
+        GSTestAssert(c->decoded->n == 0x5, "got 0x%X, want 0x%X", c->decoded->n, 0x5);
+        GSTestAssert(c->decoded->nn == 0xA5, "got 0x%02X, want 0x%02X", c->decoded->nn, 0xA5);
+        GSTestAssert(c->decoded->nnn == 0x3A5, "got 0x%03X, want 0x%03X", c->decoded->nnn, 0x3A5);
+
+        c->instruction = 0x8008;
+        OpcodeDecode(c);
+        GSTestAssert(c->fn == NULL, "Expected c->fn(%p) to be NULL", c->fn);
+
+        OpcodeDeinit(c);
+
+        return NULL;
+}
+
+char *TestOpcodeName() {
+        const char *name = OpcodeName(0xD3A5);
+        GSTestAssert(name != NULL && strcmp(name, "DXYN") == 0, "got %s, want DXYN", name);
+
+        name = OpcodeName(0x00EE);
+        GSTestAssert(name != NULL && strcmp(name, "00EE") == 0, "got %s, want 00EE", name);
+
+        name = OpcodeName(0x8008);
+        GSTestAssert(name == NULL, "got %s, want NULL", name);
+
+        return NULL;
+}
+
+char *TestOpcodeInvalidate() {
+        struct system *s = SystemInit(0);
+        struct opcode *c = OpcodeInit();
+
+        // 0x200: FX55 with X=1, storing V0 and V1 over the instruction at 0x202.
+        s->memory[0x200] = 0xF1;
+        s->memory[0x201] = 0x55;
+        s->memory[0x202] = 0x60;
+        s->memory[0x203] = 0x01;
+
+        s->pc = 0x202;
+        OpcodeFetch(c, s);
+        GSTestAssert(0x6001 == c->instruction, "got 0x%04X, want 0x%04X", c->instruction, 0x6001);
+
+        s->pc = 0x200;
+        s->i = 0x202;
+        s->v[0] = 0x61;
+        s->v[1] = 0x23;
+        OpcodeFetch(c, s);
+        OpcodeDecode(c);
+        OpcodeExecute(c, s);
+
+        OpcodeFetch(c, s);
+        GSTestAssert(0x6123 == c->instruction, "got 0x%04X, want 0x%04X", c->instruction, 0x6123);
+
+        // Writes made outside of the opcode layer need an explicit invalidation.
+        s->memory[0x203] = 0x45;
+        OpcodeInvalidate(c, 0x203, 1);
+        OpcodeFetch(c, s);
+        GSTestAssert(0x6145 == c->instruction, "got 0x%04X, want 0x%04X", c->instruction, 0x6145);
+
+        OpcodeDeinit(c);
+        SystemDeinit(s);
+
+        return NULL;
+}
+
 char *TestOpcodeExecute() {
         struct system *s = SystemInit(0);
         struct opcode *c = OpcodeInit();
@@ -183,6 +314,209 @@ char *TestOpcodeExecute() {
         return NULL;
 }
 
+char *TestOpcodeRun() {
+        struct test_snapshot want, got;
+        RunTestProgram(OPCODE_ENGINE_REFERENCE, 1, 200, &want);
+
+        GSTestAssert(want.pc == 0x210, "got 0x%03X, want 0x%03X", want.pc, 0x210);
+        GSTestAssert(want.v[0xB] == 70, "got %d, want %d", want.v[0xB], 70);
+        GSTestAssert(want.bcd[0] == 0 && want.bcd[1] == 7 && want.bcd[2] == 0, "got %d%d%d, want 070", want.bcd[0], want.bcd[1], want.bcd[2]);
+
+        enum opcode_engine engines[] = { OPCODE_ENGINE_REFERENCE, OPCODE_ENGINE_THREADED, OPCODE_ENGINE_JIT };
+        unsigned int batches[] = { 1, 3, 200 };
+
+        for (int e = 0; e < ARRAY_LENGTH(engines); e++) {
+                for (int b = 0; b < ARRAY_LENGTH(batches); b++) {
+                        RunTestProgram(engines[e], batches[b], 200, &got);
+                        GSTestAssert(0 == memcmp(&want, &got, sizeof(want)), "engine %d with batch %d doesn't match the reference engine", engines[e], batches[b]);
+                }
+        }
+
+        return NULL;
+}
+
+char *TestOpcodeFusion() {
+        unsigned char program[] = {
+                0x60, 0x05, // 0x200: V0 = 5
+                0xF0, 0x15, // 0x202: Delay timer = V0
+                0x6A, 0x08, // 0x204: VA = 8
+                0x6B, 0x04, // 0x206: VB = 4
+                0xA2, 0x1A, // 0x208: I = 0x21A
+                0xDA, 0xB2, // 0x20A: Draw 2 rows at (VA, VB)
+                0x7C, 0x01, // 0x20C: VC += 1
+                0x3C, 0x05, // 0x20E: Skip if VC == 5
+                0x12, 0x04, // 0x210: Goto 0x204
+                0xF1, 0x07, // 0x212: V1 = delay timer
+                0x31, 0x00, // 0x214: Skip if V1 == 0
+                0x12, 0x12, // 0x216: Goto 0x212
+                0xF0, 0x90, // 0x218: Sprite data at 0x21A
+        };
+        unsigned int batches[] = { 1, 2, 3, 4, 100 };
+
+        for (int b = 0; b < ARRAY_LENGTH(batches); b++) {
+                unsigned char v[2][16];
+                unsigned char gfx[2][64 * 32];
+                unsigned short pc[2];
+                unsigned long fusions[OPCODE_FUSION_COUNT];
+
+                for (int e = 0; e < 2; e++) {
+                        struct system *s = SystemInit(0);
+                        struct opcode *c = OpcodeInit();
+                        SystemLoadProgram(s, program, sizeof(program));
+                        OpcodeSetEngine(c, e ? OPCODE_ENGINE_THREADED : OPCODE_ENGINE_REFERENCE);
+
+                        // Nothing decrements the delay timer, so this ends up waiting forever.
+                        for (unsigned int executed = 0; executed < 100;) {
+                                unsigned int remaining = 100 - executed;
+                                executed += OpcodeRun(c, s, remaining < batches[b] ? remaining : batches[b]);
+                        }
+
+                        memcpy(v[e], s->v, sizeof(v[e]));
+                        memcpy(gfx[e], s->gfx, sizeof(gfx[e]));
+                        pc[e] = s->pc;
+                        for (int f = 0; f < OPCODE_FUSION_COUNT; f++) {
+                                fusions[f] = OpcodeFusionCount(c, f);
+                        }
+
+                        OpcodeDeinit(c);
+                        SystemDeinit(s);
+                }
+
+                GSTestAssert(memcmp(v[0], v[1], sizeof(v[0])) == 0, "batch %d: registers don't match the reference engine", batches[b]);
+                GSTestAssert(memcmp(gfx[0], gfx[1], sizeof(gfx[0])) == 0, "batch %d: graphics don't match the reference engine", batches[b]);
+                GSTestAssert(pc[0] == pc[1], "batch %d: got pc 0x%03X, want 0x%03X", batches[b], pc[1], pc[0]);
+
+                if (batches[b] == 100) {
+                        GSTestAssert(fusions[OPCODE_FUSION_SPRITE] == 5, "got %lu, want %d", fusions[OPCODE_FUSION_SPRITE], 5);
+                        GSTestAssert(fusions[OPCODE_FUSION_COUNTED_LOOP] == 5, "got %lu, want %d", fusions[OPCODE_FUSION_COUNTED_LOOP], 5);
+                        GSTestAssert(fusions[OPCODE_FUSION_DELAY_WAIT] == 21, "got %lu, want %d", fusions[OPCODE_FUSION_DELAY_WAIT], 21);
+                }
+        }
+
+        return NULL;
+}
+
+char *TestOpcodeJit() {
+        unsigned char program[] = {
+                0x60, 0x05, // 0x200: V0 = 5
+                0x61, 0x01, // 0x202: V1 = 1
+                0x30, 0x05, // 0x204: Skip if V0 == 5
+                0x22, 0x20, // 0x206: Call 0x220
+                0x41, 0x05, // 0x208: Skip if V1 != 5
+                0x31, 0x00, // 0x20A: Skip if V1 == 0
+                0x72, 0x01, // 0x20C: V2 += 1
+                0xE1, 0x9E, // 0x20E: Skip if key V1 is pressed
+                0x73, 0x01, // 0x210: V3 += 1
+                0x70, 0x01, // 0x212: V0 += 1
+                0x12, 0x04, // 0x214: Goto 0x204
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                0x74, 0x01, // 0x220: V4 += 1
+                0x00, 0xEE, // 0x222: Return
+        };
+
+        // Skips branch within a block, and a block stops part way through
+        // once the batch runs out; neither may be visible to the caller.
+        for (unsigned int batch = 1; batch < 10; batch++) {
+                struct system *s[2];
+                struct opcode *c[2];
+
+                for (int e = 0; e < 2; e++) {
+                        s[e] = SystemInit(0);
+                        c[e] = OpcodeInit();
+                        SystemLoadProgram(s[e], program, sizeof(program));
+                        SystemKeySetPressed(s[e], 1, 1);
+                        OpcodeSetEngine(c[e], e ? OPCODE_ENGINE_JIT : OPCODE_ENGINE_REFERENCE);
+                }
+
+                for (int run = 0; run < 100; run++) {
+                        unsigned int want = OpcodeRun(c[0], s[0], batch);
+                        unsigned int got = OpcodeRun(c[1], s[1], batch);
+                        GSTestAssert(got == want, "batch %d, run %d: executed %d, want %d", batch, run, got, want);
+                        GSTestAssert(s[1]->pc == s[0]->pc, "batch %d, run %d: got pc 0x%03X, want 0x%03X", batch, run, s[1]->pc, s[0]->pc);
+                        GSTestAssert(OpcodeInstruction(c[1]) == OpcodeInstruction(c[0]), "batch %d, run %d: got instruction 0x%04X, want 0x%04X", batch, run, OpcodeInstruction(c[1]), OpcodeInstruction(c[0]));
+                        GSTestAssert(memcmp(s[1]->v, s[0]->v, sizeof(s[0]->v)) == 0, "batch %d, run %d: registers don't match the reference engine", batch, run);
+                }
+
+                for (int e = 0; e < 2; e++) {
+                        OpcodeDeinit(c[e]);
+                        SystemDeinit(s[e]);
+                }
+        }
+
+        return NULL;
+}
+
+char *TestOpcodeProfile() {
+        unsigned char program[] = {
+                0x60, 0x04, // 0x200: V0 = 4
+                0x62, 0x02, // 0x202: V2 = 2
+                0x6A, 0x05, // 0x204: VA = 5
+                0x6B, 0x81, // 0x206: VB = 0x81
+                0x8A, 0xB6, // 0x208: Shift right
+                0x8C, 0xF0, // 0x20A: VC = VF
+                0x6F, 0x07, // 0x20C: VF = 7
+                0x8A, 0xB1, // 0x20E: VA |= VB
+                0x8D, 0xF0, // 0x210: VD = VF
+                0x6F, 0x07, // 0x212: VF = 7
+                0x63, 0x01, // 0x214: V3 = 1
+                0x64, 0x01, // 0x216: V4 = 1
+                0x83, 0x44, // 0x218: V3 += V4
+                0x87, 0xF0, // 0x21A: V7 = VF
+                0xA3, 0x00, // 0x21C: I = 0x300
+                0xF1, 0x55, // 0x21E: Store V0, V1 at I
+                0xB2, 0x26, // 0x220: Jump to 0x226 + V0, or + V2
+                0x7E, 0x01, // 0x222: VE += 1
+                0x7E, 0x02, // 0x224: VE += 2
+                0x7E, 0x04, // 0x226: VE += 4
+                0x7E, 0x08, // 0x228: VE += 8
+                0x7E, 0x10, // 0x22A: VE += 0x10
+                0x12, 0x2C, // 0x22C: Goto 0x22C
+        };
+
+        // Registers and I each profile should end up with
+        struct {
+                enum opcode_profile profile;
+                unsigned char va, vc, vd, v7, ve;
+                unsigned short i;
+        } want[] = {
+                { OPCODE_PROFILE_DEFAULT, 0x83, 0x05, 0x07, 0x07, 0x1F, 0x22A },
+                { OPCODE_PROFILE_COSMAC_VIP, 0xC1, 0x01, 0x00, 0x00, 0x10, 0x302 },
+                { OPCODE_PROFILE_SCHIP, 0x83, 0x01, 0x07, 0x00, 0x18, 0x300 },
+                { OPCODE_PROFILE_XO_CHIP, 0xC1, 0x01, 0x07, 0x00, 0x10, 0x302 },
+        };
+        enum opcode_engine engines[] = { OPCODE_ENGINE_REFERENCE, OPCODE_ENGINE_THREADED, OPCODE_ENGINE_JIT };
+        unsigned int batches[] = { 1, 3, 100 };
+
+        for (int p = 0; p < ARRAY_LENGTH(want); p++) {
+                for (int e = 0; e < ARRAY_LENGTH(engines); e++) {
+                        for (int b = 0; b < ARRAY_LENGTH(batches); b++) {
+                                struct system *s = SystemInit(0);
+                                struct opcode *c = OpcodeInit();
+                                SystemLoadProgram(s, program, sizeof(program));
+                                OpcodeSetEngine(c, engines[e]);
+                                OpcodeSetProfile(c, want[p].profile);
+
+                                for (unsigned int executed = 0; executed < 100;) {
+                                        unsigned int remaining = 100 - executed;
+                                        executed += OpcodeRun(c, s, remaining < batches[b] ? remaining : batches[b]);
+                                }
+
+                                unsigned char got[] = { s->v[0xA], s->v[0xC], s->v[0xD], s->v[0x7], s->v[0xE] };
+                                unsigned char expected[] = { want[p].va, want[p].vc, want[p].vd, want[p].v7, want[p].ve };
+                                for (int r = 0; r < ARRAY_LENGTH(got); r++) {
+                                        GSTestAssert(got[r] == expected[r], "profile %d, engine %d, batch %d: register %d got 0x%02X, want 0x%02X", want[p].profile, engines[e], batches[b], r, got[r], expected[r]);
+                                }
+                                GSTestAssert(s->i == want[p].i, "profile %d, engine %d, batch %d: got I 0x%03X, want 0x%03X", want[p].profile, engines[e], batches[b], s->i, want[p].i);
+
+                                OpcodeDeinit(c);
+                                SystemDeinit(s);
+                        }
+                }
+        }
+
+        return NULL;
+}
+
 static char *RunAllTests() {
         GSTestRun(TestOpcodeInstruction);
         GSTestRun(TestOpcodeDescription);
@@ -193,7 +527,14 @@ static char *RunAllTests() {
         GSTestRun(TestOpcodeDeinit);
         GSTestRun(TestOpcodeFetch);
         GSTestRun(TestOpcodeDecode);
+        GSTestRun(TestOpcodeDecodeTable);
         GSTestRun(TestOpcodeExecute);
+        GSTestRun(TestOpcodeName);
+        GSTestRun(TestOpcodeInvalidate);
+        GSTestRun(TestOpcodeRun);
+        GSTestRun(TestOpcodeFusion);
+        GSTestRun(TestOpcodeJit);
+        GSTestRun(TestOpcodeProfile);
         return NULL;
 }
 
@@ -0,0 +1,174 @@
+/******************************************************************************
+  File: pacer_test.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+#include <stdio.h>
+
+#include "gstest.h"
+
+#define PACER_CLOCK
+#include "../pacer.h"
+#include "../pacer.c"
+
+int GSTestNumTestsRun = 0;
+char GSTestErrMsg[GSTestErrMsgSize];
+
+//------------------------------------------------------------------------------
+// Helper functions and globals
+//------------------------------------------------------------------------------
+
+static unsigned long long fakeNow = NS_PER_S; //!< The pacer's clock, in ns
+static unsigned long long fakeOversleep; //!< How late each sleep wakes up, in ns
+
+//! \brief Reads the fake clock
+static unsigned long long Now() {
+        return fakeNow;
+}
+
+//! \brief Moves the fake clock to the deadline, plus fakeOversleep
+static void SleepUntil(unsigned long long deadline) {
+        fakeNow = deadline + fakeOversleep;
+}
+
+//! \brief Moves the fake clock forward, as if working for the given milliseconds
+static void SleepMs(long ms) {
+        fakeNow += ms * 1000 * 1000ull;
+}
+
+//! \brief Milliseconds since start
+static double ElapsedMs(unsigned long long start) {
+        return NS_TO_MS((double)(Now() - start));
+}
+
+//------------------------------------------------------------------------------
+// Tests
+//------------------------------------------------------------------------------
+
+static char *TestPacerInit() {
+        struct pacer *pacer = PacerInit(100, 0);
+        GSTestAssert(pacer != NULL, "got %p, want non-NULL", (void *)pacer);
+
+        struct pacer_stats stats = PacerStats(pacer);
+        GSTestAssert(stats.waits == 0, "got %lu, want %d", stats.waits, 0);
+        GSTestAssert(stats.overruns == 0, "got %lu, want %d", stats.overruns, 0);
+
+        PacerDeinit(pacer);
+
+        return NULL;
+}
+
+static char *TestPacerWait() {
+        fakeOversleep = 1000 * 1000;
+        unsigned long long start = Now();
+        struct pacer *pacer = PacerInit(50, 0);
+
+        // Work shorter than the period doesn't add up as drift; only the last
+        // oversleep shows.
+        for (int i = 0; i < 10; i++) {
+                SleepMs(2);
+                unsigned int due = PacerWait(pacer);
+                GSTestAssert(due == 1, "got %u, want %d", due, 1);
+        }
+
+        double elapsed = ElapsedMs(start);
+        GSTestAssert(elapsed == 201, "got %.1fms, want %dms", elapsed, 201);
+
+        struct pacer_stats stats = PacerStats(pacer);
+        GSTestAssert(stats.waits == 10, "got %lu, want %d", stats.waits, 10);
+        GSTestAssert(stats.overruns == 0, "got %lu, want %d", stats.overruns, 0);
+        GSTestAssert(stats.jitterMeanMs == 1, "got %f, want %d", stats.jitterMeanMs, 1);
+        GSTestAssert(stats.jitterMaxMs == 1, "got %f, want %d", stats.jitterMaxMs, 1);
+
+        PacerDeinit(pacer);
+        fakeOversleep = 0;
+
+        return NULL;
+}
+
+static char *TestPacerCatchUp() {
+        struct pacer *pacer = PacerInit(100, 3);
+
+        // 25ms past the first deadline: that period plus two more are due.
+        SleepMs(35);
+        unsigned int due = PacerWait(pacer);
+        GSTestAssert(due == 3, "got %u, want %d", due, 3);
+
+        struct pacer_stats stats = PacerStats(pacer);
+        GSTestAssert(stats.overruns == 1, "got %lu, want %d", stats.overruns, 1);
+        GSTestAssert(stats.skipped == 0, "got %lu, want %d", stats.skipped, 0);
+
+        // Too far behind: 95ms past the next deadline. Catch up on three, skip
+        // the other six.
+        SleepMs(100);
+        due = PacerWait(pacer);
+        GSTestAssert(due == 4, "got %u, want %d", due, 4);
+
+        stats = PacerStats(pacer);
+        GSTestAssert(stats.overruns == 2, "got %lu, want %d", stats.overruns, 2);
+        GSTestAssert(stats.skipped == 6, "got %lu, want %d", stats.skipped, 6);
+
+        // Then back on schedule.
+        due = PacerWait(pacer);
+        GSTestAssert(due == 1, "got %u, want %d", due, 1);
+
+        PacerDeinit(pacer);
+
+        return NULL;
+}
+
+static char *TestPacerReset() {
+        struct pacer *pacer = PacerInit(100, 3);
+
+        SleepMs(50);
+        PacerReset(pacer);
+        unsigned int due = PacerWait(pacer);
+        GSTestAssert(due == 1, "got %u, want %d", due, 1);
+
+        struct pacer_stats stats = PacerStats(pacer);
+        GSTestAssert(stats.overruns == 0, "got %lu, want %d", stats.overruns, 0);
+
+        PacerDeinit(pacer);
+
+        return NULL;
+}
+
+static char *TestPacerSetHz() {
+        struct pacer *pacer = PacerInit(100, 0);
+
+        unsigned long long start = Now();
+        PacerSetHz(pacer, 20);
+        PacerWait(pacer);
+        PacerWait(pacer);
+
+        double elapsed = ElapsedMs(start);
+        GSTestAssert(elapsed == 100, "got %.1fms, want %dms", elapsed, 100);
+
+        PacerDeinit(pacer);
+
+        return NULL;
+}
+
+static char *RunAllTests() {
+        GSTestRun(TestPacerInit);
+        GSTestRun(TestPacerWait);
+        GSTestRun(TestPacerCatchUp);
+        GSTestRun(TestPacerReset);
+        GSTestRun(TestPacerSetHz);
+        return NULL;
+}
+
+int main(int argC, char **argV) {
+        printf("pacer_test:\n");
+        char *result = RunAllTests();
+        if (result != NULL) {
+                printf("\t%s\n", result);
+        } else {
+                printf("\tALL TESTS PASSED\n");
+        }
+        printf("\ttests run: %d\n", GSTestNumTestsRun);
+
+        return result != NULL;
+}
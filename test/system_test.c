@@ -6,10 +6,13 @@
   Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
  ******************************************************************************/
 #include <dlfcn.h> // dlsym, RTLD_NEXT
+#include <pthread.h>
 #include <stdio.h>
+#include <time.h> // nanosleep
 
 #include "gstest.h"
 
+#include "../opcode.h"
 #include "../system.h"
 #include "../system.c"
 
@@ -40,6 +43,32 @@ void free(void *p) {
         libcFree(p);
 }
 
+int failCondInit = 0; // Fail the Nth call to pthread_cond_init() from now; 0 for none.
+int mutexDestroyCount = 0;
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr) {
+        static int (*libcCondInit)(pthread_cond_t *, const pthread_condattr_t *) = NULL;
+        if (NULL == libcCondInit) {
+                *(void **)&libcCondInit = dlsym(RTLD_NEXT, "pthread_cond_init");
+        }
+
+        if (failCondInit > 0 && --failCondInit == 0) {
+                return -1;
+        }
+
+        return libcCondInit(cond, attr);
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex) {
+        static int (*libcMutexDestroy)(pthread_mutex_t *) = NULL;
+        if (NULL == libcMutexDestroy) {
+                *(void **)&libcMutexDestroy = dlsym(RTLD_NEXT, "pthread_mutex_destroy");
+        }
+
+        mutexDestroyCount++;
+        return libcMutexDestroy(mutex);
+}
+
 //------------------------------------------------------------------------------
 // Tests
 //------------------------------------------------------------------------------
@@ -49,16 +78,15 @@ static char *TestSystemInit() {
                 struct system *system = SystemInit(0);
 
                 GSTestAssert(system->prv != NULL, "got %p, didn't want %p", system->prv, NULL);
-                GSTestAssert(system->memory == MEMORY, "got %p, want %p", system->memory, MEMORY);
-                GSTestAssert(system->gfx == GFX, "got %p, want %p", system->gfx, GFX);
+                GSTestAssert(system->memory == system->prv->memory, "got %p, want %p", system->memory, system->prv->memory);
+                GSTestAssert(system->gfx == system->prv->gfx, "got %p, want %p", system->gfx, system->prv->gfx);
                 GSTestAssert(system->pc == 0x200, "got 0x%02x, want 0x%02x", system->pc, 0x200);
                 GSTestAssert(system->fontp == 0, "got %d, want %d", system->fontp, 0);
                 for (int i = 0; i < FONT_SIZE; i++) {
                         GSTestAssert(system->memory[i] == fontset[i], "got 0x%02x, want 0x%02x", system->memory[i], fontset[i]);
                 }
                 GSTestAssert(system->prv->debug.enabled == 0, "got %d, want %d", system->prv->debug.enabled, 0);
-                GSTestAssert(system->prv->debug.fetchAndDecode == 1, "got %d, want %d", system->prv->debug.fetchAndDecode, 1);
-                GSTestAssert(system->prv->debug.execute == 0, "got %d, want %d", system->prv->debug.execute, 0);
+                GSTestAssert(system->prv->debug.command == SYSTEM_DEBUG_NONE, "got %u, want %d", system->prv->debug.command, SYSTEM_DEBUG_NONE);
 
                 SystemDeinit(system);
         }
@@ -72,6 +100,52 @@ static char *TestSystemInit() {
         return NULL;
 }
 
+static char *TestSystemInitFailure() {
+        // SystemInit() sets up three sleeps; fail each in turn.
+        for (int n = 1; n <= 3; n++) {
+                int frees = customFreeCount;
+                int destroys = mutexDestroyCount;
+
+                failCondInit = n;
+                useCustomFree = 1;
+                struct system *system = SystemInit(0);
+                useCustomFree = 0;
+                failCondInit = 0;
+
+                GSTestAssert(system == NULL, "sleep %d: got %p, want %p", n, system, NULL);
+                GSTestAssert(customFreeCount - frees == 2, "sleep %d: got %d frees, want %d", n, customFreeCount - frees, 2);
+                GSTestAssert(mutexDestroyCount - destroys == n, "sleep %d: got %d mutexes destroyed, want %d", n, mutexDestroyCount - destroys, n);
+        }
+
+        return NULL;
+}
+
+static char *TestSystemInstances() {
+        struct system *a = SystemInit(0);
+        struct system *b = SystemInit(0);
+
+        unsigned char rom[] = { 0x12, 0x00 };
+        SystemLoadProgram(a, rom, sizeof(rom));
+        GSTestAssert(a->memory[0x200] == 0x12, "got 0x%02X, want 0x%02X", a->memory[0x200], 0x12);
+        GSTestAssert(b->memory[0x200] == 0x00, "got 0x%02X, want 0x%02X", b->memory[0x200], 0x00);
+
+        a->i = 0x200;
+        SystemDrawSprite(a, 0, 0, 1);
+        GSTestAssert(a->gfx[3] == 0xFF, "got 0x%02X, want 0x%02X", a->gfx[3], 0xFF);
+        GSTestAssert(b->gfx[3] == 0x00, "got 0x%02X, want 0x%02X", b->gfx[3], 0x00);
+
+        // A fresh instance doesn't disturb an existing one either.
+        struct system *c = SystemInit(0);
+        GSTestAssert(a->memory[0x200] == 0x12, "got 0x%02X, want 0x%02X", a->memory[0x200], 0x12);
+        GSTestAssert(a->gfx[3] == 0xFF, "got 0x%02X, want 0x%02X", a->gfx[3], 0xFF);
+
+        SystemDeinit(c);
+        SystemDeinit(b);
+        SystemDeinit(a);
+
+        return NULL;
+}
+
 static char *TestSystemDeinit() {
         struct system *system = SystemInit(0);
 
@@ -108,6 +182,41 @@ static char *TestSystemFontSprite() {
         return NULL;
 }
 
+static char *TestSystemRandom() {
+        struct system *a = SystemInit(0);
+        struct system *b = SystemInit(0);
+
+        // Instances with the same seed agree; other seeds don't.
+        int differ = 0;
+        SystemRandomSeed(b, 1);
+        for (int i = 0; i < 100; i++) {
+                differ |= SystemRandom(a) != SystemRandom(b);
+        }
+        GSTestAssert(differ, "Expected seeds %d and %d to give different numbers", 0, 1);
+
+        SystemRandomSeed(a, 42);
+        SystemRandomSeed(b, 42);
+        for (int i = 0; i < 100; i++) {
+                unsigned char got = SystemRandom(a);
+                unsigned char want = SystemRandom(b);
+                GSTestAssert(got == want, "got %u, want %u", got, want);
+        }
+
+        // Every byte comes up about equally often.
+        unsigned int counts[256] = { 0 };
+        for (int i = 0; i < 256 * 1024; i++) {
+                counts[SystemRandom(a)]++;
+        }
+        for (int value = 0; value < 256; value++) {
+                GSTestAssert(counts[value] > 896 && counts[value] < 1152, "got %u of %d, want about %d", counts[value], value, 1024);
+        }
+
+        SystemDeinit(a);
+        SystemDeinit(b);
+
+        return NULL;
+}
+
 static char *TestSystemLoadProgram() {
         struct system *system = SystemInit(0);
 
@@ -230,6 +339,528 @@ static char *TestSystemKey() {
        return NULL;
 }
 
+//! \brief Presses and releases one key many times
+//! \param[in,out] arg System whose key 0 or 1 is toggled, depending on the thread
+//! \return NULL
+static void *ToggleKey(void *arg) {
+        static atomic_int next = 0;
+        struct system *system = (struct system *)arg;
+        int key = atomic_fetch_add(&next, 1) & 1;
+
+        for (int n = 0; n < 100000; n++) {
+                SystemKeySetPressed(system, key, 1);
+                SystemKeySetPressed(system, key, 0);
+        }
+
+        return NULL;
+}
+
+static char *TestSystemKeyEdges() {
+        struct system *system = SystemInit(0);
+
+        SystemKeySetPressed(system, 3, 1);
+        SystemKeySetPressed(system, 3, 1); // Repeated key down isn't an edge.
+        SystemKeySetPressed(system, 0xA, 1);
+        SystemKeySetPressed(system, 3, 0);
+        SystemKeySetPressed(system, 5, 0); // Neither is releasing a released key.
+
+        GSTestAssert(SystemKeyMask(system) == 0x0400, "got 0x%04X, want 0x%04X", SystemKeyMask(system), 0x0400);
+        GSTestAssert(SystemKeyEdges(system) == 3, "got %u, want %u", SystemKeyEdges(system), 3);
+        SystemKeySetPressed(system, 0xA, 0);
+
+        // No edge is lost when two threads change keys at the same time.
+        pthread_t threads[2];
+        for (int i = 0; i < 2; i++) {
+                pthread_create(&threads[i], NULL, ToggleKey, system);
+        }
+        for (int i = 0; i < 2; i++) {
+                pthread_join(threads[i], NULL);
+        }
+
+        GSTestAssert(SystemKeyMask(system) == 0, "got 0x%04X, want 0x%04X", SystemKeyMask(system), 0);
+        GSTestAssert(SystemKeyEdges(system) == 4 + 400000, "got %u, want %u", SystemKeyEdges(system), 4 + 400000);
+
+        SystemDeinit(system);
+
+        return NULL;
+}
+
+static char *TestSystemWFKPoll() {
+        struct system *system = SystemInit(0);
+
+        // A key held before the wait began doesn't end it.
+        SystemKeySetPressed(system, 2, 1);
+        SystemWFKSet(system, 4);
+        GSTestAssert(SystemWFKPoll(system) == 0, "got %d, want %d", SystemWFKPoll(system), 0);
+        GSTestAssert(SystemWFKWaiting(system), "got %d, want non-zero", SystemWFKWaiting(system));
+
+        // A new press does, storing the key pressed last.
+        SystemKeySetPressed(system, 7, 1);
+        SystemKeySetPressed(system, 9, 1);
+        GSTestAssert(SystemWFKPoll(system) == 1, "got %d, want %d", 0, 1);
+        GSTestAssert(!SystemWFKWaiting(system), "got %d, want %d", SystemWFKWaiting(system), 0);
+        GSTestAssert(system->v[4] == 9, "got %d, want %d", system->v[4], 9);
+
+        // Nothing to do once the wait is over.
+        GSTestAssert(SystemWFKPoll(system) == 0, "got %d, want %d", 1, 0);
+
+        SystemDeinit(system);
+
+        return NULL;
+}
+
+//! \brief Presses a key, breaks into the debugger or quits, as V0 says, once
+//! the emulation thread is asleep
+static void *WakeWFK(void *arg) {
+        struct system *system = (struct system *)arg;
+        struct timespec delay = { 0, 20 * 1000 * 1000 };
+        nanosleep(&delay, NULL);
+
+        if (system->v[0] == 0) {
+                SystemKeySetPressed(system, 5, 1);
+        } else if (system->v[0] == 1) {
+                SystemDebugSetEnabled(system, 1);
+        } else {
+                SystemSignalQuit(system);
+        }
+
+        return NULL;
+}
+
+static char *TestSystemWFKBlock() {
+        struct system *system = SystemInit(0);
+        pthread_t thread;
+
+        // Not waiting: returns straight away.
+        GSTestAssert(SystemWFKBlock(system) == 0, "got %d, want %d", 1, 0);
+
+        // A press from another thread ends the wait.
+        SystemWFKSet(system, 3);
+        pthread_create(&thread, NULL, WakeWFK, system);
+        int ended = SystemWFKBlock(system);
+        pthread_join(thread, NULL);
+        GSTestAssert(ended == 1, "got %d, want %d", ended, 1);
+        GSTestAssert(!SystemWFKWaiting(system), "got %d, want %d", SystemWFKWaiting(system), 0);
+        GSTestAssert(system->v[3] == 5, "got %d, want %d", system->v[3], 5);
+
+        // So does the debugger, without a key; the wait carries on.
+        system->v[0] = 1;
+        SystemWFKSet(system, 3);
+        pthread_create(&thread, NULL, WakeWFK, system);
+        ended = SystemWFKBlock(system);
+        pthread_join(thread, NULL);
+        GSTestAssert(ended == 0, "got %d, want %d", ended, 0);
+        GSTestAssert(SystemWFKWaiting(system), "got %d, want non-zero", SystemWFKWaiting(system));
+        SystemDebugSetEnabled(system, 0);
+
+        // Quitting ends it too, without a key.
+        system->v[0] = 2;
+        SystemWFKSet(system, 3);
+        pthread_create(&thread, NULL, WakeWFK, system);
+        ended = SystemWFKBlock(system);
+        pthread_join(thread, NULL);
+        GSTestAssert(ended == 0, "got %d, want %d", ended, 0);
+        GSTestAssert(SystemWFKWaiting(system), "got %d, want non-zero", SystemWFKWaiting(system));
+
+        SystemDeinit(system);
+
+        return NULL;
+}
+
+static char *TestSystemRunCycles() {
+        unsigned char program[] = {
+                0x61, 0x05, // 0x200: V1 = 5
+                0xE1, 0x9E, // 0x202: Skip if key V1 is pressed
+                0x62, 0x01, // 0x204: V2 = 1
+                0xF2, 0x07, // 0x206: V2 = delay timer
+                0xF3, 0x0A, // 0x208: Wait for a key, storing it in V3
+                0x12, 0x00, // 0x20A: Goto 0x200
+        };
+
+        struct system *system = SystemInit(0);
+        struct opcode *opcode = OpcodeInit();
+        SystemLoadProgram(system, program, sizeof(program));
+
+        SystemDebugSetEnabled(system, 1);
+        unsigned int got = SystemRunCycles(system, opcode, 100);
+        GSTestAssert(got == 0, "got %d, want %d", got, 0);
+        SystemDebugSetEnabled(system, 0);
+
+        // Stops right after FX0A.
+        SystemKeySetPressed(system, 5, 1);
+        SystemSetTimers(system, 42, -1);
+        got = SystemRunCycles(system, opcode, 100);
+        GSTestAssert(got == 4, "got %d, want %d", got, 4);
+        GSTestAssert(system->v[2] == 42, "got %d, want %d", system->v[2], 42);
+        GSTestAssert(SystemWFKWaiting(system), "Expected to be waiting for a key");
+
+        got = SystemRunCycles(system, opcode, 100);
+        GSTestAssert(got == 0, "got %d, want %d", got, 0);
+
+        SystemWFKOccurred(system, 7);
+        SystemWFKStop(system);
+        SystemSignalQuit(system);
+        got = SystemRunCycles(system, opcode, 100);
+        GSTestAssert(got == 0, "got %d, want %d", got, 0);
+
+        OpcodeDeinit(opcode);
+        SystemDeinit(system);
+
+        return NULL;
+}
+
+static char *TestSystemRunCyclesAfterKeyWait() {
+        unsigned char program[] = {
+                0xF0, 0x0A, // 0x200: Wait for a key, storing it in V0
+                0x61, 0x05, // 0x202: V1 = 5
+                0x12, 0x04, // 0x204: Goto 0x204
+        };
+        enum opcode_engine engines[] = { OPCODE_ENGINE_REFERENCE, OPCODE_ENGINE_THREADED, OPCODE_ENGINE_JIT };
+
+        for (int e = 0; e < sizeof(engines) / sizeof(engines[0]); e++) {
+                struct system *system = SystemInit(0);
+                struct opcode *opcode = OpcodeInit();
+                SystemLoadProgram(system, program, sizeof(program));
+                OpcodeSetEngine(opcode, engines[e]);
+
+                unsigned int got = SystemRunCycles(system, opcode, 100);
+                GSTestAssert(got == 1, "engine %d: got %d, want %d", engines[e], got, 1);
+                GSTestAssert(system->pc == 0x202, "engine %d: got pc 0x%03X, want 0x%03X", engines[e], system->pc, 0x202);
+
+                // FX0A has already moved past itself; the press just ends the wait.
+                SystemKeySetPressed(system, 3, 1);
+                got = SystemRunCycles(system, opcode, 100);
+                GSTestAssert(got == 100, "engine %d: got %d, want %d", engines[e], got, 100);
+                GSTestAssert(system->v[0] == 3, "engine %d: got V0 %d, want %d", engines[e], system->v[0], 3);
+                GSTestAssert(system->v[1] == 5, "engine %d: got V1 %d, want %d", engines[e], system->v[1], 5);
+                GSTestAssert(system->pc == 0x204, "engine %d: got pc 0x%03X, want 0x%03X", engines[e], system->pc, 0x204);
+
+                OpcodeDeinit(opcode);
+                SystemDeinit(system);
+        }
+
+        return NULL;
+}
+
+//! \brief Alternately clears the screen and draws a 15-row sprite on it
+//! \param[in,out] arg System to be drawn on
+//! \return NULL
+static void *DrawRepeatedly(void *arg) {
+        struct system *system = (struct system *)arg;
+
+        while (!SystemShouldQuit(system)) {
+                SystemClearScreen(system);
+                SystemDrawSprite(system, 0, 0, 15);
+        }
+
+        return NULL;
+}
+
+static char *TestSystemGfxFrame() {
+        struct system *system = SystemInit(0);
+        const unsigned char *gfx;
+
+        memset(&system->memory[0x300], 0xFF, 15);
+        system->i = 0x300;
+        SystemDrawSprite(system, 0, 0, 15);
+        gfx = SystemGfxFrame(system);
+        GSTestAssert(memcmp(gfx, system->gfx, GRAPHICS_MEM_SIZE) == 0, "frame doesn't match %s", "gfx");
+
+        // Nothing new was drawn, so the same frame comes back.
+        GSTestAssert(SystemGfxFrame(system) == gfx, "got %p, want %p", SystemGfxFrame(system), gfx);
+
+        unsigned char sprite[GRAPHICS_MEM_SIZE];
+        memcpy(sprite, gfx, sizeof(sprite));
+
+        // Every frame must show either a whole sprite or none of it, however the
+        // drawing thread is interleaved with this one.
+        pthread_t drawer;
+        pthread_create(&drawer, NULL, DrawRepeatedly, system);
+
+        int torn = 0;
+        for (int n = 0; n < 20000; n++) {
+                gfx = SystemGfxFrame(system);
+
+                int lit = 0;
+                for (int p = 0; p < GRAPHICS_MEM_SIZE; p++) {
+                        lit += (gfx[p] != 0);
+                }
+
+                if (!(lit == 0 || memcmp(gfx, sprite, GRAPHICS_MEM_SIZE) == 0)) {
+                        torn++;
+                }
+        }
+
+        SystemSignalQuit(system);
+        pthread_join(drawer, NULL);
+
+        GSTestAssert(torn == 0, "got %d torn frames, want %d", torn, 0);
+
+        SystemDeinit(system);
+
+        return NULL;
+}
+
+static char *TestSystemGfxFrameBatch() {
+        unsigned char program[] = {
+                0x00, 0xE0, // 0x200: Clear screen
+                0xA2, 0x0A, // 0x202: I = 0x20A
+                0xD0, 0x01, // 0x204: Draw 1 row at (V0, V0)
+                0xD0, 0x01, // 0x206: Draw it again, erasing it
+                0x12, 0x00, // 0x208: Goto 0x200
+                0x80, 0x00, // 0x20A: Sprite data
+        };
+
+        struct system *system = SystemInit(0);
+        struct opcode *opcode = OpcodeInit();
+        SystemLoadProgram(system, program, sizeof(program));
+        OpcodeSetEngine(opcode, OPCODE_ENGINE_THREADED);
+
+        SystemRunCycles(system, opcode, 3);
+        GSTestAssert(SystemGfxFrame(system)[0] == 0xFF, "got 0x%02X, want 0x%02X", SystemGfxFrame(system)[0], 0xFF);
+
+        // The sprite is erased and redrawn within the batch; only the result
+        // is published.
+        SystemRunCycles(system, opcode, 5);
+        GSTestAssert(SystemGfxFrame(system)[0] == 0xFF, "got 0x%02X, want 0x%02X", SystemGfxFrame(system)[0], 0xFF);
+
+        SystemRunCycles(system, opcode, 1);
+        GSTestAssert(SystemGfxFrame(system)[0] == 0x00, "got 0x%02X, want 0x%02X", SystemGfxFrame(system)[0], 0x00);
+
+        OpcodeDeinit(opcode);
+        SystemDeinit(system);
+
+        return NULL;
+}
+
+//! \brief Triggers sound, or quits, once the sound thread is asleep
+static void *WakeSound(void *arg) {
+        struct system *system = (struct system *)arg;
+        struct timespec delay = { 0, 20 * 1000 * 1000 };
+        nanosleep(&delay, NULL);
+
+        if (SystemSoundTimer(system) == 0) {
+                SystemSoundSetTrigger(system, 1);
+        } else {
+                SystemSignalQuit(system);
+        }
+
+        return NULL;
+}
+
+//! \brief Sleeps for the given number of milliseconds
+static void SleepMs(long ms) {
+        struct timespec delay = { ms / 1000, (ms % 1000) * 1000 * 1000 };
+        nanosleep(&delay, NULL);
+}
+
+static char *TestSystemTimersCountDown() {
+        struct system *system = SystemInit(0);
+
+        // Timers count down at 60Hz on their own; 6 ticks is 100ms.
+        SystemSetTimers(system, 6, 200);
+        SleepMs(50);
+        int got = SystemDelayTimer(system);
+        GSTestAssert(got > 0 && got < 6, "got %d, want between %d and %d", got, 1, 5);
+        SleepMs(100);
+        got = SystemDelayTimer(system);
+        GSTestAssert(got == 0, "got %d, want %d", got, 0);
+        got = SystemSoundTimer(system);
+        GSTestAssert(got > 150 && got < 200, "got %d, want between %d and %d", got, 151, 199);
+
+        // They stop while debugging, apart from explicit ticks.
+        SystemDebugSetEnabled(system, 1);
+        SystemSetTimers(system, 10, -1);
+        SleepMs(50);
+        SystemDecrementTimers(system);
+        got = SystemDelayTimer(system);
+        GSTestAssert(got == 9, "got %d, want %d", got, 9);
+
+        // And carry on afterwards.
+        SystemDebugSetEnabled(system, 0);
+        SleepMs(200);
+        got = SystemDelayTimer(system);
+        GSTestAssert(got == 0, "got %d, want %d", got, 0);
+
+        SystemDeinit(system);
+
+        return NULL;
+}
+
+static char *TestSystemVirtualTime() {
+        unsigned char program[] = {
+                0xD0, 0x01, // 0x200: Draw 1 row of the "0" sprite at (V0, V0)
+                0xF0, 0x0A, // 0x202: Wait for a key, storing it in V0
+                0x12, 0x04, // 0x204: Goto 0x204
+        };
+
+        struct system *system = SystemInit(0);
+        struct opcode *opcode = OpcodeInit();
+        SystemLoadProgram(system, program, sizeof(program));
+
+        // Two instructions a tick, and the clock doesn't count.
+        SystemVirtualTimeSet(system, 2 * TIMER_HZ);
+        SystemSetTimers(system, 10, 10);
+        SleepMs(50);
+        int got = SystemDelayTimer(system);
+        GSTestAssert(got == 10, "got %d, want %d", got, 10);
+
+        // Drawing is presented when the tick ends.
+        unsigned int ran = SystemRunCycles(system, opcode, 1);
+        GSTestAssert(ran == 1, "got %u, want %d", ran, 1);
+        GSTestAssert(SystemGfxFrame(system)[0] == 0x00, "got 0x%02X, want 0x%02X", SystemGfxFrame(system)[0], 0x00);
+        got = SystemVirtualTickRemaining(system);
+        GSTestAssert(got == 1, "got %d, want %d", got, 1);
+
+        ran = SystemRunCycles(system, opcode, 5);
+        GSTestAssert(ran == 1, "got %u, want %d", ran, 1);
+        GSTestAssert(SystemGfxFrame(system)[0] == 0xFF, "got 0x%02X, want 0x%02X", SystemGfxFrame(system)[0], 0xFF);
+        GSTestAssert(SystemVirtualTicks(system) == 1, "got %llu, want %d", SystemVirtualTicks(system), 1);
+        got = SystemDelayTimer(system);
+        GSTestAssert(got == 9, "got %d, want %d", got, 9);
+
+        // Time passes while waiting for a key.
+        ran = SystemRunCycles(system, opcode, 4);
+        GSTestAssert(ran == 0, "got %u, want %d", ran, 0);
+        GSTestAssert(SystemVirtualTicks(system) == 3, "got %llu, want %d", SystemVirtualTicks(system), 3);
+        got = SystemSoundTimer(system);
+        GSTestAssert(got == 7, "got %d, want %d", got, 7);
+
+        // Leaving the debugger doesn't restart the clock.
+        SystemDebugSetEnabled(system, 1);
+        SystemDebugSetEnabled(system, 0);
+        SleepMs(50);
+        got = SystemDelayTimer(system);
+        GSTestAssert(got == 7, "got %d, want %d", got, 7);
+
+        // Until time is real again.
+        SystemVirtualTimeSet(system, 0);
+        got = SystemVirtualTickRemaining(system);
+        GSTestAssert(got == 0, "got %d, want %d", got, 0);
+        SleepMs(200);
+        got = SystemDelayTimer(system);
+        GSTestAssert(got == 0, "got %d, want %d", got, 0);
+
+        OpcodeDeinit(opcode);
+        SystemDeinit(system);
+
+        return NULL;
+}
+
+static char *TestSystemSoundWait() {
+        struct system *system = SystemInit(0);
+        pthread_t thread;
+
+        // Gives up at the deadline.
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        int triggered = SystemSoundWait(system, &deadline);
+        GSTestAssert(triggered == 0, "got %d, want %d", triggered, 0);
+
+        // Triggering from another thread wakes it.
+        pthread_create(&thread, NULL, WakeSound, system);
+        triggered = SystemSoundWait(system, NULL);
+        pthread_join(thread, NULL);
+        GSTestAssert(triggered != 0, "got %d, want non-zero", triggered);
+
+        // The sound timer reaching zero while triggered wakes it too.
+        SystemSoundSetTrigger(system, 0);
+        SystemSetTimers(system, -1, 1);
+        SystemSoundSetTrigger(system, 1);
+        GSTestAssert(!SystemSoundTriggered(system), "got %d, want %d", 1, 0);
+        SystemDecrementTimers(system);
+        triggered = SystemSoundWait(system, NULL);
+        GSTestAssert(triggered != 0, "got %d, want non-zero", triggered);
+
+        // Nothing ticks the sound timer, but it wakes when the timer runs out.
+        SystemSoundSetTrigger(system, 0);
+        SystemSetTimers(system, -1, 3);
+        SystemSoundSetTrigger(system, 1);
+        triggered = SystemSoundWait(system, NULL);
+        GSTestAssert(triggered != 0, "got %d, want non-zero", triggered);
+
+        // So does quitting, without a trigger.
+        SystemSoundSetTrigger(system, 0);
+        SystemSetTimers(system, -1, 200);
+        pthread_create(&thread, NULL, WakeSound, system);
+        triggered = SystemSoundWait(system, NULL);
+        pthread_join(thread, NULL);
+        GSTestAssert(triggered == 0, "got %d, want %d", triggered, 0);
+
+        SystemDeinit(system);
+
+        return NULL;
+}
+
+//! \brief Posts a debugger command, or resumes, once the debugger is asleep
+static void *WakeDebugger(void *arg) {
+        struct system *system = (struct system *)arg;
+        SleepMs(20);
+
+        if (SystemDelayTimer(system) == 0) {
+                SystemDebugPost(system, SYSTEM_DEBUG_RUN_TO, 0x230);
+        } else {
+                SystemDebugSetEnabled(system, 0);
+        }
+
+        return NULL;
+}
+
+static char *TestSystemDebugCommands() {
+        struct system *system = SystemInit(1);
+        pthread_t thread;
+        unsigned int argument;
+
+        // Nothing posted yet.
+        enum system_debug_command command = SystemDebugTake(system, &argument);
+        GSTestAssert(command == SYSTEM_DEBUG_NONE, "got %d, want %d", command, SYSTEM_DEBUG_NONE);
+
+        // A command is taken once, with its argument.
+        SystemDebugPost(system, SYSTEM_DEBUG_STEP, 5);
+        command = SystemDebugTake(system, &argument);
+        GSTestAssert(command == SYSTEM_DEBUG_STEP, "got %d, want %d", command, SYSTEM_DEBUG_STEP);
+        GSTestAssert(argument == 5, "got %u, want %d", argument, 5);
+        command = SystemDebugTake(system, &argument);
+        GSTestAssert(command == SYSTEM_DEBUG_NONE, "got %d, want %d", command, SYSTEM_DEBUG_NONE);
+
+        // Posting from another thread wakes a waiter.
+        pthread_create(&thread, NULL, WakeDebugger, system);
+        command = SystemDebugWait(system, &argument);
+        pthread_join(thread, NULL);
+        GSTestAssert(command == SYSTEM_DEBUG_RUN_TO, "got %d, want %d", command, SYSTEM_DEBUG_RUN_TO);
+        GSTestAssert(argument == 0x230, "got %X, want %X", argument, 0x230);
+
+        // So does leaving the debugger, without a command.
+        SystemSetTimers(system, 1, -1);
+        pthread_create(&thread, NULL, WakeDebugger, system);
+        command = SystemDebugWait(system, &argument);
+        pthread_join(thread, NULL);
+        GSTestAssert(command == SYSTEM_DEBUG_NONE, "got %d, want %d", command, SYSTEM_DEBUG_NONE);
+
+        SystemDeinit(system);
+
+        return NULL;
+}
+
+static char *TestSystemFastForward() {
+        struct system *system = SystemInit(0);
+
+        int got = SystemFastForward(system);
+        GSTestAssert(got == 0, "got %d, want %d", got, 0);
+
+        SystemFastForwardSet(system, 1);
+        got = SystemFastForward(system);
+        GSTestAssert(got == 1, "got %d, want %d", got, 1);
+
+        SystemFastForwardSet(system, 0);
+        got = SystemFastForward(system);
+        GSTestAssert(got == 0, "got %d, want %d", got, 0);
+
+        SystemDeinit(system);
+
+        return NULL;
+}
+
 static char *TestSystemQuit() {
         struct system *system = SystemInit(0);
 
@@ -252,7 +883,8 @@ static char *TestSystemQuit() {
 }
 
 static char *TestSystemTimers() {
-        struct system *system = SystemInit(0);
+        // Timers are stopped while debugging, so only SystemDecrementTimers() moves them.
+        struct system *system = SystemInit(1);
 
         int got, want;
 
@@ -348,28 +980,37 @@ static char *TestSystemWFK() {
 
 static char *RunAllTests() {
         GSTestRun(TestSystemInit);
+        GSTestRun(TestSystemInitFailure);
         GSTestRun(TestSystemDeinit);
+        GSTestRun(TestSystemInstances);
         GSTestRun(TestSystemIncrementPC);
         GSTestRun(TestSystemFontSprite);
+        GSTestRun(TestSystemRandom);
         GSTestRun(TestSystemLoadProgram);
         GSTestRun(TestSystemStackPush);
         GSTestRun(TestSystemStackPop);
-        // GSTestRun(TestSystemGfxLock);
-        // GSTestRun(TestSystemGfxUnlock);
+        GSTestRun(TestSystemGfxFrame);
+        GSTestRun(TestSystemGfxFrameBatch);
         // GSTestRun(TestSystemClearScreen);
         // GSTestRun(TestSystemDrawSprite);
         GSTestRun(TestSystemWFK);
         GSTestRun(TestSystemTimers);
+        GSTestRun(TestSystemTimersCountDown);
+        GSTestRun(TestSystemVirtualTime);
         // GSTestRun(TestSystemSoundTriggered);
         // GSTestRun(TestSystemSetTrigger);
+        GSTestRun(TestSystemSoundWait);
         GSTestRun(TestSystemQuit);
+        GSTestRun(TestSystemFastForward);
+        GSTestRun(TestSystemRunCycles);
+        GSTestRun(TestSystemRunCyclesAfterKeyWait);
         // GSTestRun(TestSystemDebugIsEnabled);
         // GSTestRun(TestSystemDebugSetEnabled);
-        // GSTestRun(TestSystemDebugShouldFetchAndDecode);
-        // GSTestRun(TestSystemDebugSetFetchAndExecute);
-        // GSTestRun(TestSystemDebugShouldExecute);
-        // GSTestRun(TestSystemDebugSetExecute);
+        GSTestRun(TestSystemDebugCommands);
         GSTestRun(TestSystemKey);
+        GSTestRun(TestSystemKeyEdges);
+        GSTestRun(TestSystemWFKPoll);
+        GSTestRun(TestSystemWFKBlock);
         return NULL;
 }
 
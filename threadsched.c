@@ -0,0 +1,182 @@
+/******************************************************************************
+  File: threadsched.c
+  Created: 2026-10-17
+  Updated: 2026-10-17
+  Author: Aaron Oman
+  Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
+ ******************************************************************************/
+//! \file threadsched.c
+//!
+//! CPU affinity and scheduling policy for the emulator's threads.
+//!
+//! Both are requests: a CPU that doesn't exist or a real-time policy the user
+//! isn't permitted (see RLIMIT_RTPRIO and CAP_SYS_NICE) is reported and the
+//! thread carries on as it was.
+
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h> // sysconf
+
+//! Threads that can be scheduled, in the order `--affinity` lists them
+enum thread_sched_role {
+        THREAD_SCHED_EMULATION,
+        THREAD_SCHED_GRAPHICS,
+        THREAD_SCHED_SOUND,
+        THREAD_SCHED_COUNT
+};
+
+//! Name of each enum thread_sched_role, for logging
+static const char *THREAD_SCHED_NAMES[THREAD_SCHED_COUNT] = { "emulation", "graphics", "sound" };
+
+//! Where and how a thread should run
+struct thread_sched {
+        int cpu; //!< CPU to pin to, or -1 to leave it to the kernel
+        int policy; //!< SCHED_OTHER, SCHED_FIFO or SCHED_RR
+        int priority; //!< Static priority; 0 for SCHED_OTHER
+};
+
+//! \brief Leaves every thread unpinned under SCHED_OTHER
+//! \param[out] scheds One entry per enum thread_sched_role
+void ThreadSchedDefaults(struct thread_sched scheds[THREAD_SCHED_COUNT]) {
+        for (int i = 0; i < THREAD_SCHED_COUNT; i++) {
+                scheds[i] = (struct thread_sched){ .cpu = -1, .policy = SCHED_OTHER, .priority = 0 };
+        }
+}
+
+//! \brief Parses `--affinity`: CPUs for emulation, graphics and sound
+//!
+//! A comma separated list such as `2,3,3`. Trailing threads may be left
+//! off, and an empty entry leaves that thread unpinned: `,3` only pins
+//! graphics.
+//!
+//! \param[out] scheds One entry per enum thread_sched_role
+//! \param[in] arg Option argument
+//! \return 1 on success, otherwise 0
+int ThreadSchedParseAffinity(struct thread_sched scheds[THREAD_SCHED_COUNT], const char *arg) {
+        for (int i = 0; i < THREAD_SCHED_COUNT; i++) {
+                if (*arg != ',' && *arg != '\0') {
+                        char *end;
+                        long cpu = strtol(arg, &end, 10);
+                        if (end == arg || cpu < 0 || cpu >= CPU_SETSIZE)
+                                return 0;
+                        scheds[i].cpu = cpu;
+                        arg = end;
+                }
+
+                if (*arg == '\0')
+                        return 1;
+                if (*arg != ',')
+                        return 0;
+                arg++;
+        }
+
+        return 0;
+}
+
+//! \brief Parses `--sched`: POLICY[:PRIORITY] for every thread
+//!
+//! POLICY is `fifo`, `rr` or `other`. PRIORITY defaults to the lowest the
+//! policy allows.
+//!
+//! \param[out] scheds One entry per enum thread_sched_role
+//! \param[in] arg Option argument
+//! \return 1 on success, otherwise 0
+int ThreadSchedParsePolicy(struct thread_sched scheds[THREAD_SCHED_COUNT], const char *arg) {
+        int policy;
+        size_t nameLen = strcspn(arg, ":");
+        if (nameLen == 4 && strncmp(arg, "fifo", 4) == 0) {
+                policy = SCHED_FIFO;
+        } else if (nameLen == 2 && strncmp(arg, "rr", 2) == 0) {
+                policy = SCHED_RR;
+        } else if (nameLen == 5 && strncmp(arg, "other", 5) == 0) {
+                policy = SCHED_OTHER;
+        } else {
+                return 0;
+        }
+
+        int priority = sched_get_priority_min(policy);
+        if (arg[nameLen] == ':') {
+                char *end;
+                priority = strtol(&arg[nameLen + 1], &end, 10);
+                if (*end != '\0' || end == &arg[nameLen + 1])
+                        return 0;
+        }
+
+        if (priority < sched_get_priority_min(policy) || priority > sched_get_priority_max(policy)) {
+                fprintf(stderr, "Priority %d is outside %d-%d for this policy\n", priority,
+                        sched_get_priority_min(policy), sched_get_priority_max(policy));
+                return 0;
+        }
+
+        for (int i = 0; i < THREAD_SCHED_COUNT; i++) {
+                scheds[i].policy = policy;
+                scheds[i].priority = priority;
+        }
+
+        return 1;
+}
+
+//! \brief Name of a scheduling policy
+//! \param[in] policy SCHED_OTHER, SCHED_FIFO, SCHED_RR or another policy
+//! \return Printable name
+const char *ThreadSchedPolicyName(int policy) {
+        switch (policy) {
+                case SCHED_OTHER: return "SCHED_OTHER";
+                case SCHED_FIFO: return "SCHED_FIFO";
+                case SCHED_RR: return "SCHED_RR";
+                default: return "unknown";
+        }
+}
+
+//! \brief Applies affinity and policy to a thread, and logs the outcome
+//!
+//! Each request that fails is logged and skipped. The line logged afterwards
+//! is read back from the thread, so it shows what's actually in effect.
+//!
+//! \param[in] name Name to log the thread as
+//! \param[in] thread Thread to schedule
+//! \param[in] sched What to request
+//! \return 1 if everything requested was applied, otherwise 0
+int ThreadSchedApply(const char *name, pthread_t thread, const struct thread_sched *sched) {
+        int applied = 1;
+        int err;
+
+        if (sched->cpu >= 0) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(sched->cpu, &cpus);
+                if (0 != (err = pthread_setaffinity_np(thread, sizeof(cpus), &cpus))) {
+                        fprintf(stderr, "%s thread: couldn't pin to cpu %d: %s\n", name, sched->cpu, strerror(err));
+                        applied = 0;
+                }
+        }
+
+        struct sched_param param = { .sched_priority = sched->priority };
+        if (0 != (err = pthread_setschedparam(thread, sched->policy, &param))) {
+                fprintf(stderr, "%s thread: couldn't use %s priority %d: %s\n", name,
+                        ThreadSchedPolicyName(sched->policy), sched->priority, strerror(err));
+                applied = 0;
+        }
+
+        int policy;
+        cpu_set_t cpus;
+        if (0 != pthread_getschedparam(thread, &policy, &param) ||
+            0 != pthread_getaffinity_np(thread, sizeof(cpus), &cpus)) {
+                return applied;
+        }
+
+        char cpuList[64] = "";
+        if (sched->cpu >= 0 || CPU_COUNT(&cpus) < sysconf(_SC_NPROCESSORS_ONLN)) {
+                int len = 0;
+                for (int cpu = 0; cpu < CPU_SETSIZE && len < (int)sizeof(cpuList) - 8; cpu++) {
+                        if (CPU_ISSET(cpu, &cpus))
+                                len += snprintf(&cpuList[len], sizeof(cpuList) - len, "%s%d", len ? "," : "", cpu);
+                }
+        } else {
+                strcpy(cpuList, "any");
+        }
+
+        fprintf(stderr, "%s thread: cpu %s, %s priority %d\n", name, cpuList, ThreadSchedPolicyName(policy), param.sched_priority);
+
+        return applied;
+}
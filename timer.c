@@ -1,7 +1,7 @@
 /******************************************************************************
  * File: timer.c
  * Created: 2019-07-14
- * Updated: 2016-07-31
+ * Updated: 2026-10-17
  * Creator: Aaron Oman
  * Notice: Creative Commons Attribution 4.0 International License (CC-BY 4.0)
  ******************************************************************************/
@@ -16,19 +16,34 @@
 #include <stdio.h> // fprintf
 
 //! \brief Queryable timer state used in soundthread.c
+//!
+//! Times are CLOCK_MONOTONIC, so the deadline can be slept on directly.
 struct timer {
-        struct timespec start;
+        struct timespec deadline; //!< When the timer fires
         unsigned int waitMs;
 };
 
+//! \brief Reset the timer
+//! \param[in,out] timer Timer state to reset
+void TimerReset(struct timer *timer) {
+        clock_gettime(CLOCK_MONOTONIC, &timer->deadline);
+
+        timer->deadline.tv_sec += timer->waitMs / 1000;
+        timer->deadline.tv_nsec += (long)(timer->waitMs % 1000) * 1000000;
+        if (timer->deadline.tv_nsec >= 1000000000) {
+                timer->deadline.tv_sec++;
+                timer->deadline.tv_nsec -= 1000000000;
+        }
+}
+
 //! \brief Returns a pointer to an initialized timer on the heap
 //! \param[in] ms Time in ms after which the timer is considered to have "fired"
 //! \return The initialized timer
 struct timer *TimerInit(unsigned int ms) {
         struct timer *timer = (struct timer *)malloc(sizeof(struct timer));;
 
-        clock_gettime(CLOCK_REALTIME, &timer->start);
         timer->waitMs = ms;
+        TimerReset(timer);
 
         return timer;
 }
@@ -38,24 +53,20 @@ struct timer *TimerInit(unsigned int ms) {
 //! \return 1 if the timer has "fired" otherwise 0
 int TimerHasElapsed(struct timer *timer) {
         struct timespec now;
-        clock_gettime(CLOCK_REALTIME, &now);
-
-        // Convert seconds to milliseconds.
-        double elapsedTime = (now.tv_sec - timer->start.tv_sec) * 1000;
-        // Convert nanoseconds to milliseconds.
-        elapsedTime += ((now.tv_nsec - timer->start.tv_nsec) / 1000000);
+        clock_gettime(CLOCK_MONOTONIC, &now);
 
-        if (elapsedTime >= timer->waitMs) {
-                return 1;
+        if (now.tv_sec != timer->deadline.tv_sec) {
+                return now.tv_sec > timer->deadline.tv_sec;
         }
 
-        return 0;
+        return now.tv_nsec >= timer->deadline.tv_nsec;
 }
 
-//! \brief Reset the timer
-//! \param[in,out] timer Timer state to reset
-void TimerReset(struct timer *timer) {
-        clock_gettime(CLOCK_REALTIME, &timer->start);
+//! \brief When the timer fires
+//! \param[in] timer Timer state to query
+//! \return CLOCK_MONOTONIC deadline, suitable for SystemSoundWait()
+const struct timespec *TimerDeadline(struct timer *timer) {
+        return &timer->deadline;
 }
 
 #endif // TIMER_VERSION
@@ -265,17 +265,36 @@ void UIWidgets(struct ui *ui, struct system *system, struct opcode *opcode) {
         nk_end(ui->ctx);
 
         if (nk_begin(ui->ctx, "Debugger", nk_rect(ui->widgetWidth * 3, 0, ui->widgetWidth, ui->widgetHeight / 2.0), NK_WINDOW_BORDER | NK_WINDOW_TITLE)) {
-                nk_layout_row_static(ui->ctx, 20, ui->widgetWidth - 40, 1);
+                // Commands go to the emulation thread, which sleeps until one arrives.
+                static char stepCount[16] = "10";
+                static int stepCountLen = 2;
+                static char runToAddress[16] = "200";
+                static int runToAddressLen = 3;
+
+                nk_layout_row_dynamic(ui->ctx, 20, 2);
                 if (nk_button_label(ui->ctx, "Step")) {
-                        SystemDebugSetFetchAndDecode(system, 0);
-                        SystemDebugSetExecute(system, 1);
+                        SystemDebugPost(system, SYSTEM_DEBUG_STEP, 1);
                 }
                 if (nk_button_label(ui->ctx, "Continue")) {
-                        SystemDebugSetEnabled(system, 0);
+                        SystemDebugPost(system, SYSTEM_DEBUG_CONTINUE, 0);
+                }
+
+                nk_edit_string(ui->ctx, NK_EDIT_SIMPLE, stepCount, &stepCountLen, 8, nk_filter_decimal);
+                if (nk_button_label(ui->ctx, "Step N")) {
+                        stepCount[stepCountLen] = '\0';
+                        SystemDebugPost(system, SYSTEM_DEBUG_STEP, strtoul(stepCount, NULL, 10));
                 }
+
+                nk_edit_string(ui->ctx, NK_EDIT_SIMPLE, runToAddress, &runToAddressLen, 5, nk_filter_hex);
+                if (nk_button_label(ui->ctx, "Run to")) {
+                        runToAddress[runToAddressLen] = '\0';
+                        SystemDebugPost(system, SYSTEM_DEBUG_RUN_TO, strtoul(runToAddress, NULL, 16));
+                }
+
+                nk_layout_row_dynamic(ui->ctx, 20, 1);
                 if (nk_button_label(ui->ctx, "Break")) {
-                        SystemDebugSetFetchAndDecode(system, 1);
                         SystemDebugSetEnabled(system, 1);
+                        SystemDebugPost(system, SYSTEM_DEBUG_BREAK, 0);
                 }
         }
         nk_end(ui->ctx);